@@ -0,0 +1,647 @@
+// Batch image editor
+//
+// Applies the same edits to many images without opening a window.
+// See editPipeline.h for the edits, and editPlan.h for how they are
+// run.
+//
+// Each image goes through three stages: decode, process, and encode.
+// Each stage has its own threads, and the stages are connected by
+// bounded queues.  A stage that gets ahead waits for the next one
+// when the queue between them is full.  So the number of images in
+// memory at once is at most the number of threads plus the queue
+// capacities.
+
+
+#include "coreHeaders.h"
+#include "image.h"
+#include "editPipeline.h"
+#include "editPlan.h"
+#include "boundedQueue.h"
+#include "imageFormats.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+EditPipeline pipeline;
+
+seq<string> inputFiles;
+string      outputDir;          // where to write the results, or empty to write next to the inputs
+ImageFormat outputFormat = UNKNOWN_FORMAT; // format of the results, or UNKNOWN_FORMAT for that of each input
+
+int inputShrink = 1;            // reduce each input by this (1, 2, 4 or 8) as it is decoded
+
+int pngLevel   = PNG_DEFAULT_LEVEL; // compression level of the results
+int pngThreads = 1;             // threads that compress each result
+
+bool dumpPlan  = false;         // print the plan for each image
+bool benchmark = false;         // time the plan fused and as full passes
+
+#define BENCHMARK_RUNS 5        // runs of each kind, of which the fastest is reported
+
+
+// An image on its way through the stages
+
+struct BatchJob {
+  int    file;                  // index in 'inputFiles'
+  Image *image;                 // the decoded image, then the result, or NULL if decoding failed
+  double seconds;               // time spent on this image in the stages so far
+};
+
+
+struct Stage {
+  const char      *name;
+  int              numThreads;
+  std::atomic<int> numTaken;    // number of jobs that the stage's threads have started
+  double           busySeconds; // time spent working, summed over the threads
+  double           waitSeconds; // time spent waiting for the queues, summed over the threads
+};
+
+Stage decodeStage, processStage, encodeStage;
+
+#define DEFAULT_QUEUE_CAPACITY 4
+
+boundedQueue<BatchJob> *decodedQueue;   // from decode to process
+boundedQueue<BatchJob> *processedQueue; // from process to encode
+
+std::atomic<int> numEncoded;
+std::atomic<int> numFailed;
+
+std::mutex outputLock;          // so that the threads' messages are not interleaved
+
+
+
+void usage( char *progName )
+
+{
+  cerr << "Usage: " << progName << " [options] image ..." << endl
+       << endl
+       << "  -e edit          add an edit (scale=s[,sy] affine=a,b,tx,c,d,ty intensity=M,B equalize=radius" << endl
+       << "                   window=lo,hi gamma=g reset)" << endl
+       << "  -p file          add the edits in 'file'" << endl
+       << "  -o directory     write the results to 'directory' (default: next to each input as name-edited.ext)" << endl
+       << "  -f format        png, qoi, pam, or ppm for the results (default: that of each input, or png for JPEGs)" << endl
+       << "  -s n             shrink each input by 2, 4, or 8 as it is read (JPEGs are decoded shrunk, which is fastest)" << endl
+       << "  -j n             threads for each of the decode, process, and encode stages" << endl
+       << "  -j d,p,e         threads for the decode, process, and encode stages (default: a third of the cores each)" << endl
+       << "  -q n             images that can wait between stages (default: " << DEFAULT_QUEUE_CAPACITY << ")" << endl
+       << "  -z level         PNG compression level, 0 (none) to 9 (most) (default: " << PNG_DEFAULT_LEVEL << ")" << endl
+       << "  -b               backward projection (default: forward)" << endl
+       << "  -r interpolation nearest, bilinear, bicubic, or lanczos for backward projection" << endl
+       << "  -m mipmapping    none, nearest, or trilinear for backward projection" << endl
+       << "  -d               print the plan for each image" << endl
+       << "  -t               time the plan run fused and as one full pass per stage (use with -j 1)" << endl;
+  exit(1);
+}
+
+
+
+// The file to which the result for 'inputFile' is written.  Its
+// extension gives the format in which it is written.
+
+string outputFilename( string inputFile )
+
+{
+  ImageFormat format = (outputFormat != UNKNOWN_FORMAT ? outputFormat : outputFormatOfName( inputFile ));
+
+  size_t slash = inputFile.find_last_of( "/\\" );
+  size_t dot   = inputFile.rfind( '.' );
+
+  string base;
+
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    base = inputFile;
+  else
+    base = inputFile.substr( 0, dot );
+
+  if (outputDir.empty())
+    return base + "-edited." + imageFormatNames[ format ];
+
+  return outputDir + "/" + (slash == string::npos ? base : base.substr( slash+1 )) + "." + imageFormatNames[ format ];
+}
+
+
+
+// A string that is the same for any two names of the same existing
+// file, such as "x.png" and "./x.png".  Returns false if the file does
+// not exist.
+
+bool fileIdentity( string filename, string &identity )
+
+{
+#ifdef _WIN32
+
+  // _stat() gives no inode on Windows, so use the full path, which
+  // is not case-sensitive
+
+  struct _stat64 st;
+  char path[ _MAX_PATH ];
+
+  if (_stat64( filename.c_str(), &st ) != 0 || _fullpath( path, filename.c_str(), _MAX_PATH ) == NULL)
+    return false;
+
+  identity = path;
+
+  for (size_t i=0; i<identity.size(); i++)
+    identity[i] = tolower( identity[i] );
+
+#else
+
+  struct stat st;
+
+  if (stat( filename.c_str(), &st ) != 0)
+    return false;
+
+  identity = std::to_string( (unsigned long long) st.st_dev ) + ":" + std::to_string( (unsigned long long) st.st_ino );
+
+#endif
+
+  return true;
+}
+
+
+
+// Time since 'start', in seconds
+
+typedef std::chrono::steady_clock Clock;
+
+double since( Clock::time_point start )
+
+{
+  return std::chrono::duration<double>( Clock::now() - start ).count();
+}
+
+
+
+// Time 'plan' on 'srcImage', run fused and as one full pass per
+// stage, and check that the two give the same result.
+
+void benchmarkPlan( EditPlan &plan, Image *srcImage, string name )
+
+{
+  Image *result[2];
+  double bestTime[2];
+
+  for (int fused=0; fused<2; fused++) {
+
+    result[fused] = new Image( srcImage->width, srcImage->height );
+
+    for (int i=0; i<BENCHMARK_RUNS; i++) {
+
+      Clock::time_point start = Clock::now();
+
+      plan.run( srcImage, result[fused], fused );
+
+      double seconds = since( start );
+
+      if (i == 0 || seconds < bestTime[fused])
+	bestTime[fused] = seconds;
+    }
+  }
+
+  bool same = (memcmp( result[0]->texmap, result[1]->texmap, srcImage->width * srcImage->height * (result[0]->hasAlpha ? 4 : 3) ) == 0);
+
+  {
+    std::lock_guard<std::mutex> lock( outputLock );
+
+    cout << name << ": full passes " << bestTime[0] << " s, fused " << bestTime[1] << " s ("
+	 << bestTime[0] / bestTime[1] << "x), " << (same ? "same result" : "DIFFERENT RESULT") << endl;
+  }
+
+  delete result[0];
+  delete result[1];
+}
+
+
+
+// Add a thread's times to those of its stage
+
+void addTimes( Stage &stage, double busySeconds, double waitSeconds )
+
+{
+  std::lock_guard<std::mutex> lock( outputLock );
+
+  stage.busySeconds += busySeconds;
+  stage.waitSeconds += waitSeconds;
+}
+
+
+
+void decodeFiles()
+
+{
+  double busySeconds = 0, waitSeconds = 0;
+
+  while (true) {
+
+    int i = decodeStage.numTaken++;
+
+    if (i >= inputFiles.size())
+      break;
+
+    Clock::time_point start = Clock::now();
+
+    BatchJob job;
+
+    job.file  = i;
+    job.image = new Image( inputFiles[i], inputShrink );
+
+    if (job.image->width == 0) {
+      delete job.image;
+      job.image = NULL;
+    }
+
+    job.seconds = since( start );
+    busySeconds += job.seconds;
+
+    waitSeconds += decodedQueue->push( job );
+  }
+
+  addTimes( decodeStage, busySeconds, waitSeconds );
+}
+
+
+
+void processFiles()
+
+{
+  double busySeconds = 0, waitSeconds = 0;
+
+  while (processStage.numTaken++ < inputFiles.size()) {
+
+    BatchJob job;
+
+    waitSeconds += decodedQueue->pop( job );
+
+    Clock::time_point start = Clock::now();
+
+    if (job.image != NULL) {
+
+      Image *src = job.image;
+
+      EditPlan plan( pipeline, src->width, src->height );
+
+      if (dumpPlan) {
+	std::lock_guard<std::mutex> lock( outputLock );
+	cout << inputFiles[ job.file ] << ": ";
+	plan.dump( cout );
+      }
+
+      if (benchmark)
+	benchmarkPlan( plan, src, inputFiles[ job.file ] );
+
+      job.image = new Image( src->width, src->height );
+
+      plan.run( src, job.image );
+
+      delete src;
+    }
+
+    double seconds = since( start );
+
+    job.seconds += seconds;
+    busySeconds += seconds;
+
+    waitSeconds += processedQueue->push( job );
+  }
+
+  addTimes( processStage, busySeconds, waitSeconds );
+}
+
+
+
+void encodeFiles()
+
+{
+  double busySeconds = 0, waitSeconds = 0;
+
+  while (encodeStage.numTaken++ < inputFiles.size()) {
+
+    BatchJob job;
+
+    waitSeconds += processedQueue->pop( job );
+
+    Clock::time_point start = Clock::now();
+
+    bool ok = (job.image != NULL && writeImage( job.image, outputFilename( inputFiles[ job.file ] ), pngLevel, pngThreads ));
+
+    double seconds = since( start );
+
+    job.seconds += seconds;
+    busySeconds += seconds;
+
+    {
+      std::lock_guard<std::mutex> lock( outputLock );
+
+      if (ok)
+	cout << inputFiles[ job.file ] << ": " << job.image->width << " x " << job.image->height << ", " << job.seconds << " s" << endl;
+      else
+	cerr << inputFiles[ job.file ] << ": failed" << endl;
+    }
+
+    if (!ok)
+      numFailed++;
+
+    if (job.image != NULL)
+      delete job.image;
+
+    numEncoded++;
+  }
+
+  addTimes( encodeStage, busySeconds, waitSeconds );
+}
+
+
+
+// Queue depths, sampled while the stages run
+
+struct QueueDepth {
+  const char             *name;
+  boundedQueue<BatchJob> *queue;
+  double                  sum;
+  int                     max;
+};
+
+
+
+void reportStages( double seconds, QueueDepth depths[2], int numSamples )
+
+{
+  Stage *stages[3] = { &decodeStage, &processStage, &encodeStage };
+
+  cout << inputFiles.size() << " images in " << seconds << " s" << endl;
+
+  for (int i=0; i<3; i++)
+    cout << "  " << stages[i]->name << ": " << stages[i]->numThreads << " threads, "
+	 << (int) rint( 100 * stages[i]->busySeconds / (stages[i]->numThreads * seconds) ) << "% busy, "
+	 << stages[i]->waitSeconds << " s waiting for queues" << endl;
+
+  for (int i=0; i<2; i++)
+    cout << "  " << depths[i].name << " queue: capacity " << depths[i].queue->capacity()
+	 << ", mean depth " << (numSamples > 0 ? depths[i].sum / numSamples : 0)
+	 << ", max depth " << depths[i].max << endl;
+}
+
+
+
+int main( int argc, char **argv )
+
+{
+  int numCores = std::thread::hardware_concurrency();
+
+  decodeStage.numThreads  = numCores / 3;
+  processStage.numThreads = numCores / 3;
+  encodeStage.numThreads  = numCores / 3;
+
+  int queueCapacity = DEFAULT_QUEUE_CAPACITY;
+
+  for (int i=1; i<argc; i++) {
+
+    string arg = argv[i];
+
+    if (arg.size() < 2 || arg[0] != '-') {
+      inputFiles.add( arg );
+      continue;
+    }
+
+    bool hasValue = (arg == "-e" || arg == "-p" || arg == "-o" || arg == "-f" || arg == "-s" || arg == "-j" || arg == "-q" || arg == "-z" || arg == "-r" || arg == "-m");
+
+    if (hasValue && i+1 == argc)
+      usage( argv[0] );
+
+    if (arg == "-e") {
+
+      if (!pipeline.addOp( argv[++i] ))
+	exit(1);
+
+    } else if (arg == "-p") {
+
+      ifstream in( argv[++i] );
+
+      if (!in) {
+	cerr << "Could not open '" << argv[i] << "'" << endl;
+	exit(1);
+      }
+
+      if (!pipeline.addOps( in ))
+	exit(1);
+
+    } else if (arg == "-o")
+      outputDir = argv[++i];
+
+    else if (arg == "-f") {
+
+      outputFormat = imageFormatNamed( argv[++i] );
+
+      if (!canWriteImageFormat( outputFormat ))
+	usage( argv[0] );
+
+    } else if (arg == "-s") {
+
+      inputShrink = atoi( argv[++i] );
+
+      if (inputShrink != 1 && inputShrink != 2 && inputShrink != 4 && inputShrink != 8)
+	usage( argv[0] );
+
+    } else if (arg == "-j") {
+
+      int d, p, e;
+
+      int n = sscanf( argv[++i], "%d,%d,%d", &d, &p, &e );
+
+      if (n == 1)
+	p = e = d;
+      else if (n != 3)
+	usage( argv[0] );
+
+      if (d < 1 || p < 1 || e < 1)
+	usage( argv[0] );
+
+      decodeStage.numThreads  = d;
+      processStage.numThreads = p;
+      encodeStage.numThreads  = e;
+
+    } else if (arg == "-q") {
+
+      queueCapacity = atoi( argv[++i] );
+
+      if (queueCapacity < 1)
+	usage( argv[0] );
+
+    } else if (arg == "-z") {
+
+      pngLevel = atoi( argv[++i] );
+
+      if (pngLevel < 0 || pngLevel > 9)
+	usage( argv[0] );
+
+    } else if (arg == "-d")
+      dumpPlan = true;
+
+    else if (arg == "-t")
+      benchmark = true;
+
+    else if (arg == "-b")
+      pipeline.projectionMode = BACKWARD;
+
+    else if (arg == "-r") {
+
+      string name = argv[++i];
+
+      int j;
+      for (j=0; j<NUM_INTERPOLATIONS; j++)
+	if (name == interpolationNames[j])
+	  break;
+
+      if (j == NUM_INTERPOLATIONS)
+	usage( argv[0] );
+
+      pipeline.interpolation = (Interpolation) j;
+
+    } else if (arg == "-m") {
+
+      string name = argv[++i];
+
+      if (name == "none")
+	pipeline.mipMapping = NO_MIPMAPS;
+      else if (name == "nearest")
+	pipeline.mipMapping = NEAREST_MIPMAP;
+      else if (name == "trilinear")
+	pipeline.mipMapping = TRILINEAR_MIPMAP;
+      else
+	usage( argv[0] );
+
+    } else
+      usage( argv[0] );
+  }
+
+  if (inputFiles.size() == 0)
+    usage( argv[0] );
+
+  // The encode threads would write the same file at once if two
+  // inputs had the same output (e.g. a/x.png and b/x.png with -o, or
+  // x.jpg and x.png beside each other)
+
+  //
+  // A result must not replace an input either, which it would with -o
+  // naming the inputs' own directory
+
+  std::map<string,int> outputs;
+  std::map<string,int> inputs;  // by file identity
+
+  for (int i=0; i<inputFiles.size(); i++) {
+
+    string identity;
+
+    if (fileIdentity( inputFiles[i], identity ))
+      inputs[identity] = i;
+  }
+
+  for (int i=0; i<inputFiles.size(); i++) {
+
+    string output = outputFilename( inputFiles[i] );
+
+    if (outputs.count( output ) > 0) {
+      cerr << "'" << inputFiles[ outputs[output] ] << "' and '" << inputFiles[i] << "' would both be written to '" << output << "'" << endl;
+      exit(1);
+    }
+
+    string identity;
+
+    if (fileIdentity( output, identity ) && inputs.count( identity ) > 0) {
+      cerr << "The result for '" << inputFiles[i] << "' would replace the input '" << inputFiles[ inputs[identity] ] << "'" << endl;
+      exit(1);
+    }
+
+    outputs[output] = i;
+  }
+
+  // Start the stages
+
+  decodeStage.name  = "decode";
+  processStage.name = "process";
+  encodeStage.name  = "encode";
+
+  Stage *stages[3]            = { &decodeStage, &processStage, &encodeStage };
+  void (*stageFunctions[3])() = { decodeFiles,  processFiles,  encodeFiles  };
+
+  decodedQueue   = new boundedQueue<BatchJob>( queueCapacity );
+  processedQueue = new boundedQueue<BatchJob>( queueCapacity );
+
+  numEncoded.store( 0 );
+  numFailed.store( 0 );
+
+  int numStageThreads = 0;
+
+  for (int i=0; i<3; i++) {
+
+    Stage &stage = *stages[i];
+
+    if (stage.numThreads < 1)
+      stage.numThreads = 1;
+    if (stage.numThreads > inputFiles.size())
+      stage.numThreads = inputFiles.size();
+
+    numStageThreads += stage.numThreads;
+  }
+
+  // Each encoding thread compresses with its share of the cores
+
+  pngThreads = max( 1, numCores / numStageThreads );
+
+  Clock::time_point start = Clock::now();
+
+  std::vector<std::thread> threads;
+
+  for (int i=0; i<3; i++) {
+
+    Stage &stage = *stages[i];
+
+    stage.numTaken.store( 0 );
+    stage.busySeconds = 0;
+    stage.waitSeconds = 0;
+
+    for (int j=0; j<stage.numThreads; j++)
+      threads.push_back( std::thread( stageFunctions[i] ) );
+  }
+
+  // Sample the queue depths until the last image is written
+
+  QueueDepth depths[2] = { { "decode -> process",  decodedQueue,   0, 0 },
+			   { "process -> encode", processedQueue, 0, 0 } };
+  int numSamples = 0;
+
+  while (numEncoded.load() < inputFiles.size()) {
+
+    for (int i=0; i<2; i++) {
+      int depth = depths[i].queue->size();
+      depths[i].sum += depth;
+      if (depth > depths[i].max)
+	depths[i].max = depth;
+    }
+
+    numSamples++;
+
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+  }
+
+  for (unsigned int i=0; i<threads.size(); i++)
+    threads[i].join();
+
+  reportStages( since( start ), depths, numSamples );
+
+  delete decodedQueue;
+  delete processedQueue;
+
+  return (numFailed.load() > 0 ? 1 : 0);
+}
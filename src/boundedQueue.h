@@ -0,0 +1,241 @@
+/* boundedQueue.h
+ *
+ * A fixed-size queue that any number of threads can add to and take
+ * from at once.  Adding and taking elements takes no lock; only
+ * threads that wait for room or for an element sleep on a mutex.
+ *
+ *   CONSTRUCTORS
+ *
+ *     boundedQueue( n )   Create an empty queue that holds up to n
+ *                         elements (rounded up to a power of 2)
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     tryPush( x )        Add x at the back, or return false if the queue is full
+ *     tryPop( x )         Take the front element into x, or return false if the queue is empty
+ *     push( x )           Add x at the back, waiting while the queue is full
+ *     pop( x )            Take the front element into x, waiting while the queue is empty
+ *     size()              The number of elements (approximate while other threads use the queue)
+ *     capacity()          The largest number of elements
+ *
+ * push() and pop() return the number of seconds spent waiting.  A
+ * thread that has to wait retries a few times, yielding its processor
+ * in between, and then sleeps until another thread takes or adds an
+ * element.  So a stage that is held up by a slower one does not keep
+ * a core busy that the slower stage could use.  Only waiting takes
+ * the queue's mutex: a push or pop checks, with one atomic load,
+ * whether any thread is asleep on the other side, and wakes one if so.
+ *
+ * Each slot has a sequence number that says whether it is ready to be
+ * written (it equals the position at which it will be written) or to
+ * be read (it is one past that).  A thread claims a position by a
+ * compare-and-swap of the queue's head or tail, and only then touches
+ * the slot, so there is no lock.  See D. Vyukov, "Bounded MPMC queue".
+ */
+
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+
+#define BOUNDED_QUEUE_SPINS 16  // tries, with a yield between, before a waiting thread sleeps
+
+
+template<class T> class boundedQueue {
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T                   value;
+  };
+
+  // The head and tail are on separate cache lines so that producers
+  // and consumers do not slow each other down
+
+  alignas(64) std::atomic<size_t> tail;   // position of the next push
+  alignas(64) std::atomic<size_t> head;   // position of the next pop
+  alignas(64) Slot               *slots;
+  size_t                          mask;
+
+  // Sleeping threads, which wait on 'notFull' to push or 'notEmpty'
+  // to pop.  A thread that pushes or pops bumps the other side's
+  // generation and notifies it, but only if a thread there is
+  // waiting.  A waiting thread sleeps only until the generation that
+  // it saw before its last try has changed.
+
+  struct Waiters {
+    std::condition_variable cv;
+    std::atomic<int>        count;
+    unsigned long           generation; // changed only with 'lock' held
+  };
+
+  std::mutex lock;
+  Waiters    notFull, notEmpty;
+
+  void wake( Waiters &w ) {
+    std::atomic_thread_fence( std::memory_order_seq_cst ); // the change is visible before the count is read
+    if (w.count.load( std::memory_order_relaxed ) > 0) {
+      std::lock_guard<std::mutex> guard( lock );
+      w.generation++;
+      w.cv.notify_one();
+    }
+  }
+
+  // Try 'attempt' until it succeeds, first spinning and then sleeping
+  // on 'w'.  Returns the seconds spent.
+
+  template <class Attempt> double wait( Attempt attempt, Waiters &w ) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int i=0; i<BOUNDED_QUEUE_SPINS; i++) {
+      std::this_thread::yield();
+      if (attempt())
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    }
+
+    std::unique_lock<std::mutex> guard( lock );
+    w.count++;
+
+    while (true) {
+
+      unsigned long seen = w.generation;
+
+      // Try without the lock, since a successful try wakes the other
+      // side.  A change after the count was raised bumps the
+      // generation, so it is not missed.
+
+      guard.unlock();
+      std::atomic_thread_fence( std::memory_order_seq_cst );
+      bool done = attempt();
+      guard.lock();
+
+      if (done)
+	break;
+
+      while (w.generation == seen)
+	w.cv.wait( guard );
+    }
+
+    w.count--;
+
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  }
+
+  boundedQueue( const boundedQueue<T> & );               // not copyable
+  boundedQueue<T> & operator = ( const boundedQueue<T> & );
+
+public:
+
+  boundedQueue( size_t n ) {
+    size_t size = 2;
+    while (size < n)
+      size *= 2;
+    mask  = size - 1;
+    slots = new Slot[ size ];
+    for (size_t i=0; i<size; i++)
+      slots[i].sequence.store( i, std::memory_order_relaxed );
+    tail.store( 0, std::memory_order_relaxed );
+    head.store( 0, std::memory_order_relaxed );
+    notFull.count.store( 0 );
+    notEmpty.count.store( 0 );
+    notFull.generation  = 0;
+    notEmpty.generation = 0;
+  }
+
+  ~boundedQueue() {
+    delete [] slots;
+  }
+
+  size_t capacity() const {
+    return mask + 1;
+  }
+
+  size_t size() const {
+    size_t t = tail.load( std::memory_order_relaxed );
+    size_t h = head.load( std::memory_order_relaxed );
+    return (t > h ? t - h : 0);
+  }
+
+  bool tryPush( const T &x );
+  bool tryPop( T &x );
+
+  double push( const T &x ) {
+    if (tryPush( x ))
+      return 0;
+    return wait( [&] () { return tryPush( x ); }, notFull );
+  }
+
+  double pop( T &x ) {
+    if (tryPop( x ))
+      return 0;
+    return wait( [&] () { return tryPop( x ); }, notEmpty );
+  }
+};
+
+
+
+template<class T>
+bool
+boundedQueue<T>::tryPush( const T &x )
+
+{
+  size_t pos = tail.load( std::memory_order_relaxed );
+
+  while (true) {
+
+    Slot &slot = slots[ pos & mask ];
+
+    size_t seq = slot.sequence.load( std::memory_order_acquire );
+
+    if (seq == pos) { // slot is free: try to claim it
+      if (tail.compare_exchange_weak( pos, pos+1, std::memory_order_relaxed )) {
+	slot.value = x;
+	slot.sequence.store( pos+1, std::memory_order_release );
+	wake( notEmpty );
+	return true;
+      }
+    } else if (seq < pos) // slot still holds an element from one lap ago: full
+      return false;
+    else
+      pos = tail.load( std::memory_order_relaxed ); // another thread took this position
+  }
+}
+
+
+
+template<class T>
+bool
+boundedQueue<T>::tryPop( T &x )
+
+{
+  size_t pos = head.load( std::memory_order_relaxed );
+
+  while (true) {
+
+    Slot &slot = slots[ pos & mask ];
+
+    size_t seq = slot.sequence.load( std::memory_order_acquire );
+
+    if (seq == pos+1) { // slot is written: try to claim it
+      if (head.compare_exchange_weak( pos, pos+1, std::memory_order_relaxed )) {
+	x = slot.value;
+	slot.sequence.store( pos + mask + 1, std::memory_order_release );
+	wake( notFull );
+	return true;
+      }
+    } else if (seq < pos+1) // slot not yet written: empty
+      return false;
+    else
+      pos = head.load( std::memory_order_relaxed ); // another thread took this position
+  }
+}
+
+
+#endif
@@ -21,7 +21,7 @@ void Canvas::draw()
   float x = image->width / (float) canvasWidth;
   float y = image->height / (float) canvasHeight;
 
-  background->draw( vec2(-x,-y), vec2(x,y) );
+  drawBackground( vec2(-x,-y), vec2(x,y) );
   
   image->draw( vec2(-x,-y), vec2(x,y) );
 
@@ -158,7 +158,11 @@ void Canvas::draw()
   strokeFont->drawStrokeString( modeStr.c_str(), -0.98, -0.95, 0.06, 0, LEFT );
 
   char radiusStr[100];
-  sprintf( radiusStr, "radius %d", editor->histoRadius );
+
+  if (editor->previewReduction() > 1)
+    sprintf( radiusStr, "radius %d  preview 1/%d", editor->histoRadius, editor->previewReduction() );
+  else
+    sprintf( radiusStr, "radius %d  preview full", editor->histoRadius );
 
   strokeFont->drawStrokeString( radiusStr, 0, -0.95, 0.06, 0, CENTRE );
 
@@ -167,36 +171,73 @@ void Canvas::draw()
   if (editor->projectionMode == FORWARD)
     projStr = "forward";
   else if (editor->projectionMode == BACKWARD)
-    projStr = "backward";
+    projStr = string("backward ") + interpolationNames[ editor->interpolation ];
   else
     projStr = "";
 
   strokeFont->drawStrokeString( projStr.c_str(), 0.98, -0.95, 0.06, 0, RIGHT );
+
+  string saveStr = editor->saveStatus();
+
+  if (saveStr != "")
+    strokeFont->drawStrokeString( saveStr.c_str(), 0, -0.87, 0.06, 0, CENTRE );
 }
 
 
-// Create a checkerboard texture to be used as background below
-// transparent images
+// Set up the quad on which the checkerboard background is drawn
+// below transparent images.  Texture coordinates are (0,0) at the
+// upper-left and (1,1) at the lower-right, as in Texture::draw().
 
-Texture * Canvas::setupBackgroundTexture( unsigned int width, unsigned int height ) 
+void Canvas::setupBackground()
 
 {
-  Texture *tex = new Texture( width, height );
+  float texcoords[8] = { 0,0, 0,1, 1,0, 1,1 };
 
-  for (unsigned int x=0; x<width; x++)
-    for (unsigned int y=0; y<height; y++) {
+  glGenVertexArrays( 1, &backgroundVAO );
+  glBindVertexArray( backgroundVAO );
 
-      Pixel &p = tex->pixel(x,y);
-	
-      if ((x/BACKGROUND_BLOCK_SIZE + y/BACKGROUND_BLOCK_SIZE) % 2 == 0)
-	p.r = p.g = p.b = 230; // grey
-      else
-	p.r = p.g = p.b = 255; // white
+  glGenBuffers( 1, &backgroundVBO );
 
-      p.a = 255; // opaque
-    }
+  glBindBuffer( GL_ARRAY_BUFFER, backgroundVBO );
+  glBufferData( GL_ARRAY_BUFFER, 8*sizeof(float) + sizeof(texcoords), NULL, GL_DYNAMIC_DRAW );
+  glBufferSubData( GL_ARRAY_BUFFER, 8*sizeof(float), sizeof(texcoords), texcoords );
+
+  glEnableVertexAttribArray( 0 );
+  glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+
+  glEnableVertexAttribArray( 1 );
+  glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, 0, (void*) (8*sizeof(float)) );
 
-  return tex;
+  glBindVertexArray( 0 );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+
+// Draw the checkerboard background in a region of the window
+
+void Canvas::drawBackground( vec2 lowerLeft, vec2 upperRight )
+
+{
+  vec2 verts[4] = { vec2( lowerLeft.x, upperRight.y ), 
+		    vec2( lowerLeft.x, lowerLeft.y ), 
+		    vec2( upperRight.x, upperRight.y ), 
+		    vec2( upperRight.x, lowerLeft.y ) };
+
+  glBindBuffer( GL_ARRAY_BUFFER, backgroundVBO );
+  glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof(verts), verts );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+  glDisable( GL_BLEND ); // background is opaque
+
+  GPUProg->activate();
+  GPUProg->setVec2( imageSizeLoc, vec2( image->width, image->height ) );
+  GPUProg->setFloat( blockSizeLoc, BACKGROUND_BLOCK_SIZE );
+
+  glBindVertexArray( backgroundVAO );
+  glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+  glBindVertexArray( 0 );
+
+  GPUProg->deactivate();
 }
 
 
@@ -207,30 +248,35 @@ char *Canvas::vertexShader = R"XX(
 
 #version 300 es
 
-uniform mediump mat4 MVP;
+uniform highp vec2 imageSize;
 
-layout (location = 0) in mediump vec4 position;
-layout (location = 1) in mediump vec4 colour_in;
+layout (location = 0) in mediump vec2 position;
+layout (location = 1) in mediump vec2 texCoords_in;
 
-out mediump vec4 colour;
+out highp vec2 texelPos;
 
 
 void main()
 
 {
-  gl_Position = MVP * position;
-  colour = colour_in;
+  gl_Position = vec4( position.x, position.y, 0, 1 );
+  texelPos = texCoords_in * imageSize; // image pixel position, with y going down
 }
 
 )XX";
 
 
 
+// Checkerboard of grey (230) and white (255) blocks of 'blockSize'
+// image pixels, as the background texture had.
+
 char *Canvas::fragmentShader = R"XX(
 
 #version 300 es
 
-in mediump vec4 colour;
+uniform highp float blockSize;
+
+in highp vec2 texelPos;
 
 out mediump vec4 fragColour;
 
@@ -238,10 +284,12 @@ out mediump vec4 fragColour;
 void main()
 
 {
-  fragColour = colour;
+  highp ivec2 block = ivec2( floor( texelPos / blockSize ) );
+
+  if ((block.x + block.y) % 2 == 0)
+    fragColour = vec4( 230.0/255.0, 230.0/255.0, 230.0/255.0, 1 ); // grey
+  else
+    fragColour = vec4( 1, 1, 1, 1 ); // white
 }
 
 )XX";
-
-
-
@@ -17,13 +17,18 @@
 class Canvas {
 
   Texture *image;         // image being drawn.  This is edited elsewhere.
-  Texture *background;    // checkerboard background to be drawn below a transparent image
   
   unsigned int canvasWidth, canvasHeight;
 
+  // The checkerboard background below a transparent image is
+  // generated in the fragment shader, so it needs no texture.
+
   static char *vertexShader;
   static char *fragmentShader;
   GPUProgram  *GPUProg;
+  GLint        imageSizeLoc, blockSizeLoc; // uniform locations in 'GPUProg'
+
+  GLuint backgroundVAO, backgroundVBO;
 
   Segs *segs;
 
@@ -40,11 +45,14 @@ class Canvas {
     GPUProg = new GPUProgram();
     GPUProg->init( vertexShader, fragmentShader, "canvas" );
 
+    imageSizeLoc = GPUProg->uniformLocation( "imageSize" );
+    blockSizeLoc = GPUProg->uniformLocation( "blockSize" );
+
     segs = new Segs();
 
     image = texImage;
 
-    background = setupBackgroundTexture( image->width, image->height );
+    setupBackground();
 
     imageOrigin = vec2( 0.5 * (canvasWidth - image->width), 
 			0.5 * (canvasHeight + image->height) );
@@ -52,12 +60,15 @@ class Canvas {
 
   void draw();
 
-  Texture * setupBackgroundTexture( unsigned int width, unsigned int height );
+  void setupBackground();
+  void drawBackground( vec2 lowerLeft, vec2 upperRight );
 
   void reshape( unsigned int width, unsigned int height ) {
 
     canvasWidth = width;
     canvasHeight = height;
+
+    postRedisplay();
   }
 };
 
@@ -0,0 +1,58 @@
+// The standard headers included by all files of the image core.
+//
+// These do not include OpenGL or GLFW, so the core can be built and
+// run without a display.
+
+
+#ifndef CORE_HEADERS_H
+#define CORE_HEADERS_H
+
+#include <sys/timeb.h>	// includes ftime (to return current time)
+
+#ifdef LINUX
+  #include <unistd.h>		// includes usleep (to sleep for some time)
+  #include <values.h>           // includes MAX_FLOAT
+  #define sprintf_s sprintf
+  #define _strdup strdup
+  #define sscanf_s sscanf
+  #define _getcwd getcwd
+#endif
+
+#ifdef _WIN32
+  #include <direct.h>
+  #include <windows.h>
+  #include <typeinfo>
+  #define PATH_MAX 1000
+  #define M_PI 3.14159
+  #define MAXFLOAT FLT_MAX
+  #pragma warning(disable : 4244 4305 4996 4838)
+#endif
+
+#ifdef __APPLE_CC__
+  #include <unistd.h>
+  #define sprintf_s sprintf
+  #define _strdup strdup
+  #define sscanf_s sscanf
+  #define _getcwd getcwd
+#endif
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+// This function is already defined in Windows.
+// We redefine it here according to our desired behaviour
+
+#ifdef _WIN32
+  #define rint(x) floor((x)+0.5)
+#endif
+
+#include <cmath>
+
+#include "linalg.h"
+
+#define randIn01() (rand() / (float)RAND_MAX)   // random number in [0,1]
+
+#endif
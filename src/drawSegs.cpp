@@ -55,11 +55,11 @@ void Segs::drawSegs( GLuint primitiveType, vec3 *pts, vec4 *colours, vec3 *norms
  
   gpuProg->activate();
 
-  gpuProg->setMat4( "MV",  MV  );
-  gpuProg->setMat4( "MVP", MVP );
-  gpuProg->setVec3( "lightDir", lightDir );
+  gpuProg->setMat4( MVLoc,  MV  );
+  gpuProg->setMat4( MVPLoc, MVP );
+  gpuProg->setVec3( lightDirLoc, lightDir );
 
-  gpuProg->setInt( "useNormals", (norms != NULL) );
+  gpuProg->setInt( useNormalsLoc, (norms != NULL) );
 
   glDrawArrays( primitiveType, 0, nPts );
 
@@ -18,11 +18,18 @@ class Segs {
   GPUProgram *setupShaders();
 
   GPUProgram *gpuProg;
+
+  GLint MVLoc, MVPLoc, lightDirLoc, useNormalsLoc; // uniform locations in 'gpuProg'
   
  public:
 
   Segs() { 
     gpuProg = setupShaders();
+
+    MVLoc         = gpuProg->uniformLocation( "MV" );
+    MVPLoc        = gpuProg->uniformLocation( "MVP" );
+    lightDirLoc   = gpuProg->uniformLocation( "lightDir" );
+    useNormalsLoc = gpuProg->uniformLocation( "useNormals" );
   };
 
   // Main function
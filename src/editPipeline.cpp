@@ -0,0 +1,144 @@
+// editPipeline.cpp
+
+
+#include "editPipeline.h"
+#include "editPlan.h"
+
+#include <sstream>
+
+
+struct EditOpSyntax {
+  const char *name;
+  EditOpType  type;
+  int         minArgs, maxArgs;
+};
+
+static EditOpSyntax opSyntax[] = {
+  { "scale",     SCALE_OP,     1, 2 },
+  { "affine",    AFFINE_OP,    6, 6 },
+  { "intensity", INTENSITY_OP, 2, 2 },
+  { "equalize",  EQUALIZE_OP,  1, 1 },
+  { "window",    WINDOW_OP,    2, 2 },
+  { "gamma",     GAMMA_OP,     1, 1 },
+  { "reset",     RESET_OP,     0, 0 }
+};
+
+#define NUM_OP_SYNTAX (sizeof(opSyntax) / sizeof(opSyntax[0]))
+
+
+
+bool EditPipeline::addOp( string text )
+
+{
+  // Split into name and arguments
+
+  size_t eq = text.find( '=' );
+
+  string name = text.substr( 0, eq );
+
+  seq<double> args;
+
+  if (eq != string::npos) {
+
+    string argText = text.substr( eq+1 );
+
+    for (size_t i=0; i<argText.size(); i++)
+      if (argText[i] == ',')
+	argText[i] = ' ';
+
+    istringstream in( argText );
+    double x;
+
+    while (in >> x)
+      args.add( x );
+
+    if (!in.eof()) {
+      cerr << "Bad arguments in '" << text << "'" << endl;
+      return false;
+    }
+  }
+
+  // Find the edit
+
+  unsigned int i;
+  for (i=0; i<NUM_OP_SYNTAX; i++)
+    if (name == opSyntax[i].name)
+      break;
+
+  if (i == NUM_OP_SYNTAX) {
+    cerr << "Unknown edit '" << name << "'" << endl;
+    return false;
+  }
+
+  if (args.size() < opSyntax[i].minArgs || args.size() > opSyntax[i].maxArgs) {
+    cerr << "Wrong number of arguments in '" << text << "'" << endl;
+    return false;
+  }
+
+  EditOp op;
+
+  op.type = opSyntax[i].type;
+
+  for (int j=0; j<args.size(); j++)
+    op.args[j] = args[j];
+
+  if (op.type == SCALE_OP && args.size() == 1)
+    op.args[1] = op.args[0];
+
+  if (op.type == EQUALIZE_OP && op.args[0] < 1) {
+    cerr << "The equalization radius must be at least 1 in '" << text << "'" << endl;
+    return false;
+  }
+
+  if (op.type == WINDOW_OP && op.args[1] <= op.args[0]) {
+    cerr << "The window must have lo < hi in '" << text << "'" << endl;
+    return false;
+  }
+
+  if (op.type == GAMMA_OP && op.args[0] <= 0) {
+    cerr << "The gamma must be positive in '" << text << "'" << endl;
+    return false;
+  }
+
+  ops.add( op );
+
+  return true;
+}
+
+
+
+bool EditPipeline::addOps( istream &in )
+
+{
+  string line;
+
+  while (getline( in, line )) {
+
+    size_t comment = line.find( '#' );
+    if (comment != string::npos)
+      line.erase( comment );
+
+    for (size_t i=0; i<line.size(); i++)
+      if (line[i] == ';')
+	line[i] = ' ';
+
+    istringstream words( line );
+    string word;
+
+    while (words >> word)
+      if (!addOp( word ))
+	return false;
+  }
+
+  return true;
+}
+
+
+
+void EditPipeline::apply( Image *srcImage, Image *destImage )
+
+{
+  EditPlan plan( *this, srcImage->width, srcImage->height );
+
+  plan.run( srcImage, destImage );
+}
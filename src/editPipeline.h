@@ -0,0 +1,81 @@
+// editPipeline.h
+//
+// A sequence of edits that can be applied to an image without the
+// interactive editor.  The edits have the same meaning as in the
+// editor: geometric and intensity transforms accumulate, histogram
+// equalization replaces the base image with an equalized copy of the
+// original, and reset goes back to the original with no transforms.
+// The result is the base image projected with the accumulated
+// transforms, as the editor would display it.
+//
+// Two more edits, which the editor does not have, adjust that result:
+// intensity windowing and a tone curve.  These are applied in the
+// order given, after the projection.
+//
+// An edit is written as a word, with comma-separated arguments after
+// '=' if it has any:
+//
+//   scale=s  or  scale=sx,sy    scale about the image centre
+//   affine=a,b,tx,c,d,ty        any affine transform (see affine2d)
+//   intensity=M,B               Y' = Y * M + B
+//   equalize=radius             local histogram equalization
+//   window=lo,hi                stretch Y in [lo,hi] to [0,1]
+//   gamma=g                     tone curve v' = v^(1/g) on each of R, G, and B
+//   reset                       restore the original
+//
+// The edits are compiled into an EditPlan (see editPlan.h) to be run.
+
+
+#ifndef EDIT_PIPELINE_H
+#define EDIT_PIPELINE_H
+
+#include "coreHeaders.h"
+#include "image.h"
+#include "projection.h"
+#include "seq.h"
+
+#include <string>
+
+
+typedef enum { SCALE_OP, AFFINE_OP, INTENSITY_OP, EQUALIZE_OP, WINDOW_OP, GAMMA_OP, RESET_OP } EditOpType;
+
+
+struct EditOp {
+  EditOpType type;
+  double     args[6];           // scale: sx, sy; affine: a, b, tx, c, d, ty; intensity: M, B; equalize: radius;
+                                // window: lo, hi; gamma: g
+};
+
+
+class EditPipeline {
+
+ public:
+
+  seq<EditOp> ops;
+
+  ProjectionMode projectionMode;
+  Interpolation  interpolation;
+  MipMapping     mipMapping;
+
+  EditPipeline() {
+    projectionMode = FORWARD;
+    interpolation  = NEAREST;
+    mipMapping     = NO_MIPMAPS;
+  }
+
+  // Add one edit, or all of the edits (separated by white space or
+  // ';', with '#' starting a comment) in a description.  These return
+  // false and report the problem if the text is not understood.
+
+  bool addOp( string text );
+  bool addOps( istream &in );
+
+  // Apply the edits to 'srcImage', putting the result in 'destImage',
+  // which must have the same dimensions.  This compiles and runs an
+  // EditPlan.
+
+  void apply( Image *srcImage, Image *destImage );
+};
+
+
+#endif
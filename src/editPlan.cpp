@@ -0,0 +1,261 @@
+// editPlan.cpp
+
+
+#include "editPlan.h"
+#include "intensity.h"
+
+
+
+// Compile the edits.  The geometric and intensity edits follow
+// Editor::keyPress() and Editor::stopMouseMotion(), so that the
+// projection is what the editor would show after the same edits.
+
+EditPlan::EditPlan( EditPipeline &pipeline, unsigned int imageWidth, unsigned int imageHeight )
+
+{
+  width  = imageWidth;
+  height = imageHeight;
+
+  equalizeRadius = 0;
+  numEqualizeOps = 0;
+
+  params.transform      = identity2d();
+  params.intensityScale = 1;
+  params.intensityBias  = 0;
+  params.projectionMode = pipeline.projectionMode;
+  params.interpolation  = pipeline.interpolation;
+  params.mipMapping     = pipeline.mipMapping;
+  params.shrink         = 1;
+
+  // The editor scales about the centre of the displayed image
+
+  double cx = width/2;
+  double cy = height/2;
+
+  for (int i=0; i<pipeline.ops.size(); i++) {
+
+    EditOp &op = pipeline.ops[i];
+
+    switch (op.type) {
+
+    case SCALE_OP:
+      params.transform =   translate2d( cx, cy )
+	                 * scale2d( op.args[0], op.args[1] )
+	                 * translate2d( -cx, -cy )
+	                 * params.transform;
+      break;
+
+    case AFFINE_OP:
+      params.transform = affine2d( op.args[0], op.args[1], op.args[2], op.args[3], op.args[4], op.args[5] ) * params.transform;
+      break;
+
+    case INTENSITY_OP:
+      params.intensityScale = op.args[0] * params.intensityScale;
+      params.intensityBias  = op.args[1] + params.intensityBias;
+      break;
+
+    case EQUALIZE_OP:
+      equalizeRadius = (int) op.args[0];
+      numEqualizeOps++;
+      break;
+
+    case WINDOW_OP: {
+      PointStage &stage = pointStages.emplace();
+      stage.type   = WINDOW_STAGE;
+      stage.M      = 1 / (op.args[1] - op.args[0]);
+      stage.B      = -op.args[0] / (op.args[1] - op.args[0]);
+      stage.numOps = 1;
+      break;
+    }
+
+    case GAMMA_OP: {
+
+      unsigned char curve[256];
+
+      for (int v=0; v<256; v++)
+	curve[v] = (unsigned char) rint( 255 * pow( v / 255.0, 1 / op.args[0] ) );
+
+      int n = pointStages.size();
+
+      if (n > 0 && pointStages[n-1].type == LUT_STAGE) { // compose with the previous curve
+	PointStage &stage = pointStages[n-1];
+	for (int v=0; v<256; v++)
+	  stage.lut[v] = curve[ stage.lut[v] ];
+	stage.numOps++;
+      } else {
+	PointStage &stage = pointStages.emplace();
+	stage.type = LUT_STAGE;
+	memcpy( stage.lut, curve, 256 );
+	stage.numOps = 1;
+      }
+      break;
+    }
+
+    case RESET_OP:
+      params.transform      = identity2d();
+      params.intensityScale = 1;
+      params.intensityBias  = 0;
+      equalizeRadius = 0;
+      numEqualizeOps = 0;
+      pointStages.clear();
+      break;
+    }
+  }
+}
+
+
+
+static const char *projectionModeNames[] = { "forward", "backward" };
+static const char *mipMappingNames[]     = { "no mip map", "nearest mip map", "trilinear mip map" };
+
+
+static void printLinear( ostream &out, float M, float B )
+
+{
+  out << "Y' = Y * " << M << (B < 0 ? " - " : " + ") << fabs(B);
+}
+
+
+void EditPlan::dump( ostream &out )
+
+{
+  int stageNum = 1;
+
+  out << "plan for " << width << " x " << height << " image" << endl;
+
+  if (equalizeRadius > 0) {
+    out << "  " << stageNum++ << ". equalize, radius " << equalizeRadius;
+    if (numEqualizeOps > 1)
+      out << " (" << numEqualizeOps-1 << " earlier equalizations dropped)";
+    out << endl
+	<< "     full pass: the projection reads the equalized image anywhere" << endl;
+  }
+
+  out << "  " << stageNum++ << ". " << projectionModeNames[ params.projectionMode ] << " projection";
+  if (params.projectionMode == BACKWARD)
+    out << ", " << interpolationNames[ params.interpolation ] << ", " << mipMappingNames[ params.mipMapping ];
+  out << endl
+      << "     transform [ " << params.transform.a << " " << params.transform.b << " " << params.transform.tx << " ; "
+      << params.transform.c << " " << params.transform.d << " " << params.transform.ty << " ]" << endl
+      << "     intensity ";
+  printLinear( out, params.intensityScale, params.intensityBias );
+  out << endl;
+
+  for (int i=0; i<pointStages.size(); i++) {
+
+    PointStage &stage = pointStages[i];
+
+    out << "  " << stageNum++ << ". ";
+
+    if (stage.type == WINDOW_STAGE) {
+      out << "window ";
+      printLinear( out, stage.M, stage.B );
+    } else {
+      out << "tone curve";
+      if (stage.numOps > 1)
+	out << " (" << stage.numOps << " curves composed)";
+    }
+
+    out << endl;
+  }
+
+  if (pointStages.size() > 0) {
+    if (params.projectionMode == BACKWARD)
+      out << "  stages " << stageNum - pointStages.size() - 1 << " to " << stageNum-1
+	  << " fused, band by band" << endl;
+    else
+      out << "  forward projection can write any row, so stages " << stageNum - pointStages.size()
+	  << " to " << stageNum-1 << " follow it as one band" << endl;
+  }
+}
+
+
+
+// Apply the point stages to rows [y0,y1) of the footprint of 'image'.
+// Transparent pixels are left alone, as in project().
+
+void EditPlan::runPointStages( Image *image, int y0, int y1 )
+
+{
+  PixelRect &r = image->footprint;
+
+  for (int i=0; i<pointStages.size(); i++) {
+
+    PointStage &stage = pointStages[i];
+
+    for (int y=y0; y<y1; y++) {
+
+      Pixel *row = &image->pixel( 0, y );
+
+      if (stage.type == WINDOW_STAGE) {
+	for (int x=r.x0; x<r.x1; x++)
+	  if (row[x].a != 0)
+	    row[x] = applyIntensityTransform( row[x], stage.M, stage.B );
+      } else {
+	unsigned char *lut = stage.lut;
+	for (int x=r.x0; x<r.x1; x++)
+	  if (row[x].a != 0) {
+	    row[x].r = lut[ row[x].r ];
+	    row[x].g = lut[ row[x].g ];
+	    row[x].b = lut[ row[x].b ];
+	  }
+      }
+    }
+  }
+}
+
+
+
+// Runs the point stages on each band as project() finishes it
+
+class PointStageRunner : public ProjectionBandListener {
+
+  EditPlan *plan;
+
+ public:
+
+  PointStageRunner( EditPlan *p ) {
+    plan = p;
+  }
+
+  void bandProjected( Image *destImage, int y0, int y1 ) {
+    plan->runPointStages( destImage, y0, y1 );
+  }
+};
+
+
+
+void EditPlan::run( Image *srcImage, Image *destImage, bool fused )
+
+{
+  if (srcImage->width != width || srcImage->height != height) {
+    cerr << "in EditPlan::run() the image is not the size for which the plan was made" << endl;
+    exit(1);
+  }
+
+  Image *baseImage = srcImage;
+
+  if (equalizeRadius > 0) {
+    baseImage = new Image( width, height, srcImage->hasAlpha );
+    histogramEqualization( srcImage, baseImage, equalizeRadius );
+  }
+
+  if (fused && pointStages.size() > 0) {
+
+    PointStageRunner runner( this );
+
+    project( baseImage, destImage, params, NULL, &runner );
+
+  } else {
+
+    project( baseImage, destImage, params );
+
+    PixelRect &r = destImage->footprint;
+
+    if (!r.empty())
+      runPointStages( destImage, r.y0, r.y1 );
+  }
+
+  if (baseImage != srcImage)
+    delete baseImage;
+}
@@ -0,0 +1,67 @@
+// editPlan.h
+//
+// An EditPipeline compiled into the stages that produce its result:
+//
+//   1. histogram equalization of the source, if any
+//   2. projection, with all of the geometric and intensity transforms
+//   3. point stages (windowing and tone curves), in order
+//
+// Only the last equalization after the last reset matters, since each
+// one starts again from the original.  Consecutive tone curves are
+// composed into one table, which gives exactly the same result.
+//
+// Equalization is a neighbourhood operation and the projection can
+// read its result anywhere, so it is done as a full pass.  The point
+// stages are fused with the projection: they are applied to each band
+// of rows as soon as project() finishes it, while the band is still in
+// cache.  The plan can also be run one full pass per stage, to compare.
+
+
+#ifndef EDIT_PLAN_H
+#define EDIT_PLAN_H
+
+#include "coreHeaders.h"
+#include "image.h"
+#include "projection.h"
+#include "editPipeline.h"
+#include "seq.h"
+
+
+typedef enum { WINDOW_STAGE, LUT_STAGE } PointStageType;
+
+
+struct PointStage {
+  PointStageType type;
+  float          M, B;          // window: Y' = Y * M + B
+  unsigned char  lut[256];      // tone curve: v' = lut[v] for each of R, G, and B
+  int            numOps;        // number of edits combined in this stage
+};
+
+
+class EditPlan {
+
+  unsigned int width, height;   // image dimensions for which the plan was made
+
+  int              equalizeRadius;  // 0 if there is no equalization
+  int              numEqualizeOps;  // number of equalizations, including those that were dropped
+  ProjectionParams params;
+  seq<PointStage>  pointStages;
+
+  friend class PointStageRunner;
+
+  void runPointStages( Image *image, int y0, int y1 );
+
+ public:
+
+  EditPlan( EditPipeline &pipeline, unsigned int imageWidth, unsigned int imageHeight );
+
+  void dump( ostream &out );
+
+  // Put the result for 'srcImage' in 'destImage'.  If 'fused' is
+  // false, each stage is run over the whole image before the next.
+
+  void run( Image *srcImage, Image *destImage, bool fused = true );
+};
+
+
+#endif
@@ -2,99 +2,325 @@
 
 
 #include "editor.h"
+#include "projectionWorker.h"
+#include "main.h"
 
+#include <chrono>
 
 
-// Take the source image, apply the provided transform, T, and store
-// the transformed image in the destination image.
+
+Editor::Editor( Texture *image )
+
+{
+  displayedImage = image; // this is the image that the Canvas class draws
+
+  // The original takes over the file's pixels, which stay in the
+  // mapped raw cache if there is one, and stay RGB if the image is
+  // opaque.  'baseImage' shares them until an edit needs pixels of
+  // its own.
+
+  originalImage = new Image();
+  originalImage->takeTexmap( image );
+  originalImage->name = image->name;
+
+  baseImage = originalImage;
+
+  // Projection leaves transparent pixels in the displayed image, and
+  // its pixels are swapped with the projection worker's buffers, so
+  // it gets RGBA pixels of its own
+
+  displayedImage->copyAsRGBA( originalImage );
+
+  editMode = SCALE;
+  projectionMode = FORWARD;
+  interpolation = NEAREST;
+  mipMapping = TRILINEAR_MIPMAP;
+
+  mouseDragging = false;
+
+  initEditingParams();
+
+  // Choose the preview reduction for drags on large images
+
+  int shrink = 1;
+  while (shrink < (1 << NUM_PROXY_LEVELS) &&
+	 (image->width / shrink) * (image->height / shrink) > MAX_PREVIEW_PIXELS)
+    shrink *= 2;
+
+  previewShrink.store( shrink );
+  secondsPerPixel = 0; // not yet measured
+
+  for (int i=0; i<NUM_PROXY_LEVELS; i++) {
+    proxyImages[i]   = NULL;
+    previewImages[i] = NULL;
+  }
+
+  previewShown = false;
+
+  saveThread = NULL;
+  saveState.store( NOT_SAVING );
+
+  worker = new ProjectionWorker( this, displayedImage, glfwPostEmptyEvent ); // wake the main loop when a frame is ready
+}
+
+
+
+Editor::~Editor()
+
+{
+  if (saveThread != NULL) {
+    saveThread->join();
+    delete saveThread;
+  }
+
+  delete worker;
+  freeProxyImages();
+  if (baseImage != originalImage)
+    delete baseImage;
+  delete originalImage;
+}
+
+
+
+// Compute the projection of 'srcImage' into 'destImage'.
 //
-// Where a pixel in the destination image has no corresponding (valid)
-// pixel in the source image, use the 'transparentPixel'
+// If 'params.shrink' is more than 1, this is a quick preview: the
+// projection is computed from a proxy of 'srcImage' at reduced
+// resolution and then enlarged to fill 'destImage'.  The transform
+// is conjugated with the reduction so that the preview matches the
+// full-resolution result, apart from its coarser pixels.
 //
-// Also apply the intensity transform.
+// Returns false if the work was abandoned for a newer request.
+
+bool Editor::render( Image *srcImage, Image *destImage, ProjectionParams &params, ProjectionCanceller *canceller )
+
+{
+  typedef std::chrono::steady_clock Clock;
+
+  if (params.shrink <= 1) {
+
+    Clock::time_point start = Clock::now();
+
+    if (!project( srcImage, destImage, params, canceller ))
+      return false;
+
+    adjustPreviewShrink( destImage, std::chrono::duration<double>( Clock::now() - start ).count() );
+    return true;
+  }
+
+  int level = 0;
+  while ((2 << level) < params.shrink && level < NUM_PROXY_LEVELS-1)
+    level++;
+
+  int k = 2 << level;
+
+  if (proxyImages[level] == NULL) {
+
+    unsigned int w = (srcImage->width  + k-1) / k;
+    unsigned int h = (srcImage->height + k-1) / k;
+
+    proxyImages[level] = new Image( w, h, srcImage->hasAlpha );
+    shrinkImage( srcImage, proxyImages[level], k );
+
+    previewImages[level] = new Image( w, h );
+  }
+
+  ProjectionParams previewParams = params;
 
+  previewParams.transform = scale2d( 1.0/k, 1.0/k ) * params.transform * scale2d( k, k );
+  previewParams.shrink = 1;
 
-void Editor::project( Texture *srcImage, Texture *destImage )
+  Clock::time_point start = Clock::now();
+
+  if (!project( proxyImages[level], previewImages[level], previewParams, canceller ))
+    return false;
+
+  adjustPreviewShrink( previewImages[level], std::chrono::duration<double>( Clock::now() - start ).count() );
+
+  enlargeImage( previewImages[level], destImage, k );
+
+  return true;
+}
+
+
+
+// Update the per-pixel cost of projection with a measurement of
+// 'seconds' to project into 'projected', then choose the finest
+// preview reduction that is expected to take no more than
+// TARGET_FRAME_TIME.  This adapts the previews to the machine and to
+// the current edit (e.g. forward projection of an enlarged image
+// costs more per pixel).
+//
+// Only the footprint of 'projected' was computed, so the cost is per
+// footprint pixel, and the next projection is assumed to cover the
+// same fraction of the image.
+
+void Editor::adjustPreviewShrink( Image *projected, double seconds )
 
 {
-  // Check that dimensions match
-  
-  if (srcImage->width != destImage->width || srcImage->height != destImage->height) {
-    cerr << "in Editor::project() the source and destination images have different dimensions" << endl;
-    exit(1);
+  unsigned int nPixels = projected->footprint.area();
+
+  if (nPixels == 0)
+    return;
+
+  double coveredFraction = nPixels / (double) (projected->width * projected->height);
+
+  double cost = seconds / nPixels;
+
+  if (secondsPerPixel == 0)
+    secondsPerPixel = cost;
+  else
+    secondsPerPixel = 0.7 * secondsPerPixel + 0.3 * cost; // smooth out timing noise
+
+  unsigned int w = displayedImage->width;
+  unsigned int h = displayedImage->height;
+
+  int shrink = 1;
+  while (shrink < (1 << NUM_PROXY_LEVELS) &&
+	 coveredFraction * ((w+shrink-1)/shrink) * ((h+shrink-1)/shrink) * secondsPerPixel > TARGET_FRAME_TIME)
+    shrink *= 2;
+
+  previewShrink.store( shrink );
+}
+
+
+
+// Free the proxies of 'baseImage'.  The worker must be idle.
+
+void Editor::freeProxyImages()
+
+{
+  for (int i=0; i<NUM_PROXY_LEVELS; i++) {
+    delete proxyImages[i];
+    delete previewImages[i];
+    proxyImages[i]   = NULL;
+    previewImages[i] = NULL;
   }
+}
 
-  // Project
 
-  mat4 T = recentMovementTransform * accumulatedTransform;
-  
-  Pixel transparentPixel = { 0,0,0,0 }; // fully transparent pixel (alpha = 0, so r,g,b doesn't matter)
-    
-  if (projectionMode == FORWARD) { // Forward projection
-    
-    // Set all of the image to transparent pixels in case there are
-    // destination locations that do not get written to with forward
-    // projection.
 
-    for (unsigned int x=0; x<destImage->width; x++)
-      for (unsigned int y=0; y<destImage->height; y++)
-        destImage->pixel( x, y ) = transparentPixel;
+// Snapshot of the current editing parameters for project()
 
-    // Do the forward projection
+ProjectionParams Editor::currentProjectionParams()
 
-    for (unsigned int x=0; x<srcImage->width; x++)
-      for (unsigned int y=0; y<srcImage->height; y++) {
-        vec4 destPos = T * vec4(x,y,0,1);
-        if (destPos.x >= 0 && destPos.x < destImage->width && destPos.y >= 0 && destPos.y < destImage->height) {
+{
+  ProjectionParams params;
 
-	  Pixel p = srcImage->pixel(x,y);
+  params.transform      = recentMovementTransform * accumulatedTransform;
+  params.intensityScale = recentIntensityScale * accumulatedIntensityScale;
+  params.intensityBias  = recentIntensityBias  + accumulatedIntensityBias;
+  params.projectionMode = projectionMode;
+  params.interpolation  = interpolation;
+  params.mipMapping     = (Image::useMipMaps ? mipMapping : NO_MIPMAPS);
+  params.shrink         = (mouseDragging ? previewShrink.load() : 1);
 
-	  p = applyIntensityTransform( p );
-	  
-          destImage->pixel( (int) destPos.x, (int) destPos.y ) = p;
-	}
-      }
+  return params;
+}
 
-  } else { // Backward projection
 
-    // Where a destination pixel has no corresponding source pixel,
-    // set the destination pixel to 'transparentPixel'.
-    // 
-    // Note that the inverse must not be recalculated with every
-    // iteration of the loops.  That's incredibly slow.  Use 'inverse'
-    // from linalg.h.
-    //
-    // Use 'applyIntensityTransform()' as above.
-    
-    // YOUR CODE HERE
 
-    // Calculate inverse transformation matrix once for efficiency
-    mat4 T_inverse = T.inverse();
-    
-    // For each destination pixel
-    for (unsigned int x=0; x<destImage->width; x++) {
-      for (unsigned int y=0; y<destImage->height; y++) {
-        
-        // Apply inverse transform to find corresponding source position
-        vec4 srcPos = T_inverse * vec4(x, y, 0, 1);
-        
-        // Check if source position is within valid bounds
-        if (srcPos.x >= 0 && srcPos.x < srcImage->width && 
-            srcPos.y >= 0 && srcPos.y < srcImage->height) {
-          
-          // Valid source pixel - copy it and apply intensity transform
-          Pixel p = srcImage->pixel((int) srcPos.x, (int) srcPos.y); // The casting performs nearest-neighbor sampling
-          p = applyIntensityTransform(p);
-          destImage->pixel(x, y) = p;
-          
-        } else {
-          // No valid source pixel - use transparent pixel
-          destImage->pixel(x, y) = transparentPixel;
-        }
-      }
-    }
+// Ask the worker to project 'baseImage' into 'displayedImage' with
+// the current parameters.  The result appears in a later update().
+
+void Editor::requestProjection()
+
+{
+  ProjectionParams params = currentProjectionParams();
+
+  if (params.shrink > 1)
+    previewShown = true;
+
+  worker->request( baseImage, params );
+}
+
+
+
+// Save the edited image in the background, in the format given by
+// the extension of 'filename'.  Returns false if an earlier save is
+// still running.
+//
+// 'displayedImage' may still hold a drag preview or an earlier edit
+// that the worker has not yet replaced, so the image is projected
+// afresh at full resolution with the current parameters.
+
+bool Editor::saveImage( string filename, int level )
+
+{
+  if (saveState.load() == SAVING)
+    return false;
+
+  if (saveThread != NULL) {
+    saveThread->join();
+    delete saveThread;
+  }
+
+  // Copy 'baseImage' on this thread, which is the only one that
+  // changes it.  The projection then runs on the save thread without
+  // sharing the copy, or its mip map, with the worker.
+
+  Image *src = new Image( *baseImage );
+
+  ProjectionParams params = currentProjectionParams();
+  params.shrink = 1;
+
+  unsigned int w = displayedImage->width;
+  unsigned int h = displayedImage->height;
+
+  saveFilename = filename;
+  saveState.store( SAVING );
+
+  saveThread = new std::thread( [this, src, params, w, h, filename, level]() mutable {
+
+    Image *result = new Image( w, h );
+    project( src, result, params );
+    delete src;
+
+    bool ok = writeImage( result, filename, level );
+    delete result;
+
+    if (!ok)
+      cerr << "Error saving '" << filename << "'" << endl;
+
+    saveState.store( ok ? SAVED : SAVE_FAILED );
+    glfwPostEmptyEvent(); // wake the main loop to show the new status
+  } );
+
+  return true;
+}
+
+
+
+string Editor::saveStatus()
+
+{
+  switch (saveState.load()) {
+  case SAVING:      return "saving " + saveFilename;
+  case SAVED:       return "saved " + saveFilename;
+  case SAVE_FAILED: return "could not save " + saveFilename;
+  default:          return "";
+  }
+}
+
+
+
+// Called from the main loop: show any newly projected frame and the
+// end of any save.
+
+void Editor::update()
+
+{
+  if (worker->receive( displayedImage )) {
+    displayedImage->updated = true; // necessary to get new image shipped to GPU
+    postRedisplay();
+  }
+
+  if (saveThread != NULL && saveState.load() != SAVING) {
+    saveThread->join();
+    delete saveThread;
+    saveThread = NULL;
+    postRedisplay();
   }
-  destImage->updated = true; // necessary to get new image shipped to GPU
 }
 
 
@@ -104,6 +330,7 @@ void Editor::startMouseMotion( float x, float y )
 {
   initMousePosition = vec2(x,y);
   mouseDragging = true;
+  previewShown = false;
 }
 
 
@@ -175,7 +402,7 @@ void Editor::mouseMotion( float x, float y )
 
     // Apply the new transform using the project() function
     
-    project( baseImage, displayedImage );
+    requestProjection();
 
   } else if (editMode == SCALE) {
 
@@ -184,13 +411,13 @@ void Editor::mouseMotion( float x, float y )
     float initDist    = (initMousePosition - imageCentre).length();
     float currentDist = (mousePosition - imageCentre).length();
 
-    float scaleFactor = currentDist / initDist;
+    double scaleFactor = currentDist / (double) initDist;
 
-    recentMovementTransform =   translate( imageCentre.x, imageCentre.y, 0 )
-                              * scale( scaleFactor, scaleFactor, 1 )
-                              * translate( -imageCentre.x, -imageCentre.y, 0 );
+    recentMovementTransform =   translate2d( imageCentre.x, imageCentre.y )
+                              * scale2d( scaleFactor, scaleFactor )
+                              * translate2d( -imageCentre.x, -imageCentre.y );
 
-    project( baseImage, displayedImage );
+    requestProjection();
   }
 }
 
@@ -209,7 +436,7 @@ void Editor::stopMouseMotion()
     // Incorporate the transform from the mouse drag into the 'accumulatedTransform'.
 
     accumulatedTransform = recentMovementTransform * accumulatedTransform;
-    recentMovementTransform = identity4();
+    recentMovementTransform = identity2d();
 
   } else if (editMode == INTENSITY) {
 
@@ -220,9 +447,16 @@ void Editor::stopMouseMotion()
     
     accumulatedIntensityBias  = recentIntensityBias  + accumulatedIntensityBias;
     recentIntensityBias = 0;
-}
+  }
   
   mouseDragging = false;
+
+  // Replace the reduced-resolution preview with the exact result
+
+  if (previewShown)
+    requestProjection();
+
+  postRedisplay();
 }
 
 
@@ -237,6 +471,10 @@ void Editor::keyPress( int keyInt )
   if (mouseDragging)
     return;
 
+  // Any handled key can change the status line or image
+
+  postRedisplay();
+
   // handle key press
   
   switch (key) {
@@ -254,19 +492,47 @@ void Editor::keyPress( int keyInt )
     
   case 'F':
     projectionMode = FORWARD;
-    project( baseImage, displayedImage );
+    requestProjection();
     break;
 
   case 'B':
     projectionMode = BACKWARD;
-    project( baseImage, displayedImage );
+    requestProjection();
+    break;
+
+    // Interpolation in backward projection (cycles through the kinds)
+
+  case 'R':
+    interpolation = (Interpolation) ((interpolation + 1) % NUM_INTERPOLATIONS);
+    if (projectionMode == BACKWARD)
+      requestProjection();
+    break;
+
+    // Mip mapping in backward projection: off, nearest level, trilinear
+
+  case 'M':
+    if (!Image::useMipMaps) {
+      Image::useMipMaps = true;
+      mipMapping = NEAREST_MIPMAP;
+    } else if (mipMapping == NEAREST_MIPMAP)
+      mipMapping = TRILINEAR_MIPMAP;
+    else
+      Image::useMipMaps = false;
+    if (projectionMode == BACKWARD)
+      requestProjection();
     break;
 
     // Histogram equalization
     
   case 'E':
+    worker->cancelAndWait(); // worker must not read 'baseImage' while it changes
+    freeProxyImages();
+    if (baseImage == originalImage) // the first edit that needs pixels of its own
+      baseImage = new Image( originalImage->width, originalImage->height, originalImage->hasAlpha );
+    else
+      baseImage->freeMipMaps();
     histogramEqualization( originalImage, baseImage, histoRadius );
-    project( baseImage, displayedImage );
+    requestProjection();
     break;
 
   case '+':
@@ -285,211 +551,27 @@ void Editor::keyPress( int keyInt )
     
   case 'Z':
     initEditingParams();
-    delete baseImage;
-    baseImage = new Texture( *originalImage );
-    project( baseImage, displayedImage );
+    worker->cancelAndWait(); // worker must not read 'baseImage' while it is replaced
+    freeProxyImages();
+    if (baseImage != originalImage)
+      delete baseImage;
+    baseImage = originalImage;
+    requestProjection();
     break;
-  }
-}
-
-
-
-// Convert RGB pixel in [0,255]x[0,255]x[0,255] into YUV pixel in same
-// ranges.  The Y channel [0,255] maps to [0,1], while the U and V
-// channels [0,255] maps to [-0.5,+0.5].
 
-Pixel Editor::rgb_to_yuv( Pixel rgbPixel )
-
-{
-  vec3 rgb( rgbPixel.r / 255.0, 
-	    rgbPixel.g / 255.0, 
-	    rgbPixel.b / 255.0 );
-
-  vec3 yuv = RGBtoYUV * rgb;
-
-  return Pixel( clamp255( rintf(yuv.x * 255) ), 
-		clamp255( rintf((yuv.y + 0.5) * 255) ), 
-		clamp255( rintf((yuv.z + 0.5) * 255) ), 
-		rgbPixel.a );
-}
-
-
-
-// Convert YUV pixel in [0,255]x[0,255]x[0,255] into RGB pixel in same
-// ranges.
-
-Pixel Editor::yuv_to_rgb( Pixel yuvPixel )
-
-{
-  vec3 yuv( yuvPixel.r / 255.0, 
-	    yuvPixel.g / 255.0 - 0.5, 
-	    yuvPixel.b / 255.0 - 0.5 );
-
-  vec3 rgb = YUVtoRGB * yuv;
-
-  return Pixel( clamp255( rint(rgb.x * 255) ), 
-		clamp255( rint(rgb.y * 255) ), 
-		clamp255( rint(rgb.z * 255) ),
-		yuvPixel.a );
-}
-
-
-
-// Given an RGB pixel, p, convert it to YUV, then apply the intensity
-// transform as
-//
-//   Y' = Y * M + B
-//
-// where M is the combination of the 'recentIntensityScale' and
-// 'accumulatedIntensityScale', and B is the combination of
-// 'recentIntensityBias' and 'accumulatedIntensityBias'.
-//
-// A pixel p has components p.r, p.g, p.b.  After conversion to YUV,
-// those components store p.r = Y, p.g = U, p.b = V.
-//
-// Notet that Y is in the range [0,255] and must be converted to [0,1]
-// before applying the transform.
-//
-// Ensure that Y' is not transformed outside the range [0,1].
-//
-// Convert Y' back from [0,1] to [0,255] before storing.
-
-
-Pixel Editor::applyIntensityTransform( Pixel rgb )
-
-{
-  // YOUR CODE HERE
-  // Convert to YUV (Y in [0,255], U,V encoded in [0,255] with +/-0.5 bias)
-  Pixel yuv = rgb_to_yuv(rgb);
-
-  // Build total slope & intercept
-  float M = recentIntensityScale * accumulatedIntensityScale;
-  float B = recentIntensityBias  + accumulatedIntensityBias;
-
-  // Map Y in [0,255] -> [0,1]
-  float Y  = (float)yuv.r / 255.0f;
-
-  // Apply transform and clamp to [0,1]
-  float Y_prime = Y * M + B;
-  if (Y_prime < 0.0f) Y_prime = 0.0f;
-  if (Y_prime > 1.0f) Y_prime = 1.0f;
-
-  // Store back into Y channel in [0,255]
-  yuv.r = clamp255( rintf( Y_prime * 255.0f ) );
-
-  // Convert back to RGB
-  Pixel out = yuv_to_rgb(yuv);
-  
-  // Note that both rgb_to_yuv and yuv_to_rgb preserve alpha
-  return out;
-}
-
-
-// Perform LOCAL histogram equalization on 'srcImage'.  Fill in
-// 'destImage' with the result.  Do the local histogram in a square
-// neighbourhood around each pixel.  If 'histoRadius' is R, the
-// neighbourhood is (2R+1) x (2R+1).
-//
-// Do not build the full histogram.  This code should be efficient.
-
-
-void Editor::histogramEqualization( Texture *srcImage, Texture *destImage, int histoRadius )
-
-{
-  // YOUR CODE HERE
-
-  // For each pixel:
-  // Define a local neighborhood
-  // Build histogram of Y values in that neighborhood
-  // Calculate CDF (cumulative distribution function)
-  // Use CDF to transform the center pixel's Y value
-  // Preserve U and V (color) components
-  //
-  // Formula for histogram equalization:
-  // Y' = (CDF[Y] - CDF_min) / (totalPixels - CDF_min) * 255
-  //
-  // Where CDF_min is the minimum non-zero CDF value
-
-  // Process each pixel in the source image
-  for (int centerX = 0; centerX < srcImage->width; centerX++) {
-    for (int centerY = 0; centerY < srcImage->height; centerY++) {
-      
-      // Build histogram for local neighborhood
-      int histogram[256] = {0};  // Initialize all bins to 0
-      int totalPixels = 0;
-      
-      // Define neighborhood bounds
-      int minX = centerX - histoRadius;
-      int maxX = centerX + histoRadius;
-      int minY = centerY - histoRadius;
-      int maxY = centerY + histoRadius;
-      
-      // Clamp to image boundaries
-      if (minX < 0) minX = 0;
-      if (maxX >= (int)srcImage->width) maxX = srcImage->width - 1;
-      if (minY < 0) minY = 0;
-      if (maxY >= (int)srcImage->height) maxY = srcImage->height - 1;
-      
-      // Build histogram from neighborhood
-      for (int x = minX; x <= maxX; x++) {
-        for (int y = minY; y <= maxY; y++) {
-          // Get pixel and convert to YUV
-          Pixel rgb = srcImage->pixel(x, y);
-          Pixel yuv = rgb_to_yuv(rgb);
-          
-          // Increment histogram bin for this Y value which is the first channel
-          histogram[yuv.r]++;
-          totalPixels++;
-        }
-      }
-      
-      // Calculate CDF from histogram
-      int cdf[256] = {0};
-      cdf[0] = histogram[0]; // Initialize first bin
-      for (int i = 1; i < 256; i++) {
-        cdf[i] = cdf[i-1] + histogram[i];
-      }
-      
-      // Find minimum non-zero CDF value
-      int cdf_min = 0;
-      for (int i = 0; i < 256; i++) {
-        if (cdf[i] > 0) {
-          cdf_min = cdf[i];
-          break;
-        }
-      }
-      
-      // Get center pixel and convert to YUV
-      Pixel centerRgb = srcImage->pixel(centerX, centerY);
-      Pixel centerYuv = rgb_to_yuv(centerRgb);
-      
-      // Apply histogram equalization to Y component
-      // Formula: Y' = ((CDF[Y] - CDF_min) / (totalPixels - CDF_min)) * 255
-      int oldY = centerYuv.r;
-      unsigned char newY;
-      
-      if (totalPixels - cdf_min > 0) {
-        // Apply equalization formula
-        float normalized = (float)(cdf[oldY] - cdf_min) / (float)(totalPixels - cdf_min);
-        newY = (unsigned char)(normalized * 255.0);
-      } else {
-        // Edge case: all pixels in neighborhood have same value
-        newY = oldY;
-      }
-      
-      // Update Y component, keep U and V unchanged (preserves color)
-      centerYuv.r = newY;
-      
-      // Convert back to RGB and store in destination
-      Pixel resultRgb = yuv_to_rgb(centerYuv);
-      destImage->pixel(centerX, centerY) = resultRgb;
-    }
+    // Write the edited image to <name>-edited.<ext>, in the
+    // format of the source if it can be written, and otherwise as a
+    // PNG
+
+  case 'W': {
+    string name = displayedImage->name;
+    string extension = imageFormatNames[ outputFormatOfName( name ) ];
+    size_t dot = name.rfind( '.' );
+    if (dot != string::npos && name.find( '/', dot ) == string::npos)
+      name = name.substr( 0, dot );
+    if (!saveImage( name + "-edited." + extension ))
+      cerr << "A save is already in progress" << endl;
+    break;
+  }
   }
-  
-  // Mark destination as updated so it gets sent to GPU
-  destImage->updated = true;
-
-
-  
 }
-
@@ -6,23 +6,66 @@
 
 #include "headers.h"
 #include "texture.h"
+#include "projection.h"
+#include "intensity.h"
+#include "imageFormats.h"
+
+#include <atomic>
+#include <thread>
 
 
 typedef enum { INTENSITY, SCALE } EditMode;
-typedef enum { FORWARD, BACKWARD } ProjectionMode;
+
+typedef enum { NOT_SAVING, SAVING, SAVED, SAVE_FAILED } SaveState;
+
+
+#define MAX_PREVIEW_PIXELS 1000000 // initial guess: drag previews have at most about this many pixels
+#define NUM_PROXY_LEVELS   3       // proxies at 1/2, 1/4, and 1/8 resolution
+#define TARGET_FRAME_TIME  0.016   // seconds allowed for each projection while dragging
+
+
+class ProjectionWorker;
 
 
 class Editor {
 
-  Texture *originalImage;       // original, never changed
-  Texture *baseImage;           // base image being edited
+  Image   *originalImage;       // original, never changed, and left in the mapped raw cache if there is one
+  Image   *baseImage;           // base image being edited, or 'originalImage' until an edit changes it
   Texture *displayedImage;      // is 'baseImage' after geometric and intensity transforms
 
+  ProjectionWorker *worker;     // computes 'displayedImage' in the background
+
+  // While dragging, 'displayedImage' is computed from a reduced
+  // resolution copy of 'baseImage' and enlarged.  proxyImages[i] is
+  // 'baseImage' reduced by a factor of 2^(i+1), and previewImages[i]
+  // holds the projection at that resolution.  These are built and
+  // used only on the worker thread, and are freed whenever
+  // 'baseImage' changes.
+
+  Image *proxyImages[ NUM_PROXY_LEVELS ];
+  Image *previewImages[ NUM_PROXY_LEVELS ];
+
+  // The preview reduction is chosen by measuring how long each
+  // projection takes, per pixel, and picking the finest reduction
+  // that should fit in TARGET_FRAME_TIME.  'secondsPerPixel' is a
+  // running average that is used only on the worker thread.
+
+  std::atomic<int> previewShrink; // reduction used for drag previews (1, 2, 4, or 8)
+  double           secondsPerPixel;
+
+  void adjustPreviewShrink( Image *projected, double seconds );
+
+  // Saving projects and encodes a copy of 'baseImage' on its own
+  // thread, so the editor stays responsive while a large image is
+  // compressed.
+
+  std::thread           *saveThread;
+  std::atomic<SaveState> saveState;
+  string                 saveFilename;
+
   vec2 initMousePosition;       // position on initial mouse click
   bool mouseDragging;		// true while mouse is being dragged to edit
-
-  mat3 RGBtoYUV;
-  mat3 YUVtoRGB;
+  bool previewShown;            // true if a reduced-resolution preview was requested during this drag
 
   void initEditingParams() {
 
@@ -30,63 +73,47 @@ class Editor {
 
     accumulatedIntensityScale = 1;
     accumulatedIntensityBias  = 0;
-    accumulatedTransform      = identity4();
+    accumulatedTransform      = identity2d();
 
     recentIntensityScale    = 1;
     recentIntensityBias     = 0;
-    recentMovementTransform = identity4();
-  }
-
-  unsigned char clamp255( float x ) {
-    if (x < 0)
-      return 0;
-    else if (x > 255)
-      return 255;
-    else
-      return x;
+    recentMovementTransform = identity2d();
   }
 
  public:
 
   EditMode       editMode;
   ProjectionMode projectionMode;
+  Interpolation  interpolation;
+  MipMapping     mipMapping;        // used only if Image::useMipMaps is true
 
-  int   histoRadius;               // neighbourhood for histogram equalization
+  int      histoRadius;               // neighbourhood for histogram equalization
 
-  float recentIntensityScale;      // current intensity scale through mouse dragging
-  float recentIntensityBias;       // current intensity bias through mouse dragging
-  mat4  recentMovementTransform;   // current geometric transform through mouse dragging
+  float    recentIntensityScale;      // current intensity scale through mouse dragging
+  float    recentIntensityBias;       // current intensity bias through mouse dragging
+  affine2d recentMovementTransform;   // current geometric transform through mouse dragging
 
-  float accumulatedIntensityScale; // all slope transforms of pixel intensity so far, accumulated
-  float accumulatedIntensityBias;  // all intercept transforms of pixel intensity so far, accumulated
-  mat4  accumulatedTransform;      // all geometry transforms so far, accumulated in one matrix
+  float    accumulatedIntensityScale; // all slope transforms of pixel intensity so far, accumulated
+  float    accumulatedIntensityBias;  // all intercept transforms of pixel intensity so far, accumulated
+  affine2d accumulatedTransform;      // all geometry transforms so far, accumulated in one transform
 
-  Editor( Texture *image ) {
+  Editor( Texture *image );
+  ~Editor();
 
-    displayedImage = image; // this is the image that the Canvas class draws
-    originalImage  = new Texture( *image );
-    baseImage      = new Texture( *image );
+  bool render( Image *srcImage, Image *destImage, ProjectionParams &params, ProjectionCanceller *canceller = NULL );
 
-    editMode = SCALE;
-    projectionMode = FORWARD;
+  void freeProxyImages();
 
-    mouseDragging = false;
-
-    initEditingParams();
-
-    RGBtoYUV.rows[0] = {  0.299,    0.587,    0.114   };
-    RGBtoYUV.rows[1] = { -0.14713, -0.28886,  0.436   };
-    RGBtoYUV.rows[2] = {  0.615,   -0.51499, -0.10001 };
-
-    YUVtoRGB = RGBtoYUV.inverse();
+  int previewReduction() {      // for the status line
+    return previewShrink.load();
   }
 
-  void histogramEqualization( Texture *srcImage, Texture *destImage, int histoRadius );
-  Pixel applyIntensityTransform( Pixel p );
-  void project( Texture *srcImage, Texture *destImage );
-  
-  Pixel rgb_to_yuv( Pixel rgb );
-  Pixel yuv_to_rgb( Pixel yuv );
+  bool saveImage( string filename, int level = PNG_DEFAULT_LEVEL );
+  string saveStatus();          // for the status line
+
+  ProjectionParams currentProjectionParams();
+  void requestProjection();
+  void update();
   
   void startMouseMotion( float x, float y );
   void mouseMotion( float x, float y );
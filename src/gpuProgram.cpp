@@ -161,6 +161,10 @@ void GPUProgram::init( const char *vsTextIn, const char *fsTextIn, const char* s
   glDeleteVertexArrays( 1, &dummy );
 #endif
 
+  programName = strdup( shaderName );
+
+  findUniformLocations();
+
   glUseProgram( program_id );
   glUseProgram( 0 );
   
@@ -203,3 +207,77 @@ void GPUProgram::initFromFile( const char *vsFile, const char *fsFile, const cha
     
   init( vsText, fsText, shaderName );
 }
+
+
+
+// Record the locations of all active uniforms in the linked program.
+//
+// Array uniforms are reported by OpenGL as "name[0]".  They are
+// stored as "name" so that they can be looked up as in the shader.
+
+void GPUProgram::findUniformLocations()
+
+{
+  GLint nUniforms = 0, maxLength = 0;
+
+  glGetProgramiv( program_id, GL_ACTIVE_UNIFORMS, &nUniforms );
+  glGetProgramiv( program_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength );
+
+  char *buffer = new char[ maxLength+1 ];
+
+  for (int i=0; i<nUniforms; i++) {
+
+    GLint size;
+    GLenum type;
+    GLsizei length = 0;
+
+    glGetActiveUniform( program_id, i, maxLength+1, &length, &size, &type, buffer );
+    buffer[length] = '\0';
+
+    char *bracket = strchr( buffer, '[' );
+    if (bracket != NULL)
+      *bracket = '\0';
+
+    UniformLocation u;
+
+    u.name     = strdup( buffer );
+    u.location = glGetUniformLocation( program_id, u.name );
+
+    uniforms.add( u );
+  }
+
+  delete [] buffer;
+}
+
+
+GLint GPUProgram::uniformLocation( const char *name )
+
+{
+  for (int i=0; i<uniforms.size(); i++)
+    if (strcmp( uniforms[i].name, name ) == 0)
+      return uniforms[i].location;
+
+  reportUnknownUniform( name );
+
+  return -1; // glUniform*() silently ignores location -1
+}
+
+
+// In debug builds, report each unknown uniform name once.  This is
+// usually a misspelling, or a uniform that the shader compiler
+// removed because it does not affect the output.
+
+void GPUProgram::reportUnknownUniform( const char *name )
+
+{
+#ifndef NDEBUG
+  for (int i=0; i<unknownUniforms.size(); i++)
+    if (strcmp( unknownUniforms[i], name ) == 0)
+      return;
+
+  unknownUniforms.add( strdup( name ) );
+
+  std::cerr << "GPUProgram (" << (programName != NULL ? programName : "unnamed")
+            << "): unknown uniform '" << name << "'" << std::endl;
+#endif
+}
@@ -17,15 +17,40 @@ class GPUProgram {
 
   static seq<unsigned int> active_programs; // stack of active GPU programs to allow nested activation
 
+  // Uniform locations are found once at link time and cached here so
+  // that the set*() functions do not call glGetUniformLocation() on
+  // every use.  Programs have only a handful of uniforms, so a
+  // linear search of the names is much cheaper than asking the driver.
+
+  struct UniformLocation {
+    char  *name;
+    GLint  location;
+  };
+
+  seq<UniformLocation> uniforms;
+  seq<char *>          unknownUniforms; // names already reported as unknown
+
+  char *programName;
+
+  void findUniformLocations();
+  void reportUnknownUniform( const char *name );
+
  public:
 
-  GPUProgram() {};
+  GPUProgram() { programName = NULL; };
 
   GPUProgram( const char *vsFile, const char *fsFile, const char* shaderName ) {
     initFromFile( vsFile, fsFile, shaderName );
   }
 
   ~GPUProgram() {
+    for (int i=0; i<uniforms.size(); i++)
+      free( uniforms[i].name );
+    for (int i=0; i<unknownUniforms.size(); i++)
+      free( unknownUniforms[i] );
+    if (programName != NULL)
+      free( programName );
+
     glDetachShader( program_id, shader_vp );
     glDeleteShader( shader_vp );
 
@@ -56,32 +81,70 @@ class GPUProgram {
 
   char* textFileRead(const char *fileName);
 
+  // Cached uniform location, or -1 if 'name' is not an active uniform
+  // in this program.  The location can be kept by the caller and
+  // passed to the set*() functions below as a handle.
+
+  GLint uniformLocation( const char *name );
+
+  // Set uniforms by name
+
   void setMat4( const char *name, mat4 &M ) {
-    glUniformMatrix4fv( glGetUniformLocation( program_id, name ), 1, GL_TRUE, &M[0][0] );
+    setMat4( uniformLocation( name ), M );
   }
 
   void setVec3( const char *name, vec3 v ) {
-    glUniform3fv( glGetUniformLocation( program_id, name ), 1, &v[0] );
+    setVec3( uniformLocation( name ), v );
   }
 
   void setVec3( const char *name, vec3 *vs, int size ) {
-    glUniform3fv( glGetUniformLocation( program_id, name ), size, &vs[0][0] ); /* indexed array */
+    setVec3( uniformLocation( name ), vs, size );
   }
 
   void setVec2( const char *name, vec2 v ) {
-    glUniform2fv( glGetUniformLocation( program_id, name ), 1, &v[0] );
+    setVec2( uniformLocation( name ), v );
   }
 
   void setVec4( const char *name, vec4 v ) {
-    glUniform4fv( glGetUniformLocation( program_id, name ), 1, &v[0] );
+    setVec4( uniformLocation( name ), v );
   }
 
   void setFloat( const char *name, float f ) {
-    glUniform1f( glGetUniformLocation( program_id, name ), f );
+    setFloat( uniformLocation( name ), f );
   }
 
   void setInt( const char *name, int i ) {
-    glUniform1i( glGetUniformLocation( program_id, name ), i );
+    setInt( uniformLocation( name ), i );
+  }
+
+  // Set uniforms by location (as returned by uniformLocation())
+
+  void setMat4( GLint location, mat4 &M ) {
+    glUniformMatrix4fv( location, 1, GL_TRUE, &M[0][0] );
+  }
+
+  void setVec3( GLint location, vec3 v ) {
+    glUniform3fv( location, 1, &v[0] );
+  }
+
+  void setVec3( GLint location, vec3 *vs, int size ) {
+    glUniform3fv( location, size, &vs[0][0] ); /* indexed array */
+  }
+
+  void setVec2( GLint location, vec2 v ) {
+    glUniform2fv( location, 1, &v[0] );
+  }
+
+  void setVec4( GLint location, vec4 v ) {
+    glUniform4fv( location, 1, &v[0] );
+  }
+
+  void setFloat( GLint location, float f ) {
+    glUniform1f( location, f );
+  }
+
+  void setInt( GLint location, int i ) {
+    glUniform1i( location, i );
   }
 
   void glErrorReport( const char *where ) {
@@ -0,0 +1,361 @@
+// image.cpp
+
+
+#include "image.h"
+#include "imageFormats.h"
+#include "pngReader.h"
+#include "projection.h"
+#include "rawCache.h"
+
+#include <thread>
+#include <vector>
+
+
+bool Image::useMipMaps = false;
+bool Image::useRawCache = false;
+
+
+
+void Image::loadImage( string filename, int shrink )
+
+{
+  mapping = NULL;
+
+  // Map the raw cache beside the file if it is up to date.  The
+  // stamp is taken before the file is read, so a cache written below
+  // never claims a later version of the file.  The cache holds the
+  // full-size image, so it is not used for a shrunk one.
+
+  SourceStamp stamp;
+
+  bool cacheable = (useRawCache && shrink == 1 && getSourceStamp( filename, stamp ));
+
+  if (cacheable) {
+    texmap = mapRawCache( filename, stamp, width, height, hasAlpha, mapping, mappingSize );
+    if (texmap != NULL)
+      return;
+  }
+
+  // Read image, in the format given by its first bytes.  The reader
+  // allocates the pixels, which become our texmap without a copy.  An
+  // opaque image comes out as RGB.
+
+  ImageFormat format;
+  int readShrink = shrink;
+
+  const char *error = readImage( filename, &texmap, width, height, hasAlpha, format, readShrink );
+
+  if (error != NULL) {
+    std::cerr << "Error loading '" << filename << "': " << error << std::endl;
+    width = 0;                  // an empty image, which the caller can check for
+    height = 0;
+    texmap = NULL;
+    hasAlpha = true;
+    return;
+  }
+
+  // A format that could not be read shrunk is shrunk here
+
+  if (readShrink != shrink) {
+
+    Image full;
+    full.texmap   = texmap;
+    full.width    = width;
+    full.height   = height;
+    full.hasAlpha = hasAlpha;
+
+    width  = (width  + shrink-1) / shrink;
+    height = (height + shrink-1) / shrink;
+    createEmptyImage();
+
+    shrinkImage( &full, this, shrink );
+    return;
+  }
+
+  // PAM and PPM are read as fast as a cache would be
+
+  if (cacheable && (format == PNG_FORMAT || format == QOI_FORMAT || format == JPEG_FORMAT))
+    writeRawCache( filename, stamp, texmap, width, height, hasAlpha );
+}
+
+
+
+
+// Write the image in the format given by the extension of
+// 'filename' (see imageFormats.h).  Returns false if it could not be
+// written.
+
+bool Image::saveImage( string filename )
+
+{
+  if (!writeImage( this, filename )) {
+    std::cerr << "Error saving '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+
+void Image::createEmptyImage()
+
+{
+  if (!hasAlpha) {
+    texmap = new unsigned char[ width * height * 3 + RGB_PADDING ];
+    memset( texmap, 0, width * height * 3 + RGB_PADDING );
+    return;
+  }
+
+  texmap = new unsigned char[ width * height * 4 ];
+
+  unsigned char *p = texmap;
+  for (unsigned int i=0; i<width*height; i++) {
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 1; // alpha
+  }
+}
+
+
+
+void Image::copyImageFrom( Image *src )
+
+{
+  // Check that dimensions match
+  
+  if (src->width != width || src->height != height) {
+    cerr << "in Image::copyImageFrom() the dimensions do not match" << endl;
+    exit(1);
+  }
+
+  if (src->hasAlpha != hasAlpha) {
+    cerr << "in Image::copyImageFrom() the 'hasAlpha' are not the same" << endl;
+    exit(1);
+  }
+
+  // Copy
+
+  memcpy( texmap, src->texmap, width * height * (hasAlpha ? 4 : 3) );
+
+  footprint = src->footprint;
+}
+
+
+
+
+void Image::addAlpha()
+
+{
+  if (hasAlpha)
+    return;
+
+  unsigned char *rgba = new unsigned char[ width * height * 4 ];
+
+  expandRGBToRGBA( rgba, texmap, width * height );
+
+  freeTexmap();
+  texmap = rgba;
+  hasAlpha = true;
+
+  freeMipMaps();
+}
+
+
+
+void Image::takeTexmap( Image *src )
+
+{
+  freeMipMaps();
+  freeTexmap();
+
+  texmap      = src->texmap;
+  mapping     = src->mapping;
+  mappingSize = src->mappingSize;
+  width       = src->width;
+  height      = src->height;
+  hasAlpha    = src->hasAlpha;
+  footprint   = PixelRect( 0, 0, width, height );
+
+  src->freeMipMaps();
+  src->texmap  = NULL;
+  src->mapping = NULL;
+}
+
+
+
+void Image::copyAsRGBA( Image *src )
+
+{
+  freeMipMaps();
+  freeTexmap();
+
+  width    = src->width;
+  height   = src->height;
+  hasAlpha = true;
+
+  texmap = new unsigned char[ width * height * 4 ];
+
+  if (src->hasAlpha)
+    memcpy( texmap, src->texmap, width * height * 4 );
+  else
+    expandRGBToRGBA( texmap, src->texmap, width * height );
+
+  footprint = PixelRect( 0, 0, width, height );
+}
+
+
+
+void Image::freeTexmap()
+
+{
+  if (mapping != NULL) {
+    unmapRawCache( mapping, mappingSize );
+    mapping = NULL;
+  } else if (texmap != NULL)
+    delete [] texmap;
+
+  texmap = NULL;
+}
+
+
+
+// Find the texel at x,y for x,y in [0,width-1]x[0,height-1]
+//
+// Return a reference to the texel so that it can be read to and
+// written from.
+//
+// The texel is a 4-byte Pixel, so this is only for images with
+// alpha.  Kernels that also read RGB images use readPixel().
+
+
+Pixel & Image::pixel( int x, int y )
+
+{
+  if (x<0) x = 0;
+  if (x>(int)width-1) x = width-1;
+  if (y<0) y = 0;
+  if (y>(int)height-1) y = height-1;
+
+  return * (Pixel*) (texmap + (hasAlpha ? 4 : 3) * (y*width + x));
+}
+
+
+
+// Number of mip map levels, down to 1x1
+
+int Image::numMipMapLevels()
+
+{
+  int n = 1;
+
+  for (unsigned int w=width, h=height; w > 1 || h > 1; n++) {
+    w = (w+1)/2;
+    h = (h+1)/2;
+  }
+
+  return n;
+}
+
+
+
+// Return mip map level 'level', building it (and any levels above it)
+// if necessary.
+
+Image * Image::mipMap( int level )
+
+{
+  if (level <= 0)
+    return this;
+
+  if (level >= numMipMapLevels())
+    level = numMipMapLevels()-1;
+
+  while (mipMaps.size() < level) {
+
+    Image *src = (mipMaps.size() == 0 ? this : mipMaps[ mipMaps.size()-1 ]);
+    Image *dest = new Image( (src->width+1)/2, (src->height+1)/2, src->hasAlpha );
+
+    buildMipMapLevel( src, dest );
+
+    mipMaps.add( dest );
+  }
+
+  return mipMaps[ level-1 ];
+}
+
+
+
+void Image::freeMipMaps()
+
+{
+  for (int i=0; i<mipMaps.size(); i++)
+    delete mipMaps[i];
+
+  mipMaps.clear();
+}
+
+
+
+// Fill 'dest' with a 2x2 box filtering of 'src'.  Colours are weighted
+// by alpha so that transparent pixels do not darken their neighbours.
+// Bands of rows are filtered in parallel.  Both images have CHANNELS
+// bytes per pixel.
+
+template <int CHANNELS> static void boxFilterRows( Image *src, Image *dest, unsigned int yStart, unsigned int yEnd )
+
+{
+  for (unsigned int y=yStart; y<yEnd; y++)
+    for (unsigned int x=0; x<dest->width; x++) {
+
+      unsigned int r = 0, g = 0, b = 0, a = 0, n = 0;
+
+      for (unsigned int sy=2*y; sy<2*y+2 && sy<src->height; sy++)
+	for (unsigned int sx=2*x; sx<2*x+2 && sx<src->width; sx++) {
+	  Pixel p = readPixel<CHANNELS>( src->row<CHANNELS>( sy ) + CHANNELS * sx );
+	  r += p.r * p.a;
+	  g += p.g * p.a;
+	  b += p.b * p.a;
+	  a += p.a;
+	  n++;
+	}
+
+      unsigned char *q = dest->row<CHANNELS>( y ) + CHANNELS * x;
+
+      if (a == 0)
+	writePixel<CHANNELS>( q, Pixel( 0, 0, 0, 0 ) );
+      else
+	writePixel<CHANNELS>( q, Pixel( (r + a/2) / a, (g + a/2) / a, (b + a/2) / a, (a + n/2) / n ) );
+    }
+}
+
+
+void Image::buildMipMapLevel( Image *src, Image *dest )
+
+{
+  unsigned int nThreads = std::thread::hardware_concurrency();
+
+  if (nThreads < 1)
+    nThreads = 1;
+  if (nThreads > dest->height / 16 + 1) // not worth a thread for fewer than 16 rows
+    nThreads = dest->height / 16 + 1;
+
+  void (*filterRows)( Image *, Image *, unsigned int, unsigned int ) = (src->hasAlpha ? boxFilterRows<4> : boxFilterRows<3>);
+
+  std::vector<std::thread> threads;
+
+  unsigned int rowsPerThread = (dest->height + nThreads-1) / nThreads;
+
+  for (unsigned int i=1; i<nThreads; i++) {
+    unsigned int yStart = i * rowsPerThread;
+    unsigned int yEnd   = (yStart + rowsPerThread < dest->height ? yStart + rowsPerThread : dest->height);
+    if (yStart < yEnd)
+      threads.push_back( std::thread( filterRows, src, dest, yStart, yEnd ) );
+  }
+
+  filterRows( src, dest, 0, (rowsPerThread < dest->height ? rowsPerThread : dest->height) );
+
+  for (unsigned int i=0; i<threads.size(); i++)
+    threads[i].join();
+}
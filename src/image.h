@@ -0,0 +1,228 @@
+// image.h
+//
+// An image in main memory, with no connection to OpenGL.  This is
+// the pixel storage used by the image core (projection, intensity
+// transforms, and equalization).  Texture adds the OpenGL side.
+
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "coreHeaders.h"
+#include "seq.h"
+
+#include <string>
+
+
+class Pixel {
+ public:
+
+  unsigned char r, g, b, a;
+
+  Pixel() {}
+
+  Pixel( unsigned char rr, unsigned char gg, unsigned char bb, unsigned char aa ) {
+    r = rr; g = gg; b = bb; a = aa;
+  }
+
+  Pixel( unsigned char rr, unsigned char gg, unsigned char bb ) {
+    r = rr; g = gg; b = bb; a = 255;
+  }
+};
+
+
+// The pixel at 'p' in an image with CHANNELS bytes per pixel: 4 for
+// RGBA, or 3 for RGB, which reads as opaque and drops alpha when
+// written.  Kernels that read an image are templated on CHANNELS, so
+// the RGB and RGBA versions are each compiled with fixed strides.
+//
+// An RGB texmap has RGB_PADDING spare bytes at the end, so an RGB
+// pixel is read with one 4-byte load, like an RGBA pixel.
+
+#define RGB_PADDING 1
+
+template <int CHANNELS> inline Pixel readPixel( const unsigned char *p ) {
+  unsigned int v;
+  memcpy( &v, p, 4 );
+  if (CHANNELS == 3) {
+    const Pixel opaque( 0, 0, 0, 255 );
+    unsigned int alphaBits;
+    memcpy( &alphaBits, &opaque, 4 );
+    v |= alphaBits; // setting the alpha byte in a word is much faster than storing it in 'q'
+  }
+  Pixel q;
+  memcpy( (void *) &q, &v, 4 );
+  return q;
+}
+
+template <int CHANNELS> inline void writePixel( unsigned char *p, Pixel q ) {
+  memcpy( p, &q, CHANNELS );
+}
+
+
+// A rectangle of pixels, [x0,x1) x [y0,y1)
+
+struct PixelRect {
+
+  int x0, y0, x1, y1;
+
+  PixelRect() {}
+
+  PixelRect( int xx0, int yy0, int xx1, int yy1 ) {
+    x0 = xx0; y0 = yy0; x1 = xx1; y1 = yy1;
+  }
+
+  bool empty() {
+    return x1 <= x0 || y1 <= y0;
+  }
+
+  unsigned int area() {
+    return empty() ? 0 : (x1-x0) * (y1-y0);
+  }
+};
+
+
+class Image {
+
+  void loadImage( string filename, int shrink = 1 );
+
+  // CPU mip map: mipMaps[i] is level i+1, half the size of level i.
+  // Levels are built when first asked for.
+
+  seq<Image *> mipMaps;
+
+  void buildMipMapLevel( Image *src, Image *dest );
+
+ public:
+
+  unsigned char *texmap;  // pixels, row by row from the top, 3 or 4 bytes each
+
+  string name;
+  unsigned int width, height;
+  bool hasAlpha;
+  bool updated; // true if the image was changed.  A Texture then re-sends it to the GPU.
+
+  // Pixels outside 'footprint' are known to be transparent.
+  // project() uses this to clear only what its previous result
+  // covered.  Anything else that writes 'texmap' must reset the
+  // footprint to the whole image.
+
+  PixelRect footprint;
+
+  // If 'mapping' is not NULL, 'texmap' is in a raw cache file that is
+  // mapped into memory (see rawCache.h), and is unmapped rather than
+  // deleted.
+
+  void  *mapping;
+  size_t mappingSize;
+
+  static bool useMipMaps; // if true, the editor samples from the CPU mip map when shrinking an image
+  static bool useRawCache; // if true, images from files are mapped from a raw cache beside the file, which is written on first load
+
+  Image() {
+    texmap = NULL;
+    mapping = NULL;
+    updated = false;
+  }
+
+  // image from file (0 x 0 if the file could not be read)
+
+  Image( string filename ) {
+
+    name = filename;
+    loadImage( filename ); // sets 'texmap'
+    footprint = PixelRect( 0, 0, width, height );
+    updated = false;
+  }
+
+  // image from file, reduced by 'shrink' (1, 2, 4 or 8) in each
+  // dimension for a quick preview.  A JPEG is decoded at the reduced size;
+  // another format is read in full and then box-averaged.
+
+  Image( string filename, int shrink ) {
+
+    name = filename;
+    loadImage( filename, shrink ); // sets 'texmap'
+    footprint = PixelRect( 0, 0, width, height );
+    updated = false;
+  }
+
+  // empty image, RGBA or (if 'withAlpha' is false) RGB
+
+  Image( unsigned int imageWidth, unsigned int imageHeight, bool withAlpha = true ) {
+
+    name = "image";
+    width = imageWidth;
+    height = imageHeight;
+    hasAlpha = withAlpha;
+    mapping = NULL;
+    createEmptyImage(); // sets 'texmap'
+    footprint = PixelRect( 0, 0, width, height );
+    updated = false;
+  }
+
+  // copy constructor
+
+  Image( Image &t ) {
+
+    width    = t.width;
+    height   = t.height;
+    hasAlpha = t.hasAlpha;
+    name     = t.name;
+    mapping  = NULL;
+
+    texmap = new unsigned char[ width * height * (hasAlpha ? 4 : 3) + (hasAlpha ? 0 : RGB_PADDING) ];
+    memcpy( texmap, t.texmap, width * height * (hasAlpha ? 4 : 3) );
+
+    footprint = PixelRect( 0, 0, width, height );
+
+    updated = false;
+  }
+
+  // destructor
+
+  virtual ~Image() {
+
+    freeMipMaps();
+    freeTexmap();
+  }
+
+  bool saveImage( string filename );
+
+  void createEmptyImage();
+  void copyImageFrom( Image *src );
+
+  // Give an RGB image an opaque alpha channel
+
+  void addAlpha();
+
+  // Take over the pixels of 'src', which are left in a mapped raw
+  // cache if they are in one, leaving 'src' without pixels
+
+  void takeTexmap( Image *src );
+
+  // Become an RGBA copy of 'src', with pixels that can be deleted or
+  // swapped with other buffers
+
+  void copyAsRGBA( Image *src );
+
+  void freeTexmap();
+
+  // Row 'y' of an image with CHANNELS bytes per pixel
+
+  template <int CHANNELS> unsigned char *row( int y ) {
+    return texmap + (size_t) y * width * CHANNELS;
+  }
+
+  Pixel & pixel( int i, int j ); // RGBA images only
+
+  // Mip map levels.  Level 0 is this image.  freeMipMaps() must be
+  // called whenever 'texmap' is changed, so that the levels are rebuilt.
+
+  int numMipMapLevels();
+  Image *mipMap( int level );
+  void freeMipMaps();
+};
+
+
+#endif
@@ -0,0 +1,177 @@
+// imageFormats.cpp
+
+
+#include "imageFormats.h"
+#include "lodepng.h"
+#include "pngReader.h"
+#include "qoi.h"
+#include "pnm.h"
+#include "jpegReader.h"
+
+#include <cctype>
+#include <vector>
+
+
+const char *imageFormatNames[ NUM_IMAGE_FORMATS ] = { "png", "qoi", "pam", "ppm", "jpg" };
+
+
+// Other extensions of the formats
+
+static struct { const char *extension; ImageFormat format; } otherExtensions[] = {
+  { "pnm",  PPM_FORMAT },
+  { "jpeg", JPEG_FORMAT },
+  { "jpe",  JPEG_FORMAT },
+};
+
+
+
+ImageFormat imageFormatNamed( string name )
+
+{
+  for (int i=0; i<NUM_IMAGE_FORMATS; i++)
+    if (name == imageFormatNames[i])
+      return (ImageFormat) i;
+
+  return UNKNOWN_FORMAT;
+}
+
+
+
+ImageFormat imageFormatOfName( string filename )
+
+{
+  size_t dot   = filename.rfind( '.' );
+  size_t slash = filename.find_last_of( "/\\" );
+
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    return UNKNOWN_FORMAT;
+
+  string extension = filename.substr( dot+1 );
+
+  for (size_t i=0; i<extension.size(); i++)
+    extension[i] = tolower( extension[i] );
+
+  ImageFormat format = imageFormatNamed( extension );
+
+  if (format != UNKNOWN_FORMAT)
+    return format;
+
+  for (size_t i=0; i<sizeof(otherExtensions)/sizeof(otherExtensions[0]); i++)
+    if (extension == otherExtensions[i].extension)
+      return otherExtensions[i].format;
+
+  return UNKNOWN_FORMAT;
+}
+
+
+
+bool canWriteImageFormat( ImageFormat format )
+
+{
+  return format != JPEG_FORMAT && format != UNKNOWN_FORMAT;
+}
+
+
+
+ImageFormat outputFormatOfName( string filename )
+
+{
+  ImageFormat format = imageFormatOfName( filename );
+
+  return (canWriteImageFormat( format ) ? format : PNG_FORMAT);
+}
+
+
+
+ImageFormat imageFormatOfBytes( const unsigned char *bytes, size_t n )
+
+{
+  if (n >= 8 && memcmp( bytes, "\x89PNG\r\n\x1a\n", 8 ) == 0)
+    return PNG_FORMAT;
+
+  if (n >= 4 && memcmp( bytes, "qoif", 4 ) == 0)
+    return QOI_FORMAT;
+
+  if (n >= 3 && bytes[0] == 'P' && bytes[1] == '7' && bytes[2] == '\n')
+    return PAM_FORMAT;
+
+  if (n >= 3 && bytes[0] == 'P' && (bytes[1] == '5' || bytes[1] == '6') && isspace( bytes[2] ))
+    return PPM_FORMAT;
+
+  if (n >= 3 && bytes[0] == 0xff && bytes[1] == 0xd8 && bytes[2] == 0xff) // SOI, then any marker
+    return JPEG_FORMAT;
+
+  return UNKNOWN_FORMAT;
+}
+
+
+
+const char *readImage( string filename, unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha,
+		       ImageFormat &format, int &shrink )
+
+{
+  // Find the format
+
+  FILE *f = fopen( filename.c_str(), "rb" );
+
+  if (f == NULL)
+    return "cannot open the file";
+
+  unsigned char magic[8];
+  size_t n = fread( magic, 1, sizeof(magic), f );
+
+  fclose( f );
+
+  format = imageFormatOfBytes( magic, n );
+
+  if (format != JPEG_FORMAT)
+    shrink = 1;
+
+  // PAM and PPM are read straight from the file into the pixels
+
+  switch (format) {
+  case PAM_FORMAT:
+  case PPM_FORMAT:
+    return readPNM( filename, out, width, height, hasAlpha );
+  case UNKNOWN_FORMAT:
+    return "not a PNG, QOI, PAM, PPM or JPEG file";
+  default:
+    break;
+  }
+
+  // The others are decoded from the whole file in memory
+
+  std::vector<unsigned char> file;
+
+  unsigned error = lodepng::load_file( file, filename );
+
+  if (error)
+    return lodepng_error_text( error );
+
+  if (format == QOI_FORMAT)
+    return decodeQOI( out, width, height, hasAlpha, file.data(), file.size() );
+
+  if (format == JPEG_FORMAT)
+    return decodeJPEG( out, width, height, hasAlpha, file.data(), file.size(), shrink );
+
+  error = decodePNG( out, width, height, hasAlpha, file.data(), file.size() );
+
+  return (error ? lodepng_error_text( error ) : NULL);
+}
+
+
+
+bool writeImage( Image *image, string filename, int level, int numThreads )
+
+{
+  switch (outputFormatOfName( filename )) {
+  case QOI_FORMAT:
+    return writeQOI( image, filename );
+  case PAM_FORMAT:
+    return writePAM( image, filename );
+  case PPM_FORMAT:
+    return writePPM( image, filename );
+  default:
+    return writePNG( image, filename, level, numThreads );
+  }
+}
@@ -0,0 +1,83 @@
+// imageFormats.h
+//
+// Reading and writing images in any of the supported file formats.
+//
+// A file is read in the format given by its first bytes, whatever its
+// name.  A file is written in the format given by its extension, or
+// as a PNG if the extension is not that of a format that can be
+// written.
+//
+//   PNG  compresses best, but is slowest to write and to read.
+//
+//   QOI  is coded an order of magnitude faster than PNG, in files that
+//        are somewhat larger.  Best for intermediate files.
+//
+//   PAM  and PPM store the pixels uncompressed, so they are read and
+//        written straight to and from the texmap.  PPM drops alpha.
+//
+//   JPEG is only read (see jpegReader.h), and can be decoded shrunk
+//        by 2, 4 or 8 for much less than the work of the full image.
+
+
+#ifndef IMAGE_FORMATS_H
+#define IMAGE_FORMATS_H
+
+#include "coreHeaders.h"
+#include "image.h"
+#include "pngWriter.h"
+
+#include <string>
+
+
+typedef enum { PNG_FORMAT, QOI_FORMAT, PAM_FORMAT, PPM_FORMAT, JPEG_FORMAT, NUM_IMAGE_FORMATS, UNKNOWN_FORMAT = NUM_IMAGE_FORMATS } ImageFormat;
+
+extern const char *imageFormatNames[ NUM_IMAGE_FORMATS ]; // also the usual extensions
+
+
+// The format named 'name' (e.g. "qoi"), or UNKNOWN_FORMAT
+
+ImageFormat imageFormatNamed( string name );
+
+// The format given by the extension of 'filename', ignoring case, or
+// UNKNOWN_FORMAT
+
+ImageFormat imageFormatOfName( string filename );
+
+// Whether images can be written in 'format'
+
+bool canWriteImageFormat( ImageFormat format );
+
+// The format in which 'filename' would be written: as above, but PNG
+// if the extension is unknown or that of a format that cannot be
+// written
+
+ImageFormat outputFormatOfName( string filename );
+
+// The format given by the first 'n' bytes of a file, or UNKNOWN_FORMAT
+
+ImageFormat imageFormatOfBytes( const unsigned char *bytes, size_t n );
+
+
+// Read an image file, in the format given by its first bytes, which
+// is returned in 'format'.  As in decodePNG(), the pixels are put in
+// '*out', which is allocated with new[] for the caller to own and has
+// RGB_PADDING spare bytes after an RGB image.  They are RGBA if
+// 'hasAlpha' is set, and otherwise RGB.  Returns NULL on success, or a
+// description of the error.
+//
+// 'shrink' (1, 2, 4 or 8) asks for the image reduced by that much in
+// each dimension, rounding up.  Only JPEGs can be decoded shrunk;
+// other formats are read at full size and 'shrink' is set to 1.
+
+const char *readImage( string filename, unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha,
+		       ImageFormat &format, int &shrink );
+
+
+// Write 'image' in the format given by the extension of 'filename'.
+// 'level' and 'numThreads' are as for writePNG(), and only apply to
+// PNGs.  Returns false if the image could not be written.
+
+bool writeImage( Image *image, string filename, int level = PNG_DEFAULT_LEVEL, int numThreads = 0 );
+
+
+#endif
@@ -0,0 +1,897 @@
+// inflate.cpp
+//
+// See RFC 1950 (zlib) and RFC 1951 (deflate).
+
+
+#include "inflate.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifndef INFLATE_NO_SIMD
+  #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define INFLATE_SSE2
+    #include <emmintrin.h>
+  #endif
+#endif
+
+
+#define LITLEN_ROOT_BITS 11
+#define DIST_ROOT_BITS   8
+#define CL_ROOT_BITS     7      // the longest code length code, so there are no subtables
+
+// Room for the root table and a subtable of the largest possible size
+// for each symbol with a code longer than the root
+
+#define LITLEN_TABLE_SIZE ((1 << LITLEN_ROOT_BITS) + 288 * (1 << (15 - LITLEN_ROOT_BITS)))
+#define DIST_TABLE_SIZE   ((1 << DIST_ROOT_BITS)   +  32 * (1 << (15 - DIST_ROOT_BITS)))
+#define CL_TABLE_SIZE     (1 << CL_ROOT_BITS)
+
+#define MAX_MATCH   258
+#define COPY_SLACK  8           // a match copy can write this far past its end
+#define OUT_MARGIN  (MAX_MATCH + COPY_SLACK)
+
+#if OUT_MARGIN != INFLATE_MARGIN
+  #error INFLATE_MARGIN in inflate.h must match OUT_MARGIN
+#endif
+
+#define MAX_RATIO   1032        // deflate cannot expand more than this
+
+
+// Errors.  lodepng reports any of these as error 110.
+
+enum {
+  INFLATE_OK = 0,
+  BAD_ZLIB_HEADER = 1,
+  BAD_BLOCK_TYPE,
+  BAD_STORED_LENGTH,
+  BAD_CODE_LENGTHS,
+  BAD_CODE,
+  BAD_DISTANCE,
+  TRUNCATED,
+  BAD_CHECKSUM,
+  TOO_BIG,
+  NO_MEMORY
+};
+
+
+
+// ---------------- Tables ----------------
+
+
+// A table entry says how many bits the code takes and what it means:
+//
+//   LITERAL        the literal in 'value'
+//   LITERAL_PAIR   two literals, in the low and high bytes of 'value'
+//   BASE           a match length or distance: 'value' plus the next 'extra' bits
+//   END_OF_BLOCK
+//   SUBTABLE       look up the next 'extra' bits in the subtable at 'value'
+//   INVALID        a code that the stream should not contain
+
+enum { LITERAL, LITERAL_PAIR, BASE, END_OF_BLOCK, SUBTABLE, INVALID };
+
+#define ENTRY( bits, kind, extra, value ) ((bits) | ((kind) << 8) | ((extra) << 11) | ((unsigned int) (value) << 16))
+
+#define ENTRY_BITS( e )  ((e) & 0xff)
+#define ENTRY_KIND( e )  (((e) >> 8) & 7)
+#define ENTRY_EXTRA( e ) (((e) >> 11) & 0x1f)
+#define ENTRY_VALUE( e ) ((e) >> 16)
+
+
+static const unsigned short lengthBase[29]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+						35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char  lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+						3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+static const unsigned short distBase[30]  = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+					      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char  distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+					      7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static const unsigned char codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+
+typedef enum { LITLEN_TABLE, DIST_TABLE, CL_TABLE } TableType;
+
+
+static unsigned int symbolEntry( TableType type, int sym, int bits )
+
+{
+  switch (type) {
+
+  case LITLEN_TABLE:
+    if (sym < 256)
+      return ENTRY( bits, LITERAL, 0, sym );
+    else if (sym == 256)
+      return ENTRY( bits, END_OF_BLOCK, 0, 0 );
+    else if (sym < 286)
+      return ENTRY( bits, BASE, lengthExtra[sym-257], lengthBase[sym-257] );
+    else
+      return ENTRY( bits, INVALID, 0, 0 );
+
+  case DIST_TABLE:
+    if (sym < 30)
+      return ENTRY( bits, BASE, distExtra[sym], distBase[sym] );
+    else
+      return ENTRY( bits, INVALID, 0, 0 );
+
+  default:
+    return ENTRY( bits, LITERAL, 0, sym );
+  }
+}
+
+
+// Build the decoding table for symbols 0 to n-1 with code 'lengths'.
+// Returns false if the lengths are not those of a complete prefix
+// code.  As in lodepng, a code with fewer than two symbols may be
+// incomplete, and its unused codes are INVALID.
+
+static bool buildTable( const unsigned char *lengths, int n, int rootBits, unsigned int *table, int tableSize, TableType type )
+
+{
+  int count[16], nextCode[16];
+
+  for (int i=0; i<16; i++)
+    count[i] = 0;
+
+  for (int i=0; i<n; i++)
+    count[ lengths[i] ]++;
+
+  count[0] = 0;
+
+  int left = 1, numCodes = 0;
+  for (int len=1; len<16; len++) {
+    left = (left << 1) - count[len];
+    if (left < 0)
+      return false;             // over-subscribed
+    numCodes += count[len];
+  }
+
+  if (left > 0 && numCodes >= 2)
+    return false;               // incomplete
+
+  int code = 0;
+  for (int len=1; len<16; len++) {
+    code = (code + count[len-1]) << 1;
+    nextCode[len] = code;
+  }
+
+  // Canonical codes, bit-reversed because they are read from the
+  // least significant bit
+
+  unsigned short reversed[288];
+
+  for (int s=0; s<n; s++) {
+
+    int len = lengths[s];
+
+    if (len == 0)
+      continue;
+
+    int c = nextCode[len]++;
+    int r = 0;
+
+    for (int k=0; k<len; k++) {
+      r = (r << 1) | (c & 1);
+      c >>= 1;
+    }
+
+    reversed[s] = r;
+  }
+
+  int rootSize = 1 << rootBits;
+
+  for (int i=0; i<rootSize; i++)
+    table[i] = ENTRY( 0, INVALID, 0, 0 );
+
+  // A subtable for each root prefix of longer codes, sized for the
+  // longest code with that prefix
+
+  unsigned char longest[ 1 << LITLEN_ROOT_BITS ];
+
+  memset( longest, 0, sizeof(longest) );
+
+  for (int s=0; s<n; s++)
+    if (lengths[s] > rootBits) {
+      int p = reversed[s] & (rootSize-1);
+      if (lengths[s] > longest[p])
+	longest[p] = lengths[s];
+    }
+
+  int used = rootSize;
+
+  for (int p=0; p<rootSize; p++)
+    if (longest[p] > 0) {
+
+      int subBits = longest[p] - rootBits;
+
+      if (used + (1 << subBits) > tableSize)
+	return false;
+
+      table[p] = ENTRY( rootBits, SUBTABLE, subBits, used );
+
+      for (int i=0; i<(1 << subBits); i++)
+	table[used+i] = ENTRY( 0, INVALID, 0, 0 );
+
+      used += 1 << subBits;
+    }
+
+  // Fill in the symbols, repeating each entry for every value of the
+  // bits that follow its code
+
+  for (int s=0; s<n; s++) {
+
+    int len = lengths[s];
+
+    if (len == 0)
+      continue;
+
+    if (len <= rootBits) {
+
+      unsigned int e = symbolEntry( type, s, len );
+
+      for (int j=reversed[s]; j<rootSize; j += 1 << len)
+	table[j] = e;
+
+    } else {
+
+      unsigned int sub = table[ reversed[s] & (rootSize-1) ];
+
+      unsigned int *subTable = table + ENTRY_VALUE( sub );
+      int subSize = 1 << ENTRY_EXTRA( sub );
+
+      unsigned int e = symbolEntry( type, s, len - rootBits );
+
+      for (int j=reversed[s] >> rootBits; j<subSize; j += 1 << (len - rootBits))
+	subTable[j] = e;
+    }
+  }
+
+  // Where a literal's code leaves room in the root bits for the code
+  // of another literal, decode both at once.  Entry i >> b holds
+  // whatever follows a b-bit code at i, and is valid if its own code
+  // fits in the remaining bits.  Going down, i >> b is not yet
+  // changed.
+
+  if (type == LITLEN_TABLE)
+    for (int i=rootSize-1; i>=0; i--) {
+
+      unsigned int e = table[i];
+
+      if (ENTRY_KIND( e ) != LITERAL)
+	continue;
+
+      int b = ENTRY_BITS( e );
+
+      unsigned int next = table[ i >> b ];
+
+      int bits = b + ENTRY_BITS( next );
+
+      if (ENTRY_KIND( next ) == LITERAL && bits <= rootBits)
+	table[i] = ENTRY( bits, LITERAL_PAIR, 0, ENTRY_VALUE( e ) | (ENTRY_VALUE( next ) << 8) );
+    }
+
+  return true;
+}
+
+
+
+// Tables for the fixed codes of block type 1
+
+static unsigned int fixedLitLenTable[ LITLEN_TABLE_SIZE ];
+static unsigned int fixedDistTable[ DIST_TABLE_SIZE ];
+
+static bool buildFixedTables()
+
+{
+  unsigned char lengths[288];
+
+  for (int i=0; i<288; i++)
+    lengths[i] = (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+
+  buildTable( lengths, 288, LITLEN_ROOT_BITS, fixedLitLenTable, LITLEN_TABLE_SIZE, LITLEN_TABLE );
+
+  for (int i=0; i<32; i++)
+    lengths[i] = 5;
+
+  buildTable( lengths, 32, DIST_ROOT_BITS, fixedDistTable, DIST_TABLE_SIZE, DIST_TABLE );
+
+  return true;
+}
+
+static bool fixedTablesBuilt = buildFixedTables();
+
+
+
+// ---------------- Inflate ----------------
+
+
+// Tables for one block with dynamic codes
+
+struct DynamicTables {
+  unsigned int litLen[ LITLEN_TABLE_SIZE ];
+  unsigned int dist[ DIST_TABLE_SIZE ];
+  unsigned int codeLength[ CL_TABLE_SIZE ];
+};
+
+
+// Output buffer, kept at least OUT_MARGIN bytes larger than what has
+// been written so that a symbol can be decoded without a check
+
+struct OutBuffer {
+  unsigned char *data;
+  size_t pos, capacity;
+  size_t maxSize;               // 0 for no limit
+  bool fixed;                   // the caller's buffer, which cannot grow
+};
+
+
+static unsigned grow( OutBuffer &out, size_t needed )
+
+{
+  if (out.fixed || (out.maxSize > 0 && out.pos > out.maxSize))
+    return TOO_BIG;
+
+  size_t capacity = out.capacity * 2;
+  if (capacity < needed)
+    capacity = needed;
+
+  unsigned char *data = (unsigned char *) realloc( out.data, capacity );
+
+  if (data == NULL)
+    return NO_MEMORY;
+
+  out.data = data;
+  out.capacity = capacity;
+
+  return INFLATE_OK;
+}
+
+
+
+// The bit reader.  The refill loads 8 bytes at once and keeps between
+// 56 and 63 bits in the buffer.  (This assumes a little-endian
+// machine.)  Near the end of the input it reads a byte at a time, and
+// past the end it reads zeros, counted in 'overrun'.  A valid stream
+// never uses those, so too many of them means it was truncated.
+
+#define REFILL()								\
+  if (inEnd - ip >= 8) {							\
+    unsigned long long word;							\
+    memcpy( &word, ip, 8 );							\
+    bitBuffer |= word << bitCount;						\
+    ip += (63 - bitCount) >> 3;							\
+    bitCount |= 56;								\
+  } else {									\
+    while (bitCount <= 56) {							\
+      if (ip < inEnd)								\
+	bitBuffer |= (unsigned long long) *ip++ << bitCount;			\
+      else if (++overrun > 16)							\
+	return TRUNCATED;							\
+      bitCount += 8;								\
+    }										\
+  }
+
+#define PEEK( n )    ((unsigned int) bitBuffer & ((1u << (n)) - 1))
+#define CONSUME( n ) { bitBuffer >>= (n); bitCount -= (n); }
+
+
+// Look up the entry for the next code in 'table' and consume its bits
+
+#define DECODE( e, table, rootBits )						\
+  e = table[ PEEK( rootBits ) ];						\
+  if (ENTRY_KIND( e ) == SUBTABLE) {						\
+    CONSUME( rootBits );							\
+    e = table[ ENTRY_VALUE( e ) + PEEK( ENTRY_EXTRA( e ) ) ];			\
+  }										\
+  CONSUME( ENTRY_BITS( e ) );
+
+
+
+// Inflate the deflate stream in [in,inEnd) into 'out', and return in
+// 'inUsed' the number of bytes that it took.  'dynamic' is space for
+// the tables of blocks with dynamic codes.
+
+static unsigned inflateStream( const unsigned char *in, const unsigned char *inEnd, size_t &inUsed,
+			       OutBuffer &out, DynamicTables *dynamic, const LodePNGDecompressSettings *settings )
+
+{
+  const unsigned char *ip = in;
+
+  unsigned long long bitBuffer = 0;
+  unsigned int bitCount = 0;
+  unsigned int overrun = 0;
+
+  size_t outStart = out.pos;    // matches cannot reach before this
+
+  unsigned result = INFLATE_OK;
+
+  bool final = false;
+
+  while (!final) {
+
+    REFILL();
+
+    final = PEEK( 1 );
+    int type = (bitBuffer >> 1) & 3;
+    CONSUME( 3 );
+
+    if (type == 0) {
+
+      // Stored block: go to a byte boundary and give back the whole
+      // bytes left in the bit buffer
+
+      CONSUME( bitCount & 7 );
+
+      unsigned int unread = bitCount >> 3;
+
+      if (overrun >= unread)
+	overrun -= unread;
+      else {
+	ip -= unread - overrun;
+	overrun = 0;
+      }
+
+      bitBuffer = 0;
+      bitCount = 0;
+
+      if (overrun > 0 || inEnd - ip < 4) {
+	result = TRUNCATED;
+	break;
+      }
+
+      unsigned int len  = ip[0] | (ip[1] << 8);
+      unsigned int nlen = ip[2] | (ip[3] << 8);
+      ip += 4;
+
+      if (len + nlen != 0xffff && !settings->ignore_nlen) {
+	result = BAD_STORED_LENGTH;
+	break;
+      }
+
+      if ((size_t) (inEnd - ip) < len) {
+	result = TRUNCATED;
+	break;
+      }
+
+      if (out.capacity - out.pos < len + OUT_MARGIN && (result = grow( out, out.pos + len + OUT_MARGIN )) != INFLATE_OK)
+	break;
+
+      memcpy( out.data + out.pos, ip, len );
+      out.pos += len;
+      ip += len;
+
+      continue;
+    }
+
+    const unsigned int *litLenTable, *distTable;
+
+    if (type == 1) {
+
+      litLenTable = fixedLitLenTable;
+      distTable = fixedDistTable;
+
+    } else if (type == 2) {
+
+      // Dynamic codes: read the code length code, then the code
+      // lengths, and build the tables
+
+      REFILL();
+
+      int numLit  = PEEK( 5 ) + 257;  CONSUME( 5 );
+      int numDist = PEEK( 5 ) + 1;    CONSUME( 5 );
+      int numCL   = PEEK( 4 ) + 4;    CONSUME( 4 );
+
+      if (numLit > 286 || numDist > 30) {
+	result = BAD_CODE_LENGTHS;
+	break;
+      }
+
+      unsigned char clLengths[19];
+
+      memset( clLengths, 0, sizeof(clLengths) );
+
+      for (int i=0; i<numCL; i++) {
+	if (bitCount < 3) {
+	  REFILL();
+	}
+	clLengths[ codeLengthOrder[i] ] = PEEK( 3 );
+	CONSUME( 3 );
+      }
+
+      if (!buildTable( clLengths, 19, CL_ROOT_BITS, dynamic->codeLength, CL_TABLE_SIZE, CL_TABLE )) {
+	result = BAD_CODE_LENGTHS;
+	break;
+      }
+
+      unsigned char lengths[ 286 + 30 ];
+
+      int n = 0;
+
+      while (n < numLit + numDist) {
+
+	REFILL();
+
+	unsigned int e = dynamic->codeLength[ PEEK( CL_ROOT_BITS ) ];
+
+	if (ENTRY_KIND( e ) == INVALID) {
+	  result = BAD_CODE;
+	  break;
+	}
+
+	CONSUME( ENTRY_BITS( e ) );
+
+	int sym = ENTRY_VALUE( e );
+
+	if (sym < 16) {
+	  lengths[n++] = sym;
+	  continue;
+	}
+
+	int value, repeat;
+
+	if (sym == 16) {
+	  if (n == 0) {
+	    result = BAD_CODE_LENGTHS;
+	    break;
+	  }
+	  value = lengths[n-1];
+	  repeat = 3 + PEEK( 2 );
+	  CONSUME( 2 );
+	} else if (sym == 17) {
+	  value = 0;
+	  repeat = 3 + PEEK( 3 );
+	  CONSUME( 3 );
+	} else {
+	  value = 0;
+	  repeat = 11 + PEEK( 7 );
+	  CONSUME( 7 );
+	}
+
+	if (n + repeat > numLit + numDist) {
+	  result = BAD_CODE_LENGTHS;
+	  break;
+	}
+
+	memset( lengths + n, value, repeat );
+	n += repeat;
+      }
+
+      if (result != INFLATE_OK)
+	break;
+
+      if (lengths[256] == 0 ||
+	  !buildTable( lengths, numLit, LITLEN_ROOT_BITS, dynamic->litLen, LITLEN_TABLE_SIZE, LITLEN_TABLE ) ||
+	  !buildTable( lengths + numLit, numDist, DIST_ROOT_BITS, dynamic->dist, DIST_TABLE_SIZE, DIST_TABLE )) {
+	result = BAD_CODE_LENGTHS;
+	break;
+      }
+
+      litLenTable = dynamic->litLen;
+      distTable = dynamic->dist;
+
+    } else {
+      result = BAD_BLOCK_TYPE;
+      break;
+    }
+
+    // Decode the symbols.  After a refill there are at least 56 bits,
+    // enough for a length code (15), its extra bits (5), a distance
+    // code (15), and its extra bits (13).
+    //
+    // The output position is kept in locals, as the compiler must
+    // otherwise reload it after every byte written.
+
+    unsigned char *data = out.data;
+    size_t pos   = out.pos;
+    size_t limit = out.capacity - OUT_MARGIN;
+
+    while (true) {
+
+      if (pos > limit) {
+	out.pos = pos;
+	if ((result = grow( out, pos + OUT_MARGIN )) != INFLATE_OK)
+	  break;
+	data  = out.data;
+	limit = out.capacity - OUT_MARGIN;
+      }
+
+      REFILL();
+
+      unsigned int e;
+
+      DECODE( e, litLenTable, LITLEN_ROOT_BITS );
+
+      unsigned int kind = ENTRY_KIND( e );
+
+      if (kind == LITERAL) {
+	data[pos++] = ENTRY_VALUE( e );
+	continue;
+      }
+
+      if (kind == LITERAL_PAIR) {
+	data[pos]   = ENTRY_VALUE( e );
+	data[pos+1] = ENTRY_VALUE( e ) >> 8;
+	pos += 2;
+	continue;
+      }
+
+      if (kind == END_OF_BLOCK)
+	break;
+
+      if (kind != BASE) {
+	result = BAD_CODE;
+	break;
+      }
+
+      unsigned int len = ENTRY_VALUE( e ) + PEEK( ENTRY_EXTRA( e ) );
+      CONSUME( ENTRY_EXTRA( e ) );
+
+      DECODE( e, distTable, DIST_ROOT_BITS );
+
+      if (ENTRY_KIND( e ) != BASE) {
+	result = BAD_CODE;
+	break;
+      }
+
+      unsigned int dist = ENTRY_VALUE( e ) + PEEK( ENTRY_EXTRA( e ) );
+      CONSUME( ENTRY_EXTRA( e ) );
+
+      if (dist > pos - outStart) {
+	result = BAD_DISTANCE;
+	break;
+      }
+
+      // Copy the match.  If it is at least 8 bytes back, 8-byte
+      // copies never read what they write, and the slack at the end
+      // of the buffer takes their overshoot.
+
+      unsigned char *dest = data + pos;
+      const unsigned char *src = dest - dist;
+
+      if (dist >= 8) {
+	unsigned char *end = dest + len;
+	do {
+	  memcpy( dest, src, 8 );
+	  dest += 8;
+	  src  += 8;
+	} while (dest < end);
+      } else if (dist == 1)
+	memset( dest, src[0], len );
+      else
+	for (unsigned int i=0; i<len; i++)
+	  dest[i] = src[i];
+
+      pos += len;
+    }
+
+    out.pos = pos;
+
+    if (result != INFLATE_OK)
+      break;
+  }
+
+  if (result != INFLATE_OK)
+    return result;
+
+  // Give back the whole bytes left in the bit buffer
+
+  unsigned int unread = bitCount >> 3;
+
+  if (overrun > unread)
+    return TRUNCATED;
+
+  inUsed = (ip - in) - (unread - overrun);
+
+  return INFLATE_OK;
+}
+
+
+
+static unsigned checkHeader( const unsigned char *in, size_t inSize )
+
+{
+  if (inSize < 2)
+    return BAD_ZLIB_HEADER;
+
+  int cmf = in[0], flg = in[1];
+
+  if ((cmf * 256 + flg) % 31 != 0 || (cmf & 15) != 8 || (cmf >> 4) > 7 || (flg & 0x20))
+    return BAD_ZLIB_HEADER;     // bad check, not deflate, window too large, or a preset dictionary
+
+  return INFLATE_OK;
+}
+
+
+// Inflate the zlib stream after its header, appending to 'buffer', and
+// check the Adler-32
+
+static unsigned inflateBody( OutBuffer &buffer, const unsigned char *in, size_t inSize,
+			     const LodePNGDecompressSettings *settings )
+
+{
+  size_t start = buffer.pos;
+  size_t used = 0;
+
+  DynamicTables *dynamic = new DynamicTables;
+
+  unsigned result = inflateStream( in+2, in+inSize, used, buffer, dynamic, settings );
+
+  delete dynamic;
+
+  if (result != INFLATE_OK)
+    return result;
+
+  if (buffer.maxSize > 0 && buffer.pos > buffer.maxSize)
+    return TOO_BIG;
+
+  // The checksum is the last 4 bytes of the input, as lodepng takes it
+
+  if (!settings->ignore_adler32) {
+
+    if (inSize - 2 - used < 4)
+      return TRUNCATED;
+
+    const unsigned char *p = in + inSize - 4;
+
+    unsigned int expectedAdler = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+
+    if (adler32( buffer.data + start, buffer.pos - start ) != expectedAdler)
+      return BAD_CHECKSUM;
+  }
+
+  return INFLATE_OK;
+}
+
+
+unsigned inflateZlib( unsigned char **out, size_t *outSize,
+		      const unsigned char *in, size_t inSize,
+		      const LodePNGDecompressSettings *settings )
+
+{
+  unsigned result = checkHeader( in, inSize );
+
+  if (result != INFLATE_OK)
+    return result;
+
+  // Allocate the expected size at once, but no more than the input
+  // could expand to
+
+  size_t expected = 0;
+
+  if (settings->custom_context != NULL)
+    expected = ((const InflateContext *) settings->custom_context)->expectedSize;
+
+  if (expected == 0 || expected > inSize * MAX_RATIO)
+    expected = inSize * 4;
+
+  OutBuffer buffer;
+
+  buffer.pos      = *outSize;
+  buffer.capacity = *outSize + expected + OUT_MARGIN;
+  buffer.maxSize  = settings->max_output_size;
+  buffer.fixed    = false;
+  buffer.data     = (unsigned char *) realloc( *out, buffer.capacity );
+
+  if (buffer.data == NULL)
+    return NO_MEMORY;
+
+  result = inflateBody( buffer, in, inSize, settings );
+
+  *out = buffer.data;
+  *outSize = buffer.pos;
+
+  return result;
+}
+
+
+unsigned inflateZlibInto( unsigned char *out, size_t outCapacity, size_t *outSize,
+			  const unsigned char *in, size_t inSize )
+
+{
+  *outSize = 0;
+
+  unsigned result = checkHeader( in, inSize );
+
+  if (result != INFLATE_OK)
+    return result;
+
+  if (outCapacity < OUT_MARGIN)
+    return TOO_BIG;
+
+  LodePNGDecompressSettings settings;
+  lodepng_decompress_settings_init( &settings );
+
+  OutBuffer buffer;
+
+  buffer.data     = out;
+  buffer.pos      = 0;
+  buffer.capacity = outCapacity;
+  buffer.maxSize  = 0;
+  buffer.fixed    = true;
+
+  result = inflateBody( buffer, in, inSize, &settings );
+
+  *outSize = buffer.pos;
+
+  return result;
+}
+
+
+
+// ---------------- Adler-32 ----------------
+
+
+#define ADLER_BASE 65521
+#define ADLER_NMAX 5552  // most bytes that can be summed before the sums must be reduced
+
+
+unsigned int adler32( const unsigned char *buf, size_t len, unsigned int adler )
+
+{
+  unsigned int s1 = adler & 0xffff;
+  unsigned int s2 = adler >> 16;
+
+#ifdef INFLATE_SSE2
+
+  // Over a block of 16-byte chunks, s2 gains s1 for every byte, 16
+  // times the bytes of each earlier chunk, and each byte of a chunk
+  // weighted by 16 down to 1 for its position.
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weightsLo = _mm_setr_epi16( 16, 15, 14, 13, 12, 11, 10, 9 );
+  const __m128i weightsHi = _mm_setr_epi16( 8, 7, 6, 5, 4, 3, 2, 1 );
+
+  while (len >= 16) {
+
+    size_t n = (len < ADLER_NMAX ? len : ADLER_NMAX) & ~(size_t) 15;
+
+    __m128i sum      = zero;    // bytes so far in the block
+    __m128i earlier  = zero;    // 'sum' before each chunk, summed
+    __m128i weighted = zero;
+
+    for (size_t i=0; i<n; i+=16) {
+
+      __m128i d = _mm_loadu_si128( (const __m128i *) (buf + i) );
+
+      earlier  = _mm_add_epi32( earlier, sum );
+      sum      = _mm_add_epi32( sum, _mm_sad_epu8( d, zero ) );
+      weighted = _mm_add_epi32( weighted, _mm_madd_epi16( _mm_unpacklo_epi8( d, zero ), weightsLo ) );
+      weighted = _mm_add_epi32( weighted, _mm_madd_epi16( _mm_unpackhi_epi8( d, zero ), weightsHi ) );
+    }
+
+    unsigned int lanes[3][4];
+
+    _mm_storeu_si128( (__m128i *) lanes[0], sum );
+    _mm_storeu_si128( (__m128i *) lanes[1], earlier );
+    _mm_storeu_si128( (__m128i *) lanes[2], weighted );
+
+    unsigned long long blockSum      = lanes[0][0] + lanes[0][2];
+    unsigned long long blockEarlier  = (unsigned long long) lanes[1][0] + lanes[1][2];
+    unsigned long long blockWeighted = (unsigned long long) lanes[2][0] + lanes[2][1] + lanes[2][2] + lanes[2][3];
+
+    s2 = (unsigned int) ((s2 + (unsigned long long) s1 * n + 16 * blockEarlier + blockWeighted) % ADLER_BASE);
+    s1 = (unsigned int) ((s1 + blockSum) % ADLER_BASE);
+
+    buf += n;
+    len -= n;
+  }
+
+#endif
+
+  while (len > 0) {
+
+    size_t n = (len < ADLER_NMAX ? len : ADLER_NMAX);
+    len -= n;
+
+    while (n-- > 0) {
+      s1 += *buf++;
+      s2 += s1;
+    }
+
+    s1 %= ADLER_BASE;
+    s2 %= ADLER_BASE;
+  }
+
+  return (s2 << 16) | s1;
+}
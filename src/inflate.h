@@ -0,0 +1,76 @@
+// inflate.h
+//
+// zlib decompression for lodepng's custom_zlib hook.
+//
+// This is much faster than lodepng's own inflate:
+//
+//   - Bits are read 64 at a time, and the bit buffer is refilled once
+//     per symbol with a single unaligned load.
+//
+//   - The literal/length table is indexed by the next 11 bits.  An
+//     entry whose code is short enough also holds the following
+//     literal, so runs of literals are decoded two at a time.  Longer
+//     codes go through small second-level tables.
+//
+//   - Matches at least 8 bytes back are copied 8 bytes at a time.
+//
+//   - Adler-32 uses SSE2 where it is available.
+//
+// To use it:
+//
+//   InflateContext context;
+//   context.expectedSize = ...;  // or 0 if unknown
+//   state.decoder.zlibsettings.custom_zlib    = inflateZlib;
+//   state.decoder.zlibsettings.custom_context = &context;
+//
+// inflateZlibInto() decompresses into the caller's buffer instead,
+// so that the data can be worked on in place.
+//
+// Define INFLATE_NO_SIMD to use the portable Adler-32 instead.
+
+
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include "lodepng.h"
+
+#include <cstddef>
+
+
+// Scratch space at the end of the output buffer that the decoder may
+// write into: the longest match plus the 8 bytes that a match copy
+// can overrun
+
+#define INFLATE_MARGIN (258 + 8)
+
+
+// Optional context for inflateZlib(), passed in custom_context
+
+struct InflateContext {
+  size_t expectedSize;          // decompressed size, if known, so that the output is allocated once
+};
+
+
+// Decompress the zlib stream 'in', appending to '*out' (which is
+// allocated with malloc, as lodepng expects).  Returns 0 on success.
+
+unsigned inflateZlib( unsigned char **out, size_t *outSize,
+		      const unsigned char *in, size_t inSize,
+		      const LodePNGDecompressSettings *settings );
+
+
+// Decompress the zlib stream 'in' into 'out', which holds 'outCapacity'
+// bytes.  The last INFLATE_MARGIN of those are scratch space, so at
+// most outCapacity - INFLATE_MARGIN bytes come out.  Returns 0 on
+// success, with the decompressed size in '*outSize'.
+
+unsigned inflateZlibInto( unsigned char *out, size_t outCapacity, size_t *outSize,
+			  const unsigned char *in, size_t inSize );
+
+
+// Continue the Adler-32 checksum 'adler' (1 to start) over 'buf'
+
+unsigned int adler32( const unsigned char *buf, size_t len, unsigned int adler = 1 );
+
+
+#endif
@@ -0,0 +1,253 @@
+// intensity.cpp
+
+
+#include "intensity.h"
+
+
+
+// RGB to YUV conversion matrix and its inverse
+
+static mat3 makeRGBtoYUV()
+
+{
+  mat3 M;
+
+  M.rows[0] = {  0.299,    0.587,    0.114   };
+  M.rows[1] = { -0.14713, -0.28886,  0.436   };
+  M.rows[2] = {  0.615,   -0.51499, -0.10001 };
+
+  return M;
+}
+
+static mat3 RGBtoYUV = makeRGBtoYUV();
+static mat3 YUVtoRGB = RGBtoYUV.inverse();
+
+
+
+static unsigned char clamp255( float x )
+
+{
+  if (x < 0)
+    return 0;
+  else if (x > 255)
+    return 255;
+  else
+    return x;
+}
+
+
+
+// Convert RGB pixel in [0,255]x[0,255]x[0,255] into YUV pixel in same
+// ranges.  The Y channel [0,255] maps to [0,1], while the U and V
+// channels [0,255] maps to [-0.5,+0.5].
+
+Pixel rgb_to_yuv( Pixel rgbPixel )
+
+{
+  vec3 rgb( rgbPixel.r / 255.0, 
+	    rgbPixel.g / 255.0, 
+	    rgbPixel.b / 255.0 );
+
+  vec3 yuv = RGBtoYUV * rgb;
+
+  return Pixel( clamp255( rintf(yuv.x * 255) ), 
+		clamp255( rintf((yuv.y + 0.5) * 255) ), 
+		clamp255( rintf((yuv.z + 0.5) * 255) ), 
+		rgbPixel.a );
+}
+
+
+
+// Convert YUV pixel in [0,255]x[0,255]x[0,255] into RGB pixel in same
+// ranges.
+
+Pixel yuv_to_rgb( Pixel yuvPixel )
+
+{
+  vec3 yuv( yuvPixel.r / 255.0, 
+	    yuvPixel.g / 255.0 - 0.5, 
+	    yuvPixel.b / 255.0 - 0.5 );
+
+  vec3 rgb = YUVtoRGB * yuv;
+
+  return Pixel( clamp255( rint(rgb.x * 255) ), 
+		clamp255( rint(rgb.y * 255) ), 
+		clamp255( rint(rgb.z * 255) ),
+		yuvPixel.a );
+}
+
+
+
+// Given an RGB pixel, p, convert it to YUV, then apply the intensity
+// transform as
+//
+//   Y' = Y * M + B
+//
+// where M is the combination of the 'recentIntensityScale' and
+// 'accumulatedIntensityScale', and B is the combination of
+// 'recentIntensityBias' and 'accumulatedIntensityBias', as found in
+// Editor::currentProjectionParams().
+//
+// A pixel p has components p.r, p.g, p.b.  After conversion to YUV,
+// those components store p.r = Y, p.g = U, p.b = V.
+//
+// Notet that Y is in the range [0,255] and must be converted to [0,1]
+// before applying the transform.
+//
+// Ensure that Y' is not transformed outside the range [0,1].
+//
+// Convert Y' back from [0,1] to [0,255] before storing.
+
+
+Pixel applyIntensityTransform( Pixel rgb, float M, float B )
+
+{
+  // YOUR CODE HERE
+  // Convert to YUV (Y in [0,255], U,V encoded in [0,255] with +/-0.5 bias)
+  Pixel yuv = rgb_to_yuv(rgb);
+
+  // Map Y in [0,255] -> [0,1]
+  float Y  = (float)yuv.r / 255.0f;
+
+  // Apply transform and clamp to [0,1]
+  float Y_prime = Y * M + B;
+  if (Y_prime < 0.0f) Y_prime = 0.0f;
+  if (Y_prime > 1.0f) Y_prime = 1.0f;
+
+  // Store back into Y channel in [0,255]
+  yuv.r = clamp255( rintf( Y_prime * 255.0f ) );
+
+  // Convert back to RGB
+  Pixel out = yuv_to_rgb(yuv);
+  
+  // Note that both rgb_to_yuv and yuv_to_rgb preserve alpha
+  return out;
+}
+
+
+// Perform LOCAL histogram equalization on 'srcImage'.  Fill in
+// 'destImage' with the result.  Do the local histogram in a square
+// neighbourhood around each pixel.  If 'histoRadius' is R, the
+// neighbourhood is (2R+1) x (2R+1).
+//
+// Do not build the full histogram.  This code should be efficient.
+//
+// Both images have CHANNELS bytes per pixel.
+
+
+template <int CHANNELS> static void equalizeChannels( Image *srcImage, Image *destImage, int histoRadius )
+
+{
+  // YOUR CODE HERE
+
+  // For each pixel:
+  // Define a local neighborhood
+  // Build histogram of Y values in that neighborhood
+  // Calculate CDF (cumulative distribution function)
+  // Use CDF to transform the center pixel's Y value
+  // Preserve U and V (color) components
+  //
+  // Formula for histogram equalization:
+  // Y' = (CDF[Y] - CDF_min) / (totalPixels - CDF_min) * 255
+  //
+  // Where CDF_min is the minimum non-zero CDF value
+
+  // Process each pixel in the source image
+  for (int centerX = 0; centerX < srcImage->width; centerX++) {
+    for (int centerY = 0; centerY < srcImage->height; centerY++) {
+      
+      // Build histogram for local neighborhood
+      int histogram[256] = {0};  // Initialize all bins to 0
+      int totalPixels = 0;
+      
+      // Define neighborhood bounds
+      int minX = centerX - histoRadius;
+      int maxX = centerX + histoRadius;
+      int minY = centerY - histoRadius;
+      int maxY = centerY + histoRadius;
+      
+      // Clamp to image boundaries
+      if (minX < 0) minX = 0;
+      if (maxX >= (int)srcImage->width) maxX = srcImage->width - 1;
+      if (minY < 0) minY = 0;
+      if (maxY >= (int)srcImage->height) maxY = srcImage->height - 1;
+      
+      // Build histogram from neighborhood
+      for (int x = minX; x <= maxX; x++) {
+        for (int y = minY; y <= maxY; y++) {
+          // Get pixel and convert to YUV
+          Pixel rgb = readPixel<CHANNELS>( srcImage->row<CHANNELS>(y) + CHANNELS * x );
+          Pixel yuv = rgb_to_yuv(rgb);
+          
+          // Increment histogram bin for this Y value which is the first channel
+          histogram[yuv.r]++;
+          totalPixels++;
+        }
+      }
+      
+      // Calculate CDF from histogram
+      int cdf[256] = {0};
+      cdf[0] = histogram[0]; // Initialize first bin
+      for (int i = 1; i < 256; i++) {
+        cdf[i] = cdf[i-1] + histogram[i];
+      }
+      
+      // Find minimum non-zero CDF value
+      int cdf_min = 0;
+      for (int i = 0; i < 256; i++) {
+        if (cdf[i] > 0) {
+          cdf_min = cdf[i];
+          break;
+        }
+      }
+      
+      // Get center pixel and convert to YUV
+      Pixel centerRgb = readPixel<CHANNELS>( srcImage->row<CHANNELS>(centerY) + CHANNELS * centerX );
+      Pixel centerYuv = rgb_to_yuv(centerRgb);
+      
+      // Apply histogram equalization to Y component
+      // Formula: Y' = ((CDF[Y] - CDF_min) / (totalPixels - CDF_min)) * 255
+      int oldY = centerYuv.r;
+      unsigned char newY;
+      
+      if (totalPixels - cdf_min > 0) {
+        // Apply equalization formula
+        float normalized = (float)(cdf[oldY] - cdf_min) / (float)(totalPixels - cdf_min);
+        newY = (unsigned char)(normalized * 255.0);
+      } else {
+        // Edge case: all pixels in neighborhood have same value
+        newY = oldY;
+      }
+      
+      // Update Y component, keep U and V unchanged (preserves color)
+      centerYuv.r = newY;
+      
+      // Convert back to RGB and store in destination
+      Pixel resultRgb = yuv_to_rgb(centerYuv);
+      writePixel<CHANNELS>( destImage->row<CHANNELS>(centerY) + CHANNELS * centerX, resultRgb );
+    }
+  }
+  
+  // Mark destination as updated so it gets sent to GPU
+  destImage->updated = true;
+  destImage->footprint = PixelRect( 0, 0, destImage->width, destImage->height );
+
+
+  
+}
+
+
+void histogramEqualization( Image *srcImage, Image *destImage, int histoRadius )
+
+{
+  if (srcImage->hasAlpha != destImage->hasAlpha) {
+    cerr << "in histogramEqualization() the source and destination images have different channels" << endl;
+    exit(1);
+  }
+
+  if (srcImage->hasAlpha)
+    equalizeChannels<4>( srcImage, destImage, histoRadius );
+  else
+    equalizeChannels<3>( srcImage, destImage, histoRadius );
+}
+
@@ -0,0 +1,23 @@
+// intensity.h
+//
+// Intensity transforms of pixels: the linear transform of the Y
+// (luminance) channel, Y' = Y * M + B, and local histogram
+// equalization of Y.  Both leave the colour (U and V) unchanged.
+
+
+#ifndef INTENSITY_H
+#define INTENSITY_H
+
+#include "coreHeaders.h"
+#include "image.h"
+
+
+Pixel rgb_to_yuv( Pixel rgb );
+Pixel yuv_to_rgb( Pixel yuv );
+
+Pixel applyIntensityTransform( Pixel p, float M, float B );
+
+void histogramEqualization( Image *srcImage, Image *destImage, int histoRadius );
+
+
+#endif
@@ -0,0 +1,1840 @@
+// jpegReader.cpp
+//
+// See ITU-T T.81, annexes B (syntax), C (Huffman tables), F (sequential
+// decoding) and G (progressive decoding), and the IJG library's
+// jidctint.c (inverse DCT) and jdsample.c (upsampling).
+
+
+#include "jpegReader.h"
+#include "image.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifndef JPEG_NO_SIMD
+  #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define JPEG_USE_SSE2
+    #include <emmintrin.h>
+  #endif
+#endif
+
+
+const char *jpegKernelSetNames[] = { "scalar", "SSE2" };
+
+
+#define JPEG_MAX_PIXELS 400000000
+#define MAX_COMPONENTS  4
+#define BAND_ROWS       32      // rows converted to RGB in each task
+
+#define FAST_BITS 9             // Huffman codes of up to this many bits are decoded with one lookup
+
+
+// Position in the block (row by row) of the k-th coefficient in
+// zigzag order.  Corrupt data can take k past 63, so there are 16
+// extra entries.
+
+static const unsigned char zigzag[64+16] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+  63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63
+};
+
+
+// Run 'task(i)' for each i in [0,n), spread over 'numThreads' threads
+
+template<class Task> static void parallelFor( int n, int numThreads, Task task )
+
+{
+  std::atomic<int> next( 0 );
+
+  auto work = [&]() {
+    for (int i=next++; i<n; i=next++)
+      task( i );
+  };
+
+  if (numThreads > n)
+    numThreads = n;
+
+  std::vector<std::thread> threads;
+
+  for (int i=1; i<numThreads; i++)
+    threads.push_back( std::thread( work ) );
+
+  work();
+
+  for (unsigned int i=0; i<threads.size(); i++)
+    threads[i].join();
+}
+
+
+static inline short clamp16( int v )
+
+{
+  return (short) (v < -32768 ? -32768 : (v > 32767 ? 32767 : v));
+}
+
+
+static inline unsigned char clamp255( int v )
+
+{
+  return (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+
+
+// ---------------- Kernels ----------------
+
+
+// The inverse DCT, in 12-bit fixed point.  The columns are done first,
+// and kept to 16 bits with two extra bits of precision.  The rows then
+// remove those bits and the DCT's factor of 8, and add 128.
+
+#define FIX(x) ((int) ((x) * 4096 + ((x) < 0 ? -0.5 : 0.5)))
+
+#define C1 FIX(  0.541196100 )  // even part
+#define C2 FIX( -1.847759065 )
+#define C3 FIX(  0.765366865 )
+
+#define C5 FIX(  1.175875602 )  // odd part
+#define A0 FIX(  0.298631336 )
+#define A1 FIX(  2.053119869 )
+#define A2 FIX(  3.072711026 )
+#define A3 FIX(  1.501321110 )
+#define B1 FIX( -0.899976223 )
+#define B2 FIX( -2.562915447 )
+#define B3 FIX( -1.961570560 )
+#define B4 FIX( -0.390180644 )
+
+#define PASS1_SHIFT 10
+#define PASS1_BIAS  (1 << (PASS1_SHIFT-1))
+#define PASS2_SHIFT 17
+#define PASS2_BIAS  ((1 << (PASS2_SHIFT-1)) + (128 << PASS2_SHIFT))
+
+
+// The pixel value of a block with only a DC coefficient, as the full
+// transform gives it
+
+static inline unsigned char dcPixel( int dc )
+
+{
+  return clamp255( (clamp16( dc * 4 ) * 4096 + PASS2_BIAS) >> PASS2_SHIFT );
+}
+
+
+// One 8-point IDCT, before the final shift.  The IJG library's sums of
+// products are multiplied out so that each output is a sum of one
+// product per input, as the SIMD version computes it.
+
+static inline void idct1D( int s0, int s1, int s2, int s3, int s4, int s5, int s6, int s7, int bias, int out[8] )
+
+{
+  // Even part
+
+  int t2 = s2 * C1 + s6 * (C1 + C2);
+  int t3 = s2 * (C1 + C3) + s6 * C1;
+  int t0 = (s0 + s4) * 4096;
+  int t1 = (s0 - s4) * 4096;
+
+  int x0 = t0 + t3 + bias;
+  int x3 = t0 - t3 + bias;
+  int x1 = t1 + t2 + bias;
+  int x2 = t1 - t2 + bias;
+
+  // Odd part
+
+  int o3 = s1 * (A3 + B1 + B4 + C5) + s7 * (B1 + C5) + s3 * C5 + s5 * (B4 + C5);
+  int o2 = s1 * C5 + s7 * (B3 + C5) + s3 * (A2 + B2 + B3 + C5) + s5 * (B2 + C5);
+  int o1 = s1 * (B4 + C5) + s7 * C5 + s3 * (B2 + C5) + s5 * (A1 + B2 + B4 + C5);
+  int o0 = s1 * (B1 + C5) + s7 * (A0 + B1 + B3 + C5) + s3 * (B3 + C5) + s5 * C5;
+
+  out[0] = x0 + o3;
+  out[7] = x0 - o3;
+  out[1] = x1 + o2;
+  out[6] = x1 - o2;
+  out[2] = x2 + o1;
+  out[5] = x2 - o1;
+  out[3] = x3 + o0;
+  out[4] = x3 - o0;
+}
+
+
+// An 8x8 block of dequantized coefficients, in row order, to 8x8
+// pixels at 'out'
+
+typedef void (*IDCTFn)( const short *in, unsigned char *out, int stride );
+
+// 'n' pixels from Y, Cb and Cr samples
+
+typedef void (*ColourFn)( unsigned char *out, const unsigned char *y, const unsigned char *cb, const unsigned char *cr, int n );
+
+// 'n' pixels from Y samples and chroma subsampled by 2 across.  The
+// chroma are given as 'cbSum' and 'crSum', each 16 times a sample,
+// summed over the rows nearest to this one.  Pixel 2i is then
+// (3 sum[i] + sum[i-1] + evenBias) / 16, and pixel 2i+1 is
+// (3 sum[i] + sum[i+1] + oddBias) / 16, so sum[-1] and sum[(n+1)/2]
+// must be there.
+
+typedef void (*ColourH2Fn)( unsigned char *out, const unsigned char *y, const short *cbSum, const short *crSum, int n,
+			    int evenBias, int oddBias );
+
+struct JPEGKernels {
+  IDCTFn     idct;
+  ColourFn   colour;
+  ColourH2Fn colourH2;
+};
+
+
+// YCbCr to RGB in 16-bit fixed point: each chroma term is the high
+// half of a 16-bit product, as _mm_mulhi_epi16() gives it.  Y has four
+// extra bits of precision, and the chroma seven.
+
+#define CR_R  11485             // 1.402    * 8192
+#define CB_G  -2819             // -0.34414 * 8192
+#define CR_G  -5850             // -0.71414 * 8192
+#define CB_B  14516             // 1.772    * 8192
+
+
+// Scalar
+
+static void idctScalar( const short *in, unsigned char *out, int stride )
+
+{
+  int ws[64];
+  int r[8];
+
+  for (int c=0; c<8; c++) {
+
+    const short *s = in + c;
+
+    if (s[8] == 0 && s[16] == 0 && s[24] == 0 && s[32] == 0 && s[40] == 0 && s[48] == 0 && s[56] == 0) {
+      for (int k=0; k<8; k++)
+	ws[8*k+c] = clamp16( s[0] * 4 );
+      continue;
+    }
+
+    idct1D( s[0], s[8], s[16], s[24], s[32], s[40], s[48], s[56], PASS1_BIAS, r );
+
+    for (int k=0; k<8; k++)
+      ws[8*k+c] = clamp16( r[k] >> PASS1_SHIFT );
+  }
+
+  for (int y=0; y<8; y++) {
+
+    const int *s = ws + 8*y;
+
+    idct1D( s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], PASS2_BIAS, r );
+
+    for (int k=0; k<8; k++)
+      out[k] = clamp255( r[k] >> PASS2_SHIFT );
+
+    out += stride;
+  }
+}
+
+
+static inline void yccPixel( unsigned char *out, int y, int cb, int cr )
+
+{
+  int yy  = y * 16 + 8;
+  int cbs = (cb - 128) * 128;
+  int crs = (cr - 128) * 128;
+
+  out[0] = clamp255( (yy + ((crs * CR_R) >> 16)) >> 4 );
+  out[1] = clamp255( (yy + ((cbs * CB_G) >> 16) + ((crs * CR_G) >> 16)) >> 4 );
+  out[2] = clamp255( (yy + ((cbs * CB_B) >> 16)) >> 4 );
+}
+
+
+static void colourScalar( unsigned char *out, const unsigned char *y, const unsigned char *cb, const unsigned char *cr, int n )
+
+{
+  for (int x=0; x<n; x++)
+    yccPixel( out + 3*x, y[x], cb[x], cr[x] );
+}
+
+
+static void colourH2Scalar( unsigned char *out, const unsigned char *y, const short *cbSum, const short *crSum, int n,
+			    int evenBias, int oddBias )
+
+{
+  for (int x=0; x<n; x++) {
+    int i = x >> 1;
+    int j = (x & 1 ? i+1 : i-1);
+    int bias = (x & 1 ? oddBias : evenBias);
+    yccPixel( out + 3*x, y[x], (3 * cbSum[i] + cbSum[j] + bias) >> 4, (3 * crSum[i] + crSum[j] + bias) >> 4 );
+  }
+}
+
+
+#ifdef JPEG_USE_SSE2
+
+static inline __m128i pair16( int a, int b )
+
+{
+  return _mm_setr_epi16( a, b, a, b, a, b, a, b );
+}
+
+
+// The sums of 32-bit lanes 'lo' and 'hi', shifted down and saturated
+// to 16 bits
+
+template <int SHIFT> static inline __m128i descale( __m128i lo, __m128i hi )
+
+{
+  return _mm_packs_epi32( _mm_srai_epi32( lo, SHIFT ), _mm_srai_epi32( hi, SHIFT ) );
+}
+
+
+// One pass of idct1D() on eight columns at once: v[k] holds input k of
+// each column, and is replaced by output k.  Pairs of inputs are
+// interleaved so that _mm_madd_epi16() does two products and their sum
+// at once.
+
+template <int SHIFT> static inline void idctPassSSE2( __m128i v[8], int bias )
+
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i b    = _mm_set1_epi32( bias );
+
+  // Even part
+
+  __m128i lo26 = _mm_unpacklo_epi16( v[2], v[6] );
+  __m128i hi26 = _mm_unpackhi_epi16( v[2], v[6] );
+
+  __m128i t2l = _mm_madd_epi16( lo26, pair16( C1, C1 + C2 ) );
+  __m128i t2h = _mm_madd_epi16( hi26, pair16( C1, C1 + C2 ) );
+  __m128i t3l = _mm_madd_epi16( lo26, pair16( C1 + C3, C1 ) );
+  __m128i t3h = _mm_madd_epi16( hi26, pair16( C1 + C3, C1 ) );
+
+  __m128i s0l = _mm_srai_epi32( _mm_unpacklo_epi16( zero, v[0] ), 4 ); // times 4096
+  __m128i s0h = _mm_srai_epi32( _mm_unpackhi_epi16( zero, v[0] ), 4 );
+  __m128i s4l = _mm_srai_epi32( _mm_unpacklo_epi16( zero, v[4] ), 4 );
+  __m128i s4h = _mm_srai_epi32( _mm_unpackhi_epi16( zero, v[4] ), 4 );
+
+  __m128i t0l = _mm_add_epi32( _mm_add_epi32( s0l, s4l ), b );
+  __m128i t0h = _mm_add_epi32( _mm_add_epi32( s0h, s4h ), b );
+  __m128i t1l = _mm_add_epi32( _mm_sub_epi32( s0l, s4l ), b );
+  __m128i t1h = _mm_add_epi32( _mm_sub_epi32( s0h, s4h ), b );
+
+  __m128i x0l = _mm_add_epi32( t0l, t3l ), x0h = _mm_add_epi32( t0h, t3h );
+  __m128i x3l = _mm_sub_epi32( t0l, t3l ), x3h = _mm_sub_epi32( t0h, t3h );
+  __m128i x1l = _mm_add_epi32( t1l, t2l ), x1h = _mm_add_epi32( t1h, t2h );
+  __m128i x2l = _mm_sub_epi32( t1l, t2l ), x2h = _mm_sub_epi32( t1h, t2h );
+
+  // Odd part
+
+  __m128i lo17 = _mm_unpacklo_epi16( v[1], v[7] );
+  __m128i hi17 = _mm_unpackhi_epi16( v[1], v[7] );
+  __m128i lo35 = _mm_unpacklo_epi16( v[3], v[5] );
+  __m128i hi35 = _mm_unpackhi_epi16( v[3], v[5] );
+
+  const __m128i k3a = pair16( A3 + B1 + B4 + C5, B1 + C5 ), k3b = pair16( C5, B4 + C5 );
+  const __m128i k2a = pair16( C5, B3 + C5 ),                k2b = pair16( A2 + B2 + B3 + C5, B2 + C5 );
+  const __m128i k1a = pair16( B4 + C5, C5 ),                k1b = pair16( B2 + C5, A1 + B2 + B4 + C5 );
+  const __m128i k0a = pair16( B1 + C5, A0 + B1 + B3 + C5 ), k0b = pair16( B3 + C5, C5 );
+
+  __m128i o3l = _mm_add_epi32( _mm_madd_epi16( lo17, k3a ), _mm_madd_epi16( lo35, k3b ) );
+  __m128i o3h = _mm_add_epi32( _mm_madd_epi16( hi17, k3a ), _mm_madd_epi16( hi35, k3b ) );
+  __m128i o2l = _mm_add_epi32( _mm_madd_epi16( lo17, k2a ), _mm_madd_epi16( lo35, k2b ) );
+  __m128i o2h = _mm_add_epi32( _mm_madd_epi16( hi17, k2a ), _mm_madd_epi16( hi35, k2b ) );
+  __m128i o1l = _mm_add_epi32( _mm_madd_epi16( lo17, k1a ), _mm_madd_epi16( lo35, k1b ) );
+  __m128i o1h = _mm_add_epi32( _mm_madd_epi16( hi17, k1a ), _mm_madd_epi16( hi35, k1b ) );
+  __m128i o0l = _mm_add_epi32( _mm_madd_epi16( lo17, k0a ), _mm_madd_epi16( lo35, k0b ) );
+  __m128i o0h = _mm_add_epi32( _mm_madd_epi16( hi17, k0a ), _mm_madd_epi16( hi35, k0b ) );
+
+  v[0] = descale<SHIFT>( _mm_add_epi32( x0l, o3l ), _mm_add_epi32( x0h, o3h ) );
+  v[7] = descale<SHIFT>( _mm_sub_epi32( x0l, o3l ), _mm_sub_epi32( x0h, o3h ) );
+  v[1] = descale<SHIFT>( _mm_add_epi32( x1l, o2l ), _mm_add_epi32( x1h, o2h ) );
+  v[6] = descale<SHIFT>( _mm_sub_epi32( x1l, o2l ), _mm_sub_epi32( x1h, o2h ) );
+  v[2] = descale<SHIFT>( _mm_add_epi32( x2l, o1l ), _mm_add_epi32( x2h, o1h ) );
+  v[5] = descale<SHIFT>( _mm_sub_epi32( x2l, o1l ), _mm_sub_epi32( x2h, o1h ) );
+  v[3] = descale<SHIFT>( _mm_add_epi32( x3l, o0l ), _mm_add_epi32( x3h, o0h ) );
+  v[4] = descale<SHIFT>( _mm_sub_epi32( x3l, o0l ), _mm_sub_epi32( x3h, o0h ) );
+}
+
+
+static inline void transpose8x8( __m128i v[8] )
+
+{
+  __m128i a0 = _mm_unpacklo_epi16( v[0], v[1] ), a1 = _mm_unpackhi_epi16( v[0], v[1] );
+  __m128i a2 = _mm_unpacklo_epi16( v[2], v[3] ), a3 = _mm_unpackhi_epi16( v[2], v[3] );
+  __m128i a4 = _mm_unpacklo_epi16( v[4], v[5] ), a5 = _mm_unpackhi_epi16( v[4], v[5] );
+  __m128i a6 = _mm_unpacklo_epi16( v[6], v[7] ), a7 = _mm_unpackhi_epi16( v[6], v[7] );
+
+  __m128i b0 = _mm_unpacklo_epi32( a0, a2 ), b1 = _mm_unpackhi_epi32( a0, a2 );
+  __m128i b2 = _mm_unpacklo_epi32( a1, a3 ), b3 = _mm_unpackhi_epi32( a1, a3 );
+  __m128i b4 = _mm_unpacklo_epi32( a4, a6 ), b5 = _mm_unpackhi_epi32( a4, a6 );
+  __m128i b6 = _mm_unpacklo_epi32( a5, a7 ), b7 = _mm_unpackhi_epi32( a5, a7 );
+
+  v[0] = _mm_unpacklo_epi64( b0, b4 ); v[1] = _mm_unpackhi_epi64( b0, b4 );
+  v[2] = _mm_unpacklo_epi64( b1, b5 ); v[3] = _mm_unpackhi_epi64( b1, b5 );
+  v[4] = _mm_unpacklo_epi64( b2, b6 ); v[5] = _mm_unpackhi_epi64( b2, b6 );
+  v[6] = _mm_unpacklo_epi64( b3, b7 ); v[7] = _mm_unpackhi_epi64( b3, b7 );
+}
+
+
+static void idctSSE2( const short *in, unsigned char *out, int stride )
+
+{
+  __m128i v[8];
+
+  for (int k=0; k<8; k++)
+    v[k] = _mm_loadu_si128( (const __m128i *) (in + 8*k) );
+
+  idctPassSSE2<PASS1_SHIFT>( v, PASS1_BIAS );
+  transpose8x8( v );
+  idctPassSSE2<PASS2_SHIFT>( v, PASS2_BIAS );
+  transpose8x8( v );
+
+  for (int k=0; k<8; k+=2) {
+    __m128i p = _mm_packus_epi16( v[k], v[k+1] );
+    _mm_storel_epi64( (__m128i *) out, p );
+    _mm_storel_epi64( (__m128i *) (out + stride), _mm_srli_si128( p, 8 ) );
+    out += 2*stride;
+  }
+}
+
+
+// Eight pixels from Y, Cb and Cr in 16-bit lanes, as yccPixel(), to R,
+// G and B in 16-bit lanes (saturated later)
+
+static inline void yccToRGB( __m128i y, __m128i cb, __m128i cr, __m128i &r, __m128i &g, __m128i &b )
+
+{
+  const __m128i c128 = _mm_set1_epi16( 128 );
+
+  __m128i yy  = _mm_add_epi16( _mm_slli_epi16( y, 4 ), _mm_set1_epi16( 8 ) );
+  __m128i cbs = _mm_slli_epi16( _mm_sub_epi16( cb, c128 ), 7 );
+  __m128i crs = _mm_slli_epi16( _mm_sub_epi16( cr, c128 ), 7 );
+
+  r = _mm_srai_epi16( _mm_add_epi16( yy, _mm_mulhi_epi16( crs, _mm_set1_epi16( CR_R ) ) ), 4 );
+  g = _mm_srai_epi16( _mm_add_epi16( _mm_add_epi16( yy, _mm_mulhi_epi16( cbs, _mm_set1_epi16( CB_G ) ) ),
+				     _mm_mulhi_epi16( crs, _mm_set1_epi16( CR_G ) ) ), 4 );
+  b = _mm_srai_epi16( _mm_add_epi16( yy, _mm_mulhi_epi16( cbs, _mm_set1_epi16( CB_B ) ) ), 4 );
+}
+
+
+// Store 16 pixels from R, G and B in 16-bit lanes (low eight pixels in
+// the 'lo' registers).  Each pixel is stored as four bytes, so one
+// byte after the 48 is overwritten.
+
+static inline void storeRGB( unsigned char *out, __m128i rlo, __m128i glo, __m128i blo, __m128i rhi, __m128i ghi, __m128i bhi )
+
+{
+  __m128i r = _mm_packus_epi16( rlo, rhi );
+  __m128i g = _mm_packus_epi16( glo, ghi );
+  __m128i b = _mm_packus_epi16( blo, bhi );
+
+  __m128i rg0 = _mm_unpacklo_epi8( r, g ), rg1 = _mm_unpackhi_epi8( r, g );
+  __m128i b0  = _mm_unpacklo_epi8( b, _mm_setzero_si128() ), b1 = _mm_unpackhi_epi8( b, _mm_setzero_si128() );
+
+  __m128i q[4] = { _mm_unpacklo_epi16( rg0, b0 ), _mm_unpackhi_epi16( rg0, b0 ),
+		   _mm_unpacklo_epi16( rg1, b1 ), _mm_unpackhi_epi16( rg1, b1 ) };
+
+  for (int k=0; k<4; k++)
+    for (int j=0; j<4; j++) {
+      int v = _mm_cvtsi128_si32( q[k] );
+      memcpy( out, &v, 4 );
+      out += 3;
+      q[k] = _mm_srli_si128( q[k], 4 );
+    }
+}
+
+
+// The SIMD loops stop 16 pixels short of the end of the row, so the
+// byte overwritten after each 16 pixels is always rewritten later.
+
+static void colourSSE2( unsigned char *out, const unsigned char *y, const unsigned char *cb, const unsigned char *cr, int n )
+
+{
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+
+  for (; x+16 < n; x+=16) {
+
+    __m128i yv  = _mm_loadu_si128( (const __m128i *) (y + x) );
+    __m128i cbv = _mm_loadu_si128( (const __m128i *) (cb + x) );
+    __m128i crv = _mm_loadu_si128( (const __m128i *) (cr + x) );
+
+    __m128i rlo, glo, blo, rhi, ghi, bhi;
+
+    yccToRGB( _mm_unpacklo_epi8( yv, zero ), _mm_unpacklo_epi8( cbv, zero ), _mm_unpacklo_epi8( crv, zero ), rlo, glo, blo );
+    yccToRGB( _mm_unpackhi_epi8( yv, zero ), _mm_unpackhi_epi8( cbv, zero ), _mm_unpackhi_epi8( crv, zero ), rhi, ghi, bhi );
+
+    storeRGB( out + 3*x, rlo, glo, blo, rhi, ghi, bhi );
+  }
+
+  colourScalar( out + 3*x, y + x, cb + x, cr + x, n-x );
+}
+
+
+// Eight chroma sums from sum[i-1], sum[i] and sum[i+1] to sixteen
+// chroma samples in 16-bit lanes
+
+static inline void upsampleH2( const short *sum, __m128i evenBias, __m128i oddBias, __m128i &lo, __m128i &hi )
+
+{
+  __m128i s  = _mm_loadu_si128( (const __m128i *) sum );
+  __m128i s3 = _mm_add_epi16( s, _mm_add_epi16( s, s ) );
+
+  __m128i even = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( s3, _mm_loadu_si128( (const __m128i *) (sum - 1) ) ), evenBias ), 4 );
+  __m128i odd  = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( s3, _mm_loadu_si128( (const __m128i *) (sum + 1) ) ), oddBias ), 4 );
+
+  lo = _mm_unpacklo_epi16( even, odd );
+  hi = _mm_unpackhi_epi16( even, odd );
+}
+
+
+static void colourH2SSE2( unsigned char *out, const unsigned char *y, const short *cbSum, const short *crSum, int n,
+			  int evenBias, int oddBias )
+
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i eb   = _mm_set1_epi16( evenBias );
+  const __m128i ob   = _mm_set1_epi16( oddBias );
+  int x = 0;
+
+  for (; x+16 < n; x+=16) {
+
+    __m128i yv = _mm_loadu_si128( (const __m128i *) (y + x) );
+    __m128i cblo, cbhi, crlo, crhi;
+
+    upsampleH2( cbSum + x/2, eb, ob, cblo, cbhi );
+    upsampleH2( crSum + x/2, eb, ob, crlo, crhi );
+
+    __m128i rlo, glo, blo, rhi, ghi, bhi;
+
+    yccToRGB( _mm_unpacklo_epi8( yv, zero ), cblo, crlo, rlo, glo, blo );
+    yccToRGB( _mm_unpackhi_epi8( yv, zero ), cbhi, crhi, rhi, ghi, bhi );
+
+    storeRGB( out + 3*x, rlo, glo, blo, rhi, ghi, bhi );
+  }
+
+  colourH2Scalar( out + 3*x, y + x, cbSum + x/2, crSum + x/2, n-x, evenBias, oddBias );
+}
+
+#endif
+
+
+
+static JPEGKernels kernels[NUM_JPEG_KERNEL_SETS];
+
+static bool buildKernels()
+
+{
+  JPEGKernels scalar = { idctScalar, colourScalar, colourH2Scalar };
+
+  for (int i=0; i<NUM_JPEG_KERNEL_SETS; i++)
+    kernels[i] = scalar;
+
+#ifdef JPEG_USE_SSE2
+  JPEGKernels sse2 = { idctSSE2, colourSSE2, colourH2SSE2 };
+
+  kernels[JPEG_SSE2] = sse2;
+#endif
+
+  return true;
+}
+
+static bool kernelsBuilt = buildKernels();
+
+
+bool canUseJPEGKernelSet( JPEGKernelSet set )
+
+{
+  switch (set) {
+  case JPEG_SCALAR:
+    return true;
+#ifdef JPEG_USE_SSE2
+  case JPEG_SSE2:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+
+static JPEGKernelSet bestJPEGKernelSet()
+
+{
+  int set = NUM_JPEG_KERNEL_SETS-1;
+
+  while (set > JPEG_SCALAR && !canUseJPEGKernelSet( (JPEGKernelSet) set ))
+    set--;
+
+  return (JPEGKernelSet) set;
+}
+
+JPEGKernelSet jpegKernelSet = bestJPEGKernelSet();
+
+
+
+// ---------------- Scaled transforms ----------------
+
+
+// Each pixel of a shrunk block is the average of the pixels that the
+// full transform would give in its place.  Averaging pairs of outputs
+// of the 8-point IDCT turns coefficient u into coefficient u of a
+// 4-point IDCT times cos(u pi/16), and folds coefficient 8-u onto it
+// with the opposite sign; averaging fours leaves a 2-point IDCT.  With
+// the products multiplied out, these are the IJG library's reduced
+// transforms (jidctred.c), here with the fixed point of the full one.
+
+#define R1 FIX( 1.281457724 )   // 4-point, odd part
+#define R3 FIX( 0.449988111 )
+#define R5 FIX( 0.300672443 )
+#define R7 FIX( 0.254897789 )
+#define S1 FIX( 0.530797000 )
+#define S3 FIX( 1.086366179 )
+#define S5 FIX( 0.725894534 )
+#define S7 FIX( 0.105580913 )
+#define E2 FIX( 0.923879533 )   // 4-point, even part
+#define E6 FIX( 0.382683432 )
+
+#define Q1 FIX( 0.906127446 )   // 2-point
+#define Q3 FIX( 0.318189645 )
+#define Q5 FIX( 0.212607523 )
+#define Q7 FIX( 0.180239955 )
+
+
+// The 4-point IDCT of the 8 coefficients 's[0]', 's[step]', ... before
+// the final shift
+
+static inline void idct4( const int *s, int step, int bias, int out[4] )
+
+{
+  int t0 = s[0] * 4096 + bias;
+  int t2 = s[2*step] * E2 - s[6*step] * E6;
+
+  int o0 = s[step] * R1 + s[3*step] * R3 - s[5*step] * R5 - s[7*step] * R7;
+  int o1 = s[step] * S1 - s[3*step] * S3 + s[5*step] * S5 - s[7*step] * S7;
+
+  out[0] = t0 + t2 + o0;
+  out[3] = t0 + t2 - o0;
+  out[1] = t0 - t2 + o1;
+  out[2] = t0 - t2 - o1;
+}
+
+
+// For 1/2 size
+
+static void idct4x4( const short *in, unsigned char *out, int stride )
+
+{
+  int s[64], ws[32], r[4];
+
+  for (int k=0; k<64; k++)
+    s[k] = in[k];
+
+  for (int c=0; c<8; c++) {
+    idct4( s + c, 8, PASS1_BIAS, r );
+    for (int y=0; y<4; y++)
+      ws[8*y+c] = clamp16( r[y] >> PASS1_SHIFT );
+  }
+
+  for (int y=0; y<4; y++) {
+    idct4( ws + 8*y, 1, PASS2_BIAS, r );
+    for (int x=0; x<4; x++)
+      out[x] = clamp255( r[x] >> PASS2_SHIFT );
+    out += stride;
+  }
+}
+
+
+// The 2-point IDCT, likewise
+
+static inline void idct2( const int *s, int step, int bias, int out[2] )
+
+{
+  int t0 = s[0] * 4096 + bias;
+  int o0 = s[step] * Q1 - s[3*step] * Q3 + s[5*step] * Q5 - s[7*step] * Q7;
+
+  out[0] = t0 + o0;
+  out[1] = t0 - o0;
+}
+
+
+// For 1/4 size
+
+static void idct2x2( const short *in, unsigned char *out, int stride )
+
+{
+  int s[64], ws[16], r[2];
+
+  for (int k=0; k<64; k++)
+    s[k] = in[k];
+
+  for (int c=0; c<8; c++) {
+    idct2( s + c, 8, PASS1_BIAS, r );
+    ws[c]   = clamp16( r[0] >> PASS1_SHIFT );
+    ws[8+c] = clamp16( r[1] >> PASS1_SHIFT );
+  }
+
+  for (int y=0; y<2; y++) {
+    idct2( ws + 8*y, 1, PASS2_BIAS, r );
+    out[0] = clamp255( r[0] >> PASS2_SHIFT );
+    out[1] = clamp255( r[1] >> PASS2_SHIFT );
+    out += stride;
+  }
+}
+
+
+// Transform 'block' (dequantized, in row order) to 'size' x 'size'
+// pixels.  'dcOnly' says that all its AC coefficients are zero.
+
+static inline void transformBlock( const JPEGKernels &k, const short *block, bool dcOnly, int size,
+				   unsigned char *out, int stride )
+
+{
+  if (dcOnly) {
+    unsigned char v = dcPixel( block[0] );
+    for (int y=0; y<size; y++)
+      memset( out + y * stride, v, size );
+    return;
+  }
+
+  switch (size) {
+  case 8:
+    k.idct( block, out, stride );
+    break;
+  case 4:
+    idct4x4( block, out, stride );
+    break;
+  case 2:
+    idct2x2( block, out, stride );
+    break;
+  default:
+    out[0] = dcPixel( block[0] );
+    break;
+  }
+}
+
+
+
+// ---------------- Huffman decoding ----------------
+
+
+struct HuffmanTable {
+  bool     defined;
+  uint16_t fast[ 1 << FAST_BITS ];   // for codes of up to FAST_BITS: (code length << 8) | symbol, or 0
+  int16_t  fastAC[ 1 << FAST_BITS ]; // for AC codes and their extra bits within FAST_BITS: (value << 8) | (run << 4) | bits, or 0
+  uint32_t maxCode[18];              // for each length, the codes are less than this, aligned to 16 bits
+  int      delta[17];                // for each length, the symbol index minus the code
+  unsigned char symbols[256];
+};
+
+
+// Build 'h' from the number of codes of each length in 'counts' and the
+// symbols in 'symbols', as in annex C.  Returns false if the codes do
+// not fit.
+
+static bool buildHuffmanTable( HuffmanTable &h, const unsigned char *counts, const unsigned char *symbols, int numSymbols )
+
+{
+  unsigned char size[256];
+  uint16_t code[256];
+
+  memcpy( h.symbols, symbols, numSymbols );
+  memset( h.fast, 0, sizeof(h.fast) );
+  memset( h.fastAC, 0, sizeof(h.fastAC) );
+
+  int k = 0;
+  unsigned int c = 0;
+
+  for (int len=1; len<=16; len++) {
+    h.delta[len] = k - (int) c;
+    for (int i=0; i<counts[len-1]; i++) {
+      size[k] = len;
+      code[k++] = c++;
+    }
+    if (c > (1u << len))
+      return false;
+    h.maxCode[len] = c << (16 - len);
+    c <<= 1;
+  }
+
+  h.maxCode[17] = 0xffffffff;
+
+  for (int i=0; i<numSymbols; i++)
+    if (size[i] <= FAST_BITS) {
+
+      int first = code[i] << (FAST_BITS - size[i]);
+      int n = 1 << (FAST_BITS - size[i]);
+
+      for (int j=0; j<n; j++)
+	h.fast[first + j] = (size[i] << 8) | symbols[i];
+
+      // With the extra bits of an AC coefficient too, if they fit and
+      // the value fits in 8 bits
+
+      int run  = symbols[i] >> 4;
+      int bits = symbols[i] & 15;
+
+      if (bits != 0 && size[i] + bits <= FAST_BITS)
+	for (int j=0; j<n; j++) {
+	  int v = j >> (FAST_BITS - size[i] - bits);
+	  if (v < (1 << (bits-1)))
+	    v -= (1 << bits) - 1;
+	  if (v >= -128 && v <= 127)
+	    h.fastAC[first + j] = (int16_t) (v * 256 + (run << 4) + size[i] + bits);
+	}
+    }
+
+  h.defined = true;
+
+  return true;
+}
+
+
+// The entropy-coded data of one restart interval.  Bits are taken from
+// the top of a 64-bit buffer.  At the end of the data, or at a marker,
+// zeros are fed in instead.
+
+struct BitReader {
+
+  const unsigned char *p, *end;
+  uint64_t bits;
+  int      count;               // of valid bits in 'bits'
+  bool     bad;                 // an invalid code was found
+
+  BitReader( const unsigned char *start, const unsigned char *e ) : p( start ), end( e ), bits( 0 ), count( 0 ), bad( false ) {}
+
+  void fill() {
+
+    // Whole bytes at once if there is no 0xff among the next eight
+
+    if (end - p >= 8) {
+      uint64_t w = 0;
+      for (int i=0; i<8; i++)
+	w = (w << 8) | p[i];
+      uint64_t x = ~w;
+      if (((x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL) == 0) {
+	int n = (64 - count) >> 3;
+	bits |= (w >> (64 - 8*n)) << (64 - 8*n - count);
+	count += 8*n;
+	p += n;
+	return;
+      }
+    }
+
+    while (count <= 56) {
+      unsigned int b = 0;
+      if (p < end) {
+	b = *p++;
+	if (b == 0xff) {
+	  if (p < end && *p == 0)
+	    p++;                // a stuffed 0xff
+	  else {
+	    b = 0;              // fill bytes before a marker
+	    p = end;
+	  }
+	}
+      }
+      bits |= (uint64_t) b << (56 - count);
+      count += 8;
+    }
+  }
+
+  inline int getBits( int n ) {   // n is 1 to 16
+    if (count < n)
+      fill();
+    int v = (int) (bits >> (64 - n));
+    bits <<= n;
+    count -= n;
+    return v;
+  }
+
+  // The value of a coefficient coded in 'n' bits, as in F.2.2.1
+
+  inline int receiveExtend( int n ) {
+    int v = getBits( n );
+    return (v < (1 << (n-1)) ? v - (1 << n) + 1 : v);
+  }
+
+  inline int decode( const HuffmanTable &h ) {
+    if (count < 16)
+      fill();
+    int f = h.fast[ bits >> (64 - FAST_BITS) ];
+    if (f != 0) {
+      int n = f >> 8;
+      bits <<= n;
+      count -= n;
+      return f & 0xff;
+    }
+    uint32_t top = (uint32_t) (bits >> 48);
+    int n = FAST_BITS+1;
+    while (top >= h.maxCode[n])
+      n++;
+    if (n > 16) {
+      bad = true;
+      return 0;
+    }
+    int i = (int) (top >> (16 - n)) + h.delta[n];
+    bits <<= n;
+    count -= n;
+    return h.symbols[i];
+  }
+};
+
+
+
+// ---------------- Decoding ----------------
+
+
+struct JPEGComponent {
+  int id, h, v, quant;          // from the frame header
+  int blocksPerLine, blocksPerColumn; // of whole MCUs
+  int blocksX, blocksY;         // covering the component's samples
+  int blockSize;                // of the transformed blocks: 8 / shrink, or more if subsampled
+  int scaledH, scaledV;         // h and v times blockSize
+  int planeWidth, planeHeight;  // number of samples, after shrinking
+  int stride;                   // of 'plane'
+  unsigned char *plane;         // the samples
+  short *coefs;                 // a progressive JPEG's coefficients, as decoded
+  int dcTable, acTable;         // of the current scan
+};
+
+
+typedef enum { SEQUENTIAL, DC_FIRST, DC_REFINE, AC_FIRST, AC_REFINE } ScanType;
+
+struct Scan {
+  int numComponents;
+  JPEGComponent *comps[ MAX_COMPONENTS ];
+  ScanType type;
+  int ss, se, al;               // spectral selection and successive approximation
+};
+
+
+struct JPEGDecoder {
+
+  unsigned width, height;
+  int  numComponents;
+  JPEGComponent comps[ MAX_COMPONENTS ];
+  int  hMax, vMax, mcusX, mcusY;
+  int  scaledHMax, scaledVMax;  // hMax and vMax times 8 / shrink
+  bool progressive;
+  bool frameSeen, scanSeen;
+  int  adobeTransform;          // or -1 without an Adobe marker
+  int  restartInterval;
+
+  uint16_t quant[4][64];        // in zigzag order
+  bool quantDefined[4];
+  HuffmanTable dcTables[4], acTables[4];
+
+  int shrink;
+  int numThreads;
+  const JPEGKernels *k;
+
+  JPEGDecoder() : numComponents( 0 ), frameSeen( false ), scanSeen( false ), adobeTransform( -1 ), restartInterval( 0 ) {
+    memset( comps, 0, sizeof(comps) );
+    memset( quantDefined, 0, sizeof(quantDefined) );
+    for (int i=0; i<4; i++)
+      dcTables[i].defined = acTables[i].defined = false;
+  }
+
+  ~JPEGDecoder() {
+    for (int i=0; i<numComponents; i++) {
+      delete [] comps[i].plane;
+      delete [] comps[i].coefs;
+    }
+  }
+};
+
+
+static inline int getBigEndian16( const unsigned char *p )
+
+{
+  return (p[0] << 8) | p[1];
+}
+
+
+
+// Frame header (SOFn)
+
+static const char *readFrameHeader( JPEGDecoder &d, const unsigned char *seg, size_t len, bool progressive )
+
+{
+  if (d.frameSeen)
+    return "JPEG has more than one frame";
+
+  if (len < 6)
+    return "invalid JPEG frame header";
+
+  if (seg[0] != 8)
+    return "only 8-bit JPEGs are supported";
+
+  d.height      = getBigEndian16( seg+1 );
+  d.width       = getBigEndian16( seg+3 );
+  d.progressive = progressive;
+
+  int numComponents = seg[5];
+
+  if (d.height == 0)
+    return "JPEGs with a DNL marker are not supported";
+
+  if (d.width == 0 || len < 6 + 3 * (size_t) numComponents)
+    return "invalid JPEG frame header";
+
+  if (d.height >= JPEG_MAX_PIXELS / d.width)
+    return "JPEG is too large";
+
+  if (numComponents == 4)
+    return "CMYK JPEGs are not supported";
+
+  if (numComponents != 1 && numComponents != 3)
+    return "only grey and colour JPEGs are supported";
+
+  d.numComponents = numComponents;
+
+  d.hMax = d.vMax = 1;
+
+  for (int i=0; i<d.numComponents; i++) {
+    JPEGComponent &c = d.comps[i];
+    c.id    = seg[6+3*i];
+    c.h     = seg[7+3*i] >> 4;
+    c.v     = seg[7+3*i] & 15;
+    c.quant = seg[8+3*i];
+    if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4 || c.quant > 3)
+      return "invalid JPEG frame header";
+    if (c.h > d.hMax) d.hMax = c.h;
+    if (c.v > d.vMax) d.vMax = c.v;
+  }
+
+  d.mcusX = (d.width  + 8*d.hMax-1) / (8*d.hMax);
+  d.mcusY = (d.height + 8*d.vMax-1) / (8*d.vMax);
+
+  // The planes of samples are whole MCUs.  As in the IJG library, a
+  // subsampled component is shrunk less where that leaves it a whole
+  // fraction of the image's size, so that it needs less upsampling: at
+  // 1/2 size, 4:2:0 chroma is not shrunk at all.
+
+  d.scaledHMax = d.hMax * 8 / d.shrink;
+  d.scaledVMax = d.vMax * 8 / d.shrink;
+
+  for (int i=0; i<d.numComponents; i++) {
+
+    JPEGComponent &c = d.comps[i];
+
+    int bs = 8 / d.shrink;
+
+    while (bs < 8 && d.scaledHMax % (c.h * bs * 2) == 0 && d.scaledVMax % (c.v * bs * 2) == 0)
+      bs *= 2;
+
+    c.blockSize = bs;
+    c.scaledH   = c.h * bs;
+    c.scaledV   = c.v * bs;
+
+    int samplesX = (d.width  * c.h + d.hMax-1) / d.hMax;
+    int samplesY = (d.height * c.v + d.vMax-1) / d.vMax;
+
+    c.blocksPerLine   = d.mcusX * c.h;
+    c.blocksPerColumn = d.mcusY * c.v;
+    c.blocksX         = (samplesX + 7) / 8;
+    c.blocksY         = (samplesY + 7) / 8;
+    c.planeWidth      = (samplesX * bs + 7) / 8;
+    c.planeHeight     = (samplesY * bs + 7) / 8;
+    c.stride          = c.blocksPerLine * bs;
+
+    size_t planeSize = (size_t) c.stride * c.blocksPerColumn * bs;
+
+    c.plane = new (std::nothrow) unsigned char[ planeSize ];
+
+    if (c.plane == NULL)
+      return "not enough memory for the image";
+
+    memset( c.plane, 128, planeSize ); // for blocks that are never decoded
+
+    if (progressive) {
+      c.coefs = new (std::nothrow) short[ (size_t) c.blocksPerLine * c.blocksPerColumn * 64 ]();
+      if (c.coefs == NULL)
+	return "not enough memory for the image";
+    }
+  }
+
+  d.frameSeen = true;
+
+  return NULL;
+}
+
+
+
+// Huffman tables (DHT)
+
+static const char *readHuffmanTables( JPEGDecoder &d, const unsigned char *seg, size_t len )
+
+{
+  size_t p = 0;
+
+  while (p < len) {
+
+    if (p + 17 > len)
+      return "invalid JPEG Huffman table";
+
+    int tableClass = seg[p] >> 4;
+    int id = seg[p] & 15;
+
+    if (tableClass > 1 || id > 3)
+      return "invalid JPEG Huffman table";
+
+    const unsigned char *counts = seg + p + 1;
+    int numSymbols = 0;
+
+    for (int i=0; i<16; i++)
+      numSymbols += counts[i];
+
+    p += 17;
+
+    if (numSymbols > 256 || p + numSymbols > len)
+      return "invalid JPEG Huffman table";
+
+    HuffmanTable &h = (tableClass == 0 ? d.dcTables[id] : d.acTables[id]);
+
+    if (!buildHuffmanTable( h, counts, seg + p, numSymbols ))
+      return "invalid JPEG Huffman table";
+
+    p += numSymbols;
+  }
+
+  return NULL;
+}
+
+
+
+// Quantization tables (DQT), of 8 or 16-bit values
+
+static const char *readQuantTables( JPEGDecoder &d, const unsigned char *seg, size_t len )
+
+{
+  size_t p = 0;
+
+  while (p < len) {
+
+    int precision = seg[p] >> 4;
+    int id = seg[p] & 15;
+    size_t n = (precision ? 128 : 64);
+
+    if (precision > 1 || id > 3 || p + 1 + n > len)
+      return "invalid JPEG quantization table";
+
+    for (int k=0; k<64; k++)
+      d.quant[id][k] = (precision ? getBigEndian16( seg + p + 1 + 2*k ) : seg[p+1+k]);
+
+    d.quantDefined[id] = true;
+
+    p += 1 + n;
+  }
+
+  return NULL;
+}
+
+
+
+// Decoding of one block, by the type of the scan.  A sequential JPEG's
+// block is transformed straight into its plane.
+
+static void decodeSequentialBlock( JPEGDecoder &d, JPEGComponent &c, int bx, int by, BitReader &br, int &dcPred,
+				   short *block )
+
+{
+  const HuffmanTable &dc = d.dcTables[ c.dcTable ];
+  const HuffmanTable &ac = d.acTables[ c.acTable ];
+  const uint16_t *q = d.quant[ c.quant ];
+
+  int t = br.decode( dc );
+
+  if (t > 15) {
+    br.bad = true;
+    return;
+  }
+
+  dcPred += (t ? br.receiveExtend( t ) : 0);
+
+  if (dcPred < -65536 || dcPred > 65535) // only in corrupt data, but keep dcPred * q in range
+    dcPred = (dcPred < 0 ? -65536 : 65535);
+
+  block[0] = clamp16( dcPred * q[0] );
+
+  int last = 0;
+
+  for (int k=1; k<64; ) {
+
+    if (br.count < 16)
+      br.fill();
+
+    int f = ac.fastAC[ br.bits >> (64 - FAST_BITS) ];
+
+    if (f != 0) {
+      int n = f & 15;
+      br.bits <<= n;
+      br.count -= n;
+      k += (f >> 4) & 15;
+      if (k > 63) {
+	br.bad = true;
+	break;
+      }
+      block[ zigzag[k] ] = clamp16( (f >> 8) * q[k] );
+      last = k++;
+      continue;
+    }
+
+    int rs = br.decode( ac );
+    int r = rs >> 4;
+    int s = rs & 15;
+
+    if (s == 0) {
+      if (r != 15)
+	break;                  // end of block
+      k += 16;
+      continue;
+    }
+
+    k += r;
+
+    if (k > 63) {
+      br.bad = true;
+      break;
+    }
+
+    block[ zigzag[k] ] = clamp16( br.receiveExtend( s ) * q[k] );
+    last = k++;
+  }
+
+  int size = c.blockSize;
+
+  transformBlock( *d.k, block, last == 0, size, c.plane + (size_t) by * size * c.stride + bx * size, c.stride );
+
+  if (last == 0)
+    block[0] = 0;
+  else
+    memset( block, 0, 64 * sizeof(short) );
+}
+
+
+static void decodeDCFirst( BitReader &br, const HuffmanTable &dc, short *coefs, int al, int &dcPred )
+
+{
+  int t = br.decode( dc );
+
+  if (t > 15) {
+    br.bad = true;
+    return;
+  }
+
+  dcPred += (t ? br.receiveExtend( t ) : 0);
+
+  if (dcPred < -65536 || dcPred > 65535)
+    dcPred = (dcPred < 0 ? -65536 : 65535);
+
+  coefs[0] = clamp16( dcPred * (1 << al) );
+}
+
+
+static void decodeDCRefine( BitReader &br, short *coefs, int al )
+
+{
+  if (br.getBits( 1 ))
+    coefs[0] |= (1 << al);
+}
+
+
+static void decodeACFirst( BitReader &br, const HuffmanTable &ac, short *coefs, int ss, int se, int al, int &eobRun )
+
+{
+  if (eobRun > 0) {
+    eobRun--;
+    return;
+  }
+
+  for (int k=ss; k<=se; ) {
+
+    int rs = br.decode( ac );
+    int r = rs >> 4;
+    int s = rs & 15;
+
+    if (s == 0) {
+      if (r < 15) {
+	eobRun = (1 << r) - 1;
+	if (r)
+	  eobRun += br.getBits( r );
+	break;
+      }
+      k += 16;
+      continue;
+    }
+
+    k += r;
+
+    if (k > 63) {
+      br.bad = true;
+      break;
+    }
+
+    coefs[ zigzag[k] ] = clamp16( br.receiveExtend( s ) * (1 << al) );
+    k++;
+  }
+}
+
+
+// As the IJG library's decode_mcu_AC_refine(): each coefficient that
+// is already nonzero gets a correction bit, and new coefficients of
+// +-1 are placed among the zero ones.
+
+static void decodeACRefine( BitReader &br, const HuffmanTable &ac, short *coefs, int ss, int se, int al, int &eobRun )
+
+{
+  int p1 = 1 << al;
+  int m1 = -p1;
+  int k  = ss;
+
+  if (eobRun == 0)
+    for (; k<=se; k++) {
+
+      int rs = br.decode( ac );
+      int r = rs >> 4;
+      int s = rs & 15;
+      int value = 0;
+
+      if (s != 0) {
+	if (s != 1) {
+	  br.bad = true;
+	  return;
+	}
+	value = (br.getBits( 1 ) ? p1 : m1);
+      } else if (r != 15) {
+	eobRun = 1 << r;
+	if (r)
+	  eobRun += br.getBits( r );
+	break;
+      }
+
+      // Skip 'r' zero coefficients, refining the nonzero ones on the way
+
+      for (; k<=se; k++) {
+	short &coef = coefs[ zigzag[k] ];
+	if (coef != 0) {
+	  if (br.getBits( 1 ) && (coef & p1) == 0)
+	    coef += (coef >= 0 ? p1 : m1);
+	} else if (--r < 0)
+	  break;
+      }
+
+      if (value != 0 && k <= se)
+	coefs[ zigzag[k] ] = value;
+    }
+
+  if (eobRun > 0) {
+
+    // Refine the rest of the band
+
+    for (; k<=se; k++) {
+      short &coef = coefs[ zigzag[k] ];
+      if (coef != 0 && br.getBits( 1 ) && (coef & p1) == 0)
+	coef += (coef >= 0 ? p1 : m1);
+    }
+
+    eobRun--;
+  }
+}
+
+
+static void decodeBlock( JPEGDecoder &d, const Scan &scan, JPEGComponent &c, int bx, int by, BitReader &br,
+			 int &dcPred, int &eobRun, short *block )
+
+{
+  if (scan.type == SEQUENTIAL) {
+    decodeSequentialBlock( d, c, bx, by, br, dcPred, block );
+    return;
+  }
+
+  short *coefs = c.coefs + ((size_t) by * c.blocksPerLine + bx) * 64;
+
+  switch (scan.type) {
+  case DC_FIRST:
+    decodeDCFirst( br, d.dcTables[ c.dcTable ], coefs, scan.al, dcPred );
+    break;
+  case DC_REFINE:
+    decodeDCRefine( br, coefs, scan.al );
+    break;
+  case AC_FIRST:
+    decodeACFirst( br, d.acTables[ c.acTable ], coefs, scan.ss, scan.se, scan.al, eobRun );
+    break;
+  default:
+    decodeACRefine( br, d.acTables[ c.acTable ], coefs, scan.ss, scan.se, scan.al, eobRun );
+    break;
+  }
+}
+
+
+
+// Decode MCUs 'first' to 'end'-1 of a scan from the data of one
+// restart interval.  A scan of one component has MCUs of one block,
+// over the blocks that cover its samples.
+
+static void decodeInterval( JPEGDecoder &d, const Scan &scan, int first, int end,
+			    const unsigned char *data, const unsigned char *dataEnd )
+
+{
+  BitReader br( data, dataEnd );
+
+  int dcPred[ MAX_COMPONENTS ] = { 0, 0, 0, 0 };
+  int eobRun = 0;
+
+  alignas(16) short block[64];
+  memset( block, 0, sizeof(block) );
+
+  for (int m=first; m<end && !br.bad; m++)
+
+    if (scan.numComponents == 1) {
+
+      JPEGComponent &c = *scan.comps[0];
+      decodeBlock( d, scan, c, m % c.blocksX, m / c.blocksX, br, dcPred[0], eobRun, block );
+
+    } else {
+
+      int mx = m % d.mcusX;
+      int my = m / d.mcusX;
+
+      for (int i=0; i<scan.numComponents; i++) {
+	JPEGComponent &c = *scan.comps[i];
+	for (int y=0; y<c.v; y++)
+	  for (int x=0; x<c.h; x++)
+	    decodeBlock( d, scan, c, mx * c.h + x, my * c.v + y, br, dcPred[i], eobRun, block );
+      }
+    }
+}
+
+
+
+// Find the entropy-coded data of a scan, from 'p', and where its
+// restart intervals start and end.  Returns the position of the marker
+// after the scan.
+
+static size_t findIntervals( const unsigned char *in, size_t inSize, size_t p,
+			     std::vector<size_t> &starts, std::vector<size_t> &ends )
+
+{
+  starts.push_back( p );
+
+  for (;;) {
+
+    const unsigned char *ff = (p < inSize ? (const unsigned char *) memchr( in + p, 0xff, inSize - p ) : NULL);
+
+    if (ff == NULL || ff + 1 >= in + inSize) {
+      p = inSize;
+      break;
+    }
+
+    p = ff - in;
+    int b = in[p+1];
+
+    if (b == 0 || b == 0xff)    // a stuffed 0xff, or a fill byte
+      p++;
+    else if (b >= 0xd0 && b <= 0xd7) {
+      ends.push_back( p );
+      starts.push_back( p+2 );
+      p += 2;
+    } else
+      break;
+  }
+
+  ends.push_back( p );
+
+  return p;
+}
+
+
+
+// Start of scan (SOS): read the header, and decode the data that
+// follows from 'p', which is left at the marker after it
+
+static const char *readScan( JPEGDecoder &d, const unsigned char *seg, size_t len,
+			     const unsigned char *in, size_t inSize, size_t &p )
+
+{
+  if (!d.frameSeen)
+    return "JPEG scan before the frame header";
+
+  Scan scan;
+
+  scan.numComponents = (len > 0 ? seg[0] : 0);
+
+  if (scan.numComponents < 1 || scan.numComponents > d.numComponents || len < 4 + 2 * (size_t) scan.numComponents)
+    return "invalid JPEG scan header";
+
+  for (int i=0; i<scan.numComponents; i++) {
+
+    int id = seg[1+2*i];
+    JPEGComponent *c = NULL;
+
+    for (int j=0; j<d.numComponents; j++)
+      if (d.comps[j].id == id)
+	c = &d.comps[j];
+
+    if (c == NULL)
+      return "invalid JPEG scan header";
+
+    c->dcTable = seg[2+2*i] >> 4;
+    c->acTable = seg[2+2*i] & 15;
+
+    if (c->dcTable > 3 || c->acTable > 3)
+      return "invalid JPEG scan header";
+
+    scan.comps[i] = c;
+  }
+
+  const unsigned char *s = seg + 1 + 2 * scan.numComponents;
+
+  scan.ss = s[0];
+  scan.se = s[1];
+  scan.al = s[2] & 15;
+
+  int ah = s[2] >> 4;
+
+  if (!d.progressive)
+    scan.type = SEQUENTIAL;
+  else if (scan.ss == 0)
+    scan.type = (ah == 0 ? DC_FIRST : DC_REFINE);
+  else
+    scan.type = (ah == 0 ? AC_FIRST : AC_REFINE);
+
+  if (d.progressive && (scan.se > 63 || scan.al > 13 ||
+			(scan.ss == 0 ? scan.se != 0 : scan.se < scan.ss || scan.numComponents != 1)))
+    return "invalid JPEG progressive scan";
+
+  // The tables the scan uses
+
+  for (int i=0; i<scan.numComponents; i++) {
+    const JPEGComponent &c = *scan.comps[i];
+    if (((scan.type == SEQUENTIAL || scan.type == DC_FIRST) && !d.dcTables[ c.dcTable ].defined) ||
+	((scan.type == SEQUENTIAL || scan.type >= AC_FIRST) && !d.acTables[ c.acTable ].defined))
+      return "JPEG scan uses an undefined Huffman table";
+    if (scan.type == SEQUENTIAL && !d.quantDefined[ c.quant ])
+      return "JPEG scan uses an undefined quantization table";
+  }
+
+  // Decode the restart intervals in parallel
+
+  std::vector<size_t> starts, ends;
+
+  p = findIntervals( in, inSize, p, starts, ends );
+
+  int numMCUs = (scan.numComponents == 1 ? scan.comps[0]->blocksX * scan.comps[0]->blocksY : d.mcusX * d.mcusY);
+  int ri = d.restartInterval;
+  int numIntervals = 1;
+
+  if (ri > 0) {
+    numIntervals = (numMCUs + ri-1) / ri;
+    if (numIntervals > (int) starts.size())
+      numIntervals = (int) starts.size();
+  } else
+    ends[0] = ends.back();      // any restart markers are errors, found by the BitReader
+
+  parallelFor( numIntervals, d.numThreads, [&]( int i ) {
+    int first = (ri > 0 ? i * ri : 0);
+    int end   = (ri > 0 && i < numIntervals-1 ? first + ri : numMCUs);
+    decodeInterval( d, scan, first, end, in + starts[i], in + ends[i] );
+  } );
+
+  d.scanSeen = true;
+
+  return NULL;
+}
+
+
+
+// Dequantize and transform the coefficients of a progressive JPEG, a
+// row of blocks at a time
+
+static const char *transformCoefficients( JPEGDecoder &d )
+
+{
+  for (int i=0; i<d.numComponents; i++) {
+
+    JPEGComponent &c = d.comps[i];
+
+    if (!d.quantDefined[ c.quant ])
+      return "JPEG uses an undefined quantization table";
+
+    uint16_t q[64];
+
+    for (int k=0; k<64; k++)
+      q[ zigzag[k] ] = d.quant[ c.quant ][k];
+
+    int size = c.blockSize;
+
+    parallelFor( c.blocksY, d.numThreads, [&]( int by ) {
+
+      alignas(16) short block[64];
+
+      for (int bx=0; bx<c.blocksX; bx++) {
+
+	const short *coefs = c.coefs + ((size_t) by * c.blocksPerLine + bx) * 64;
+	bool dcOnly = true;
+
+	for (int k=0; k<64; k++) {
+	  block[k] = clamp16( coefs[k] * q[k] );
+	  if (k > 0 && coefs[k] != 0)
+	    dcOnly = false;
+	}
+
+	transformBlock( *d.k, block, dcOnly, size, c.plane + (size_t) by * size * c.stride + bx * size, c.stride );
+      }
+    } );
+  }
+
+  return NULL;
+}
+
+
+
+// Convert rows 'y0' to 'y1'-1 of the planes to RGB pixels at 'out',
+// 'width' pixels across
+
+static void convertRows( JPEGDecoder &d, unsigned char *out, int width, int y0, int y1 )
+
+{
+  const JPEGKernels &k = *d.k;
+  JPEGComponent *c = d.comps;
+
+  bool rgb = (d.adobeTransform == 0 || (d.adobeTransform < 0 && c[0].id == 'R' && c[1].id == 'G' && c[2].id == 'B'));
+
+  // Subsampled chroma is upsampled by the triangle filter if it is
+  // halved across, down or both, and Y is not subsampled
+
+  int hMax = d.scaledHMax;
+  int vMax = d.scaledVMax;
+
+  bool fancy = (d.numComponents == 3 && !rgb &&
+		c[0].scaledH == hMax && c[0].scaledV == vMax && c[1].scaledH == c[2].scaledH && c[1].scaledV == c[2].scaledV &&
+		(c[1].scaledH == hMax || 2 * c[1].scaledH == hMax) && (c[1].scaledV == vMax || 2 * c[1].scaledV == vMax));
+
+  int h2 = (fancy && c[1].scaledH < hMax);
+  int v2 = (fancy && c[1].scaledV < vMax);
+
+  int n = c[1].planeWidth;
+
+  std::vector<short> cbSum( n+2 ), crSum( n+2 );
+  std::vector<unsigned char> rows( 3 * width );
+
+  for (int y=y0; y<y1; y++) {
+
+    unsigned char *o = out + (size_t) y * width * 3;
+
+    if (fancy) {
+
+      const unsigned char *yRow = c[0].plane + (size_t) y * c[0].stride;
+
+      // The nearest chroma row, and the next nearest if halved down
+
+      int cy = (v2 ? y/2 : y);
+      int fy = cy;
+      if (v2)
+	fy = (y & 1 ? (cy+1 < c[1].planeHeight ? cy+1 : cy) : (cy > 0 ? cy-1 : 0));
+
+      const unsigned char *cbNear = c[1].plane + (size_t) cy * c[1].stride, *cbFar = c[1].plane + (size_t) fy * c[1].stride;
+      const unsigned char *crNear = c[2].plane + (size_t) cy * c[2].stride, *crFar = c[2].plane + (size_t) fy * c[2].stride;
+
+      if (h2) {
+	for (int x=0; x<n; x++) {
+	  cbSum[x+1] = (v2 ? 3 * cbNear[x] + cbFar[x] : 4 * cbNear[x]);
+	  crSum[x+1] = (v2 ? 3 * crNear[x] + crFar[x] : 4 * crNear[x]);
+	}
+	cbSum[0] = cbSum[1];
+	crSum[0] = crSum[1];
+	cbSum[n+1] = cbSum[n];
+	crSum[n+1] = crSum[n];
+
+	if (v2)
+	  k.colourH2( o, yRow, cbSum.data()+1, crSum.data()+1, width, 8, 7 );
+	else
+	  k.colourH2( o, yRow, cbSum.data()+1, crSum.data()+1, width, 4, 8 );
+
+      } else if (v2) {
+	int bias = (y & 1 ? 2 : 1);
+	unsigned char *cb = rows.data(), *cr = rows.data() + width;
+	for (int x=0; x<width; x++) {
+	  cb[x] = (3 * cbNear[x] + cbFar[x] + bias) >> 2;
+	  cr[x] = (3 * crNear[x] + crFar[x] + bias) >> 2;
+	}
+	k.colour( o, yRow, cb, cr, width );
+
+      } else
+	k.colour( o, yRow, cbNear, crNear, width );
+
+      continue;
+    }
+
+    // Otherwise the samples are replicated
+
+    const unsigned char *src[3];
+
+    for (int i=0; i<d.numComponents; i++) {
+      const unsigned char *p = c[i].plane + (size_t) (y * c[i].scaledV / vMax) * c[i].stride;
+      if (c[i].scaledH == hMax)
+	src[i] = p;
+      else {
+	unsigned char *r = rows.data() + i * width;
+	for (int x=0; x<width; x++)
+	  r[x] = p[ x * c[i].scaledH / hMax ];
+	src[i] = r;
+      }
+    }
+
+    if (d.numComponents == 1)
+      for (int x=0; x<width; x++)
+	o[3*x] = o[3*x+1] = o[3*x+2] = src[0][x];
+    else if (rgb)
+      for (int x=0; x<width; x++) {
+	o[3*x]   = src[0][x];
+	o[3*x+1] = src[1][x];
+	o[3*x+2] = src[2][x];
+      }
+    else
+      k.colour( o, src[0], src[1], src[2], width );
+  }
+}
+
+
+
+const char *decodeJPEG( unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha,
+			const unsigned char *in, size_t inSize, int shrink, int numThreads )
+
+{
+  if (inSize < 3 || in[0] != 0xff || in[1] != 0xd8)
+    return "not a JPEG file";
+
+  if (shrink != 1 && shrink != 2 && shrink != 4 && shrink != 8)
+    return "JPEGs can only be shrunk by 2, 4 or 8";
+
+  if (numThreads <= 0)
+    numThreads = std::thread::hardware_concurrency();
+  if (numThreads <= 0)
+    numThreads = 1;
+
+  JPEGDecoder *d = new JPEGDecoder();
+
+  d->shrink     = shrink;
+  d->numThreads = numThreads;
+  d->k          = &kernels[ jpegKernelSet ];
+
+  const char *error = NULL;
+  size_t p = 2;
+
+  // The segments, up to EOI.  A file that ends early keeps what has
+  // been decoded.
+
+  while (error == NULL && p < inSize) {
+
+    if (in[p] != 0xff) {        // junk between segments
+      p++;
+      continue;
+    }
+
+    while (p < inSize && in[p] == 0xff)
+      p++;
+
+    if (p >= inSize)
+      break;
+
+    int marker = in[p++];
+
+    if (marker == 0xd9)         // EOI
+      break;
+
+    if ((marker >= 0xd0 && marker <= 0xd7) || marker == 0x01 || marker == 0) // no length
+      continue;
+
+    if (p + 2 > inSize)
+      break;
+
+    size_t len = getBigEndian16( in+p );
+
+    if (len < 2 || p + len > inSize)
+      break;
+
+    const unsigned char *seg = in + p + 2;
+    len -= 2;
+    p += len + 2;
+
+    switch (marker) {
+    case 0xc0:                  // SOF0: baseline
+    case 0xc1:                  // SOF1: extended sequential
+      error = readFrameHeader( *d, seg, len, false );
+      break;
+    case 0xc2:                  // SOF2: progressive
+      error = readFrameHeader( *d, seg, len, true );
+      break;
+    case 0xc3:
+    case 0xc5: case 0xc6: case 0xc7:
+    case 0xc9: case 0xca: case 0xcb:
+    case 0xcd: case 0xce: case 0xcf:
+      error = "only baseline, extended and progressive JPEGs with Huffman coding are supported";
+      break;
+    case 0xc4:
+      error = readHuffmanTables( *d, seg, len );
+      break;
+    case 0xdb:
+      error = readQuantTables( *d, seg, len );
+      break;
+    case 0xdd:                  // DRI
+      if (len < 2)
+	error = "invalid JPEG restart interval";
+      else
+	d->restartInterval = getBigEndian16( seg );
+      break;
+    case 0xda:
+      error = readScan( *d, seg, len, in, inSize, p );
+      break;
+    case 0xee:                  // APP14, which says whether Adobe's 3 components are YCbCr
+      if (len >= 12 && memcmp( seg, "Adobe", 5 ) == 0)
+	d->adobeTransform = seg[11];
+      break;
+    default:                    // other APPn, COM, ...
+      break;
+    }
+  }
+
+  if (error == NULL && !d->scanSeen)
+    error = (d->frameSeen ? "JPEG has no image data" : "JPEG has no frame header");
+
+  if (error == NULL && d->progressive)
+    error = transformCoefficients( *d );
+
+  if (error != NULL) {
+    delete d;
+    return error;
+  }
+
+  // To RGB, in bands of rows
+
+  width  = (d->width  + shrink-1) / shrink;
+  height = (d->height + shrink-1) / shrink;
+
+  unsigned char *pixels = new (std::nothrow) unsigned char[ (size_t) width * height * 3 + RGB_PADDING ];
+
+  if (pixels == NULL) {
+    delete d;
+    return "not enough memory for the image";
+  }
+
+  int numBands = (height + BAND_ROWS-1) / BAND_ROWS;
+
+  parallelFor( numBands, numThreads, [&]( int band ) {
+    int y1 = (band+1) * BAND_ROWS;
+    convertRows( *d, pixels, width, band * BAND_ROWS, (y1 < (int) height ? y1 : height) );
+  } );
+
+  delete d;
+
+  *out     = pixels;
+  hasAlpha = false;
+
+  return NULL;
+}
@@ -0,0 +1,78 @@
+// jpegReader.h
+//
+// JPEG decoding to 8-bit RGB.
+//
+// Sequential (baseline and extended) and progressive JPEGs with
+// Huffman coding and 8-bit samples are decoded, if they are grey or
+// have three components (YCbCr, or RGB if an Adobe marker says so),
+// with any sampling factors:
+//
+//   - The entropy-coded data of a scan is cut at its restart markers,
+//     and the restart intervals are decoded in parallel, since each
+//     starts afresh.  A scan without restart markers is decoded on one
+//     thread.
+//
+//   - A sequential JPEG's blocks are dequantized and transformed as
+//     they are decoded.  A progressive JPEG's coefficients are kept
+//     until the last scan, and the blocks are then transformed in
+//     parallel.
+//
+//   - The inverse DCT is the IJG library's integer one, with 12-bit
+//     constants.  It is done on eight columns and then eight rows at
+//     once in SIMD registers.  Blocks with only a DC coefficient are
+//     filled directly.
+//
+//   - Chroma subsampled by 2 across (4:2:2), down (4:4:0) or both
+//     ways (4:2:0) is upsampled with the IJG "fancy" triangle filter,
+//     in whichever directions it is halved, in the same pass as the
+//     conversion from YCbCr to RGB, in 16-bit fixed point.  Other
+//     samplings, such as 4:1:1 and 4:1:0, replicate the chroma
+//     samples.
+//
+// With 'shrink' 2, 4 or 8 the image is decoded at 1/2, 1/4 or 1/8 of
+// its size, by transforming each block to 4x4 or 2x2 samples, or to
+// its DC coefficient alone.  As in the IJG library's jidctred.c, the
+// higher coefficients are folded into the smaller transforms, so each
+// sample is the average of the full-size samples that it covers.
+// Subsampled chroma is shrunk less, so that it still matches the
+// luma.  The Huffman decoding is the same, but everything after it is
+// 4 to 64 times less work, which makes for quick previews.
+//
+// Arithmetic coding, 12-bit samples, lossless and hierarchical JPEGs,
+// and CMYK are not supported.  Nor is the EXIF orientation.
+//
+// The kernels are chosen when the program starts, as the best set
+// that the processor can run.  Every set gives exactly the same bytes
+// as the scalar set.
+//
+// Define JPEG_NO_SIMD to use only the scalar kernels.
+
+
+#ifndef JPEG_READER_H
+#define JPEG_READER_H
+
+#include <cstddef>
+
+
+typedef enum { JPEG_SCALAR, JPEG_SSE2, NUM_JPEG_KERNEL_SETS } JPEGKernelSet;
+
+extern const char *jpegKernelSetNames[];
+
+extern JPEGKernelSet jpegKernelSet;   // the set in use, which can be changed for testing
+
+bool canUseJPEGKernelSet( JPEGKernelSet set );
+
+
+// Decode the JPEG file in 'in', reduced by 'shrink' (1, 2, 4 or 8) in
+// each dimension, rounding up.  The pixels are put in '*out', which is
+// allocated with new[] for the caller to own, and which has
+// RGB_PADDING spare bytes after the image, as a texmap does (see
+// image.h).  They are always RGB, so 'hasAlpha' is cleared.  Up to
+// 'numThreads' threads are used, or one per core if it is 0.  Returns
+// NULL on success, or a description of the error.
+
+const char *decodeJPEG( unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha,
+			const unsigned char *in, size_t inSize, int shrink = 1, int numThreads = 0 );
+
+
+#endif
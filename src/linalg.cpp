@@ -452,7 +452,7 @@ mat4 operator * ( float k, mat4 const& m )
   return out;
 }
 
-vec4 operator * ( mat4 const& m, vec4 const& v )
+vec4 multiplyReference( mat4 const& m, vec4 const& v )
 
 {
   vec4 out;
@@ -465,7 +465,7 @@ vec4 operator * ( mat4 const& m, vec4 const& v )
   return out;
 }
 
-mat4 operator * ( mat4 const& m, mat4 const& n )
+mat4 multiplyReference( mat4 const& m, mat4 const& n )
 
 {
   mat4 out;
@@ -487,7 +487,7 @@ mat4 operator * ( mat4 const& m, mat4 const& n )
 
 // Matrix inverse adapted from Mesa GLU implementation
 
-mat4 mat4::inverse()
+mat4 mat4::inverseReference()
 
 {
   mat4 inv;
@@ -636,6 +636,204 @@ mat4 mat4::inverse()
   return inv;
 }
 
+// Matrix inverse by Cramer's rule, four cofactors at a time.  This
+// follows Intel's "Streaming SIMD Extensions - Inverse of 4x4 Matrix"
+// (AP-928).  It needs only two shuffles: swapping the halves of a
+// vector and swapping adjacent pairs of elements.
+//
+// The cofactors are summed in a different order than in
+// inverseReference(), so the results can differ in the last bits.
+
+#if defined(LINALG_SSE)
+
+  typedef __m128 float4;
+
+  #define MUL4(a,b)       _mm_mul_ps( a, b )
+  #define ADD4(a,b)       _mm_add_ps( a, b )
+  #define SUB4(a,b)       _mm_sub_ps( a, b )
+  #define SWAP_HALVES(a)  _mm_shuffle_ps( a, a, _MM_SHUFFLE(1,0,3,2) )
+  #define SWAP_PAIRS(a)   _mm_shuffle_ps( a, a, _MM_SHUFFLE(2,3,0,1) )
+
+#elif defined(LINALG_NEON)
+
+  typedef float32x4_t float4;
+
+  #define MUL4(a,b)       vmulq_f32( a, b )
+  #define ADD4(a,b)       vaddq_f32( a, b )
+  #define SUB4(a,b)       vsubq_f32( a, b )
+  #define SWAP_HALVES(a)  vextq_f32( a, a, 2 )
+  #define SWAP_PAIRS(a)   vrev64q_f32( a )
+
+#endif
+
+
+mat4 mat4::inverse()
+
+{
+#if defined(LINALG_SSE) || defined(LINALG_NEON)
+
+  // Columns of the matrix, with the halves of columns 1 and 3 swapped
+
+  float4 row0, row1, row2, row3;
+
+#if defined(LINALG_SSE)
+  row0 = _mm_loadu_ps( &rows[0].x );
+  row1 = _mm_loadu_ps( &rows[1].x );
+  row2 = _mm_loadu_ps( &rows[2].x );
+  row3 = _mm_loadu_ps( &rows[3].x );
+  _MM_TRANSPOSE4_PS( row0, row1, row2, row3 );
+#else
+  float32x4x4_t columns = vld4q_f32( &rows[0].x );
+  row0 = columns.val[0];
+  row1 = columns.val[1];
+  row2 = columns.val[2];
+  row3 = columns.val[3];
+#endif
+
+  row1 = SWAP_HALVES( row1 );
+  row3 = SWAP_HALVES( row3 );
+
+  float4 minor0, minor1, minor2, minor3, tmp;
+
+  tmp    = SWAP_PAIRS( MUL4( row2, row3 ) );
+  minor0 = MUL4( row1, tmp );
+  minor1 = MUL4( row0, tmp );
+  tmp    = SWAP_HALVES( tmp );
+  minor0 = SUB4( MUL4( row1, tmp ), minor0 );
+  minor1 = SUB4( MUL4( row0, tmp ), minor1 );
+  minor1 = SWAP_HALVES( minor1 );
+
+  tmp    = SWAP_PAIRS( MUL4( row1, row2 ) );
+  minor0 = ADD4( MUL4( row3, tmp ), minor0 );
+  minor3 = MUL4( row0, tmp );
+  tmp    = SWAP_HALVES( tmp );
+  minor0 = SUB4( minor0, MUL4( row3, tmp ) );
+  minor3 = SUB4( MUL4( row0, tmp ), minor3 );
+  minor3 = SWAP_HALVES( minor3 );
+
+  tmp    = SWAP_PAIRS( MUL4( SWAP_HALVES( row1 ), row3 ) );
+  row2   = SWAP_HALVES( row2 );
+  minor0 = ADD4( MUL4( row2, tmp ), minor0 );
+  minor2 = MUL4( row0, tmp );
+  tmp    = SWAP_HALVES( tmp );
+  minor0 = SUB4( minor0, MUL4( row2, tmp ) );
+  minor2 = SUB4( MUL4( row0, tmp ), minor2 );
+  minor2 = SWAP_HALVES( minor2 );
+
+  tmp    = SWAP_PAIRS( MUL4( row0, row1 ) );
+  minor2 = ADD4( MUL4( row3, tmp ), minor2 );
+  minor3 = SUB4( MUL4( row2, tmp ), minor3 );
+  tmp    = SWAP_HALVES( tmp );
+  minor2 = SUB4( MUL4( row3, tmp ), minor2 );
+  minor3 = SUB4( minor3, MUL4( row2, tmp ) );
+
+  tmp    = SWAP_PAIRS( MUL4( row0, row3 ) );
+  minor1 = SUB4( minor1, MUL4( row2, tmp ) );
+  minor2 = ADD4( MUL4( row1, tmp ), minor2 );
+  tmp    = SWAP_HALVES( tmp );
+  minor1 = ADD4( MUL4( row2, tmp ), minor1 );
+  minor2 = SUB4( minor2, MUL4( row1, tmp ) );
+
+  tmp    = SWAP_PAIRS( MUL4( row0, row2 ) );
+  minor1 = ADD4( MUL4( row3, tmp ), minor1 );
+  minor3 = SUB4( minor3, MUL4( row1, tmp ) );
+  tmp    = SWAP_HALVES( tmp );
+  minor1 = SUB4( minor1, MUL4( row3, tmp ) );
+  minor3 = ADD4( MUL4( row1, tmp ), minor3 );
+
+  // The minors are the rows of the adjugate
+
+  mat4 inv;
+
+#if defined(LINALG_SSE)
+  _mm_storeu_ps( &inv.rows[0].x, minor0 );
+  _mm_storeu_ps( &inv.rows[1].x, minor1 );
+  _mm_storeu_ps( &inv.rows[2].x, minor2 );
+  _mm_storeu_ps( &inv.rows[3].x, minor3 );
+#else
+  vst1q_f32( &inv.rows[0].x, minor0 );
+  vst1q_f32( &inv.rows[1].x, minor1 );
+  vst1q_f32( &inv.rows[2].x, minor2 );
+  vst1q_f32( &inv.rows[3].x, minor3 );
+#endif
+
+  float det = rows[0][0] * inv.rows[0][0] + rows[0][1] * inv.rows[1][0] + rows[0][2] * inv.rows[2][0] + rows[0][3] * inv.rows[3][0];
+
+  if (det == 0) {
+    std::cerr << "Matrix has no inverse" << std::endl;
+    exit(1);
+  }
+
+  return (1.0f / det) * inv;
+
+#else
+  return inverseReference();
+#endif
+}
+
+
+
+// Transform 'n' points stored as separate coordinate arrays
+
+void transformPoints( mat4 const& m, int n, float const *x, float const *y, float const *z,
+		      float *xOut, float *yOut, float *zOut, float *wOut )
+
+{
+  int i = 0;
+
+#if defined(LINALG_SSE) || defined(LINALG_NEON)
+
+#if defined(LINALG_SSE)
+  #define LOAD4(p)      _mm_loadu_ps( p )
+  #define STORE4(p,a)   _mm_storeu_ps( p, a )
+  #define SPLAT4(k)     _mm_set1_ps( k )
+#else
+  #define LOAD4(p)      vld1q_f32( p )
+  #define STORE4(p,a)   vst1q_f32( p, a )
+  #define SPLAT4(k)     vdupq_n_f32( k )
+#endif
+
+  // Four points at a time.  Each output coordinate is
+  // m[j][0]*x + m[j][1]*y + m[j][2]*z + m[j][3], as in 'm * v'.
+
+  float *out[4] = { xOut, yOut, zOut, wOut };
+  int nRows = (wOut != NULL ? 4 : 3);
+
+  for (; i+4<=n; i+=4) {
+
+    float4 px = LOAD4( x+i );
+    float4 py = LOAD4( y+i );
+    float4 pz = LOAD4( z+i );
+
+    for (int j=0; j<nRows; j++) {
+      float4 sum = MUL4( SPLAT4( m.rows[j].x ), px );
+      sum = ADD4( sum, MUL4( SPLAT4( m.rows[j].y ), py ) );
+      sum = ADD4( sum, MUL4( SPLAT4( m.rows[j].z ), pz ) );
+      sum = ADD4( sum, SPLAT4( m.rows[j].w ) );
+      STORE4( out[j]+i, sum );
+    }
+  }
+
+  #undef LOAD4
+  #undef STORE4
+  #undef SPLAT4
+
+#endif
+
+  // Remaining points
+
+  for (; i<n; i++) {
+    vec4 p = multiplyReference( m, vec4( x[i], y[i], z[i], 1 ) );
+    xOut[i] = p.x;
+    yOut[i] = p.y;
+    zOut[i] = p.z;
+    if (wOut != NULL)
+      wOut[i] = p.w;
+  }
+}
+
+
+
 mat4 scale( float x, float y, float z )
 
 {
@@ -843,3 +1041,104 @@ std::istream& operator >> ( std::istream& stream, mat4 & m )
 
   return stream;
 }
+
+
+
+// ---------------- affine2d ----------------
+
+
+affine2d operator * ( affine2d const& m, affine2d const& n )
+
+{
+  return affine2d( m.a * n.a  + m.b * n.c,
+		   m.a * n.b  + m.b * n.d,
+		   m.a * n.tx + m.b * n.ty + m.tx,
+		   m.c * n.a  + m.d * n.c,
+		   m.c * n.b  + m.d * n.d,
+		   m.c * n.tx + m.d * n.ty + m.ty );
+}
+
+vec2 operator * ( affine2d const& m, vec2 const& v )
+
+{
+  return vec2( m.a * v.x + m.b * v.y + m.tx,
+	       m.c * v.x + m.d * v.y + m.ty );
+}
+
+affine2d affine2d::inverse() const
+
+{
+  double detInv = 1.0 / determinant();
+
+  double ia =  detInv * d;
+  double ib = -detInv * b;
+  double ic = -detInv * c;
+  double id =  detInv * a;
+
+  return affine2d( ia, ib, -(ia * tx + ib * ty),
+		   ic, id, -(ic * tx + id * ty) );
+}
+
+mat4 affine2d::toMat4() const
+
+{
+  mat4 out;
+
+  out.rows[0] = vec4( a, b, 0, tx );
+  out.rows[1] = vec4( c, d, 0, ty );
+  out.rows[2] = vec4( 0, 0, 1, 0 );
+  out.rows[3] = vec4( 0, 0, 0, 1 );
+
+  return out;
+}
+
+affine2d identity2d()
+
+{
+  return affine2d( 1, 0, 0,
+		   0, 1, 0 );
+}
+
+affine2d scale2d( double x, double y )
+
+{
+  return affine2d( x, 0, 0,
+		   0, y, 0 );
+}
+
+affine2d translate2d( double x, double y )
+
+{
+  return affine2d( 1, 0, x,
+		   0, 1, y );
+}
+
+affine2d rotate2d( double theta )
+
+{
+  double c = cos(theta);
+  double s = sin(theta);
+
+  return affine2d( c, -s, 0,
+		   s,  c, 0 );
+}
+
+
+// I/O operators
+
+std::ostream& operator << ( std::ostream& stream, affine2d const& m )
+
+{
+  stream << m.a << " " << m.b << " " << m.tx << std::endl
+	 << m.c << " " << m.d << " " << m.ty << std::endl;
+
+  return stream;
+}
+
+std::istream& operator >> ( std::istream& stream, affine2d & m )
+
+{
+  stream >> m.a >> m.b >> m.tx >> m.c >> m.d >> m.ty;
+
+  return stream;
+}
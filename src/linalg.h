@@ -7,11 +7,25 @@
 
 #include <iostream>
 #include <cmath>
+#include <cstddef>
 
 #ifdef _WIN32
   #pragma warning(disable : 4244 4305 4996)
 #endif
 
+// mat4 products and inverse use SSE on x86 and NEON on 64-bit ARM.
+// Define LINALG_NO_SIMD to use the portable reference code instead.
+
+#ifndef LINALG_NO_SIMD
+  #if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define LINALG_SSE
+    #include <xmmintrin.h>
+  #elif defined(__ARM_NEON) && defined(__aarch64__)
+    #define LINALG_NEON
+    #include <arm_neon.h>
+  #endif
+#endif
+
 
 class mat4;
 class vec4;
@@ -342,6 +356,7 @@ public:
 
   mat4() {}
   mat4 inverse();
+  mat4 inverseReference();
 
   float *data() {
     return & rows[0][0];
@@ -360,10 +375,109 @@ std::istream& operator >> ( std::istream& stream, mat4 & m );
 // operations
 
 mat4 operator * (       float k, mat4 const& m );
-vec4 operator * ( mat4 const& m, vec4 const& v );
-mat4 operator * ( mat4 const& m, mat4 const& n );
 mat4 identity4();
 
+// Portable versions of the products below.  The SIMD versions add
+// the terms in the same order, so they give identical results.
+
+vec4 multiplyReference( mat4 const& m, vec4 const& v );
+mat4 multiplyReference( mat4 const& m, mat4 const& n );
+
+inline vec4 operator * ( mat4 const& m, vec4 const& v )
+
+{
+#if defined(LINALG_SSE)
+
+  // Multiply each row by v, transpose, and sum the columns
+
+  __m128 v4 = _mm_loadu_ps( &v.x );
+
+  __m128 r0 = _mm_mul_ps( _mm_loadu_ps( &m.rows[0].x ), v4 );
+  __m128 r1 = _mm_mul_ps( _mm_loadu_ps( &m.rows[1].x ), v4 );
+  __m128 r2 = _mm_mul_ps( _mm_loadu_ps( &m.rows[2].x ), v4 );
+  __m128 r3 = _mm_mul_ps( _mm_loadu_ps( &m.rows[3].x ), v4 );
+
+  _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+
+  vec4 out;
+  _mm_storeu_ps( &out.x, _mm_add_ps( _mm_add_ps( _mm_add_ps( r0, r1 ), r2 ), r3 ) );
+  return out;
+
+#elif defined(LINALG_NEON)
+
+  // Load the columns and sum them, weighted by v
+
+  float32x4x4_t c = vld4q_f32( &m.rows[0].x );
+
+  float32x4_t sum = vmulq_n_f32( c.val[0], v.x );
+  sum = vaddq_f32( sum, vmulq_n_f32( c.val[1], v.y ) );
+  sum = vaddq_f32( sum, vmulq_n_f32( c.val[2], v.z ) );
+  sum = vaddq_f32( sum, vmulq_n_f32( c.val[3], v.w ) );
+
+  vec4 out;
+  vst1q_f32( &out.x, sum );
+  return out;
+
+#else
+  return multiplyReference( m, v );
+#endif
+}
+
+inline mat4 operator * ( mat4 const& m, mat4 const& n )
+
+{
+#if defined(LINALG_SSE)
+
+  // Row i of the product is the sum of n's rows, weighted by row i of m
+
+  __m128 n0 = _mm_loadu_ps( &n.rows[0].x );
+  __m128 n1 = _mm_loadu_ps( &n.rows[1].x );
+  __m128 n2 = _mm_loadu_ps( &n.rows[2].x );
+  __m128 n3 = _mm_loadu_ps( &n.rows[3].x );
+
+  mat4 out;
+
+  for (int i=0; i<4; i++) {
+    __m128 sum = _mm_mul_ps( _mm_set1_ps( m.rows[i].x ), n0 );
+    sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( m.rows[i].y ), n1 ) );
+    sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( m.rows[i].z ), n2 ) );
+    sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( m.rows[i].w ), n3 ) );
+    _mm_storeu_ps( &out.rows[i].x, sum );
+  }
+
+  return out;
+
+#elif defined(LINALG_NEON)
+
+  float32x4_t n0 = vld1q_f32( &n.rows[0].x );
+  float32x4_t n1 = vld1q_f32( &n.rows[1].x );
+  float32x4_t n2 = vld1q_f32( &n.rows[2].x );
+  float32x4_t n3 = vld1q_f32( &n.rows[3].x );
+
+  mat4 out;
+
+  for (int i=0; i<4; i++) {
+    float32x4_t sum = vmulq_n_f32( n0, m.rows[i].x );
+    sum = vaddq_f32( sum, vmulq_n_f32( n1, m.rows[i].y ) );
+    sum = vaddq_f32( sum, vmulq_n_f32( n2, m.rows[i].z ) );
+    sum = vaddq_f32( sum, vmulq_n_f32( n3, m.rows[i].w ) );
+    vst1q_f32( &out.rows[i].x, sum );
+  }
+
+  return out;
+
+#else
+  return multiplyReference( m, n );
+#endif
+}
+
+// Transform 'n' points (x[i],y[i],z[i],1) by 'm'.  The points are
+// stored as separate arrays of coordinates so that four can be done
+// at once.  'wOut' may be NULL if the transform is affine.
+
+void transformPoints( mat4 const& m, int n, float const *x, float const *y, float const *z,
+		      float *xOut, float *yOut, float *zOut, float *wOut = NULL );
+
 mat4 scale( float x, float y, float z );
 mat4 translate( float x, float y, float z );
 mat4 translate( vec3 v );
@@ -379,4 +493,56 @@ mat4 lookat( vec3 eye, vec3 centre, vec3 up );
 std::ostream& operator << ( std::ostream& stream, mat4 const& m );
 std::istream& operator >> ( std::istream& stream, mat4 & m );
 
+
+// ---------------- affine2d ----------------
+//
+// A 2D affine transform
+//
+//    | x' |   | a  b  tx | | x |
+//    | y' | = | c  d  ty | | y |
+//                          | 1 |
+//
+// The coefficients are doubles so that a transform accumulated over
+// many compositions does not drift.
+
+
+class affine2d {
+
+public:
+
+  double a, b, tx;
+  double c, d, ty;
+
+  affine2d() {}
+
+  affine2d( double aa, double bb, double ttx, double cc, double dd, double tty ) {
+    a = aa; b = bb; tx = ttx;
+    c = cc; d = dd; ty = tty;
+  }
+
+  double determinant() const {
+    return a * d - b * c;
+  }
+
+  affine2d inverse() const;
+
+  mat4 toMat4() const;
+};
+
+
+// operations
+
+affine2d operator * ( affine2d const& m, affine2d const& n ); // n, then m
+vec2     operator * ( affine2d const& m, vec2 const& v );
+affine2d identity2d();
+
+affine2d scale2d( double x, double y );
+affine2d translate2d( double x, double y );
+affine2d rotate2d( double theta ); // theta in radians, counterclockwise
+
+// I/O operators
+
+std::ostream& operator << ( std::ostream& stream, affine2d const& m );
+std::istream& operator >> ( std::istream& stream, affine2d & m );
+
 #endif
@@ -15,10 +15,21 @@ Editor     *editor;	 // code to edit image
 
 #define IMAGE_BORDER 50  // border around image
 
+#define IDLE_WAIT_TIMEOUT 0.5 // maximum seconds to sleep while waiting for events
+
 
 vec2 currentMousePosition;
 bool mousePositionChanged;
 
+bool redisplayNeeded = true; // true if the window must be redrawn
+
+
+void postRedisplay()
+
+{
+  redisplayNeeded = true;
+}
+
 
 // Handle a keypress and record the state (UP or DOWN) of the arrows
 
@@ -66,6 +77,17 @@ void framebufferReshapeCallback( GLFWwindow* window, int width, int height )
 
 {
   glViewport( 0, 0, width, height );
+  postRedisplay();
+}
+
+
+
+// Callback for when the window contents are damaged and must be redrawn
+
+void windowRefreshCallback( GLFWwindow* window )
+
+{
+  postRedisplay();
 }
 
 
@@ -134,6 +156,8 @@ int main( int argc, char **argv )
     exit(1);
   }
 
+  Image::useRawCache = true; // reopening the same image is then much faster
+
   Texture *image = new Texture( argv[1] );
 
   // Trap all errors (do this *before* creating the window)
@@ -176,6 +200,7 @@ int main( int argc, char **argv )
 
   glfwSetWindowSizeCallback( window, windowReshapeCallback );
   glfwSetFramebufferSizeCallback( window, framebufferReshapeCallback );
+  glfwSetWindowRefreshCallback( window, windowRefreshCallback );
   glfwSetKeyCallback( window, keyCallback );
   glfwSetMouseButtonCallback( window, mouseButtonCallback );
 
@@ -186,18 +211,37 @@ int main( int argc, char **argv )
   editor = new Editor( image );
 
   // Main loop
+  //
+  // The window is redrawn only when something has called
+  // postRedisplay().  Otherwise the loop sleeps until an event
+  // arrives, so an idle editor uses no CPU.
 
   while (!glfwWindowShouldClose( window )) {
 
-    // Clear, display, and check for events
+    // Pick up any image that the editor finished in the background
+
+    editor->update();
+
+    // Clear and display if needed
+
+    if (redisplayNeeded) {
 
-    glClearColor( 1, 1, 1, 1 );	// white background
-    glClear( GL_COLOR_BUFFER_BIT );
+      redisplayNeeded = false;
+
+      glClearColor( 1, 1, 1, 1 );	// white background
+      glClear( GL_COLOR_BUFFER_BIT );
     
-    canvas->draw();
+      canvas->draw();
       
-    glfwSwapBuffers( window );
-    glfwPollEvents();
+      glfwSwapBuffers( window );
+    }
+
+    // Check for events, waiting for them if there's nothing else to do
+
+    if (redisplayNeeded || mousePositionChanged)
+      glfwPollEvents();
+    else
+      glfwWaitEventsTimeout( IDLE_WAIT_TIMEOUT );
 
     // Inform the editor if the mouse moved.
 
@@ -214,6 +258,8 @@ int main( int argc, char **argv )
 
   // Clean up
 
+  delete editor; // stops the editor's background thread
+
   glfwDestroyWindow( window );
   glfwTerminate();
 
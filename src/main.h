@@ -18,4 +18,9 @@ extern KeyState upKey, downKey, leftKey, rightKey, spaceBar;
 
 extern int screenWidth, screenHeight;
 
+// Request that the window be redrawn.  The main loop redraws only
+// after this has been called and otherwise sleeps waiting for events.
+
+void postRedisplay();
+
 #endif
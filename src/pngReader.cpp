@@ -0,0 +1,901 @@
+// pngReader.cpp
+//
+// See the PNG specification, sections 9 (filtering) and 11 (chunks).
+
+
+#include "pngReader.h"
+#include "image.h"
+#include "inflate.h"
+#include "lodepng.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#ifndef PNG_NO_SIMD
+  #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define PNG_USE_SSE2
+    #include <emmintrin.h>
+    #include <tmmintrin.h>      // only used in functions compiled for SSSE3
+    #if defined(_MSC_VER)
+      #include <intrin.h>
+      #define TARGET_SSSE3
+    #else
+      #define TARGET_SSSE3 __attribute__((target("ssse3")))
+    #endif
+  #endif
+#endif
+
+// The pixels end at least INFLATE_MARGIN bytes before the end of the
+// buffer that they are decoded in, which is then the texmap's padding
+
+#if INFLATE_MARGIN < RGB_PADDING
+  #error "INFLATE_MARGIN does not cover RGB_PADDING"
+#endif
+
+
+const char *pngKernelSetNames[] = { "scalar", "SSE2", "SSSE3" };
+
+
+
+// ---------------- Kernels ----------------
+
+
+// The filters are reversed in place.  'prev' is the previous
+// unfiltered scanline; the first scanline is handled separately, so
+// it is never NULL here.  'n' is a multiple of 'bpp'.
+
+typedef void (*SubFn)( unsigned char *row, size_t n, int bpp );
+typedef void (*UnfilterFn)( unsigned char *row, const unsigned char *prev, size_t n, int bpp );
+typedef void (*ExpandFn)( unsigned char *out, const unsigned char *in, size_t numPixels );
+
+struct PNGKernels {
+  SubFn      sub;
+  UnfilterFn up, average, paeth;
+  ExpandFn   greyToRGB, greyAlphaToRGBA, rgbToRGBA;
+};
+
+
+// Scalar
+
+static void subScalar( unsigned char *row, size_t n, int bpp )
+
+{
+  for (size_t i=bpp; i<n; i++)
+    row[i] += row[i-bpp];
+}
+
+
+static void upScalar( unsigned char *row, const unsigned char *prev, size_t n, int bpp )
+
+{
+  for (size_t i=0; i<n; i++)
+    row[i] += prev[i];
+}
+
+
+static void averageScalar( unsigned char *row, const unsigned char *prev, size_t n, int bpp )
+
+{
+  for (int i=0; i<bpp; i++)
+    row[i] += prev[i] >> 1;
+
+  for (size_t i=bpp; i<n; i++)
+    row[i] += (row[i-bpp] + prev[i]) >> 1;
+}
+
+
+static void averageFirstScalar( unsigned char *row, size_t n, int bpp )
+
+{
+  for (size_t i=bpp; i<n; i++)
+    row[i] += row[i-bpp] >> 1;
+}
+
+
+// The Paeth predictor: whichever of left (a), above (b) and above-left
+// (c) is closest to a+b-c, preferring a, then b.
+
+static inline unsigned char paethPredictor( int a, int b, int c )
+
+{
+  int pa = abs( b - c );
+  int pb = abs( a - c );
+  int pc = abs( a + b - 2*c );
+
+  if (pa <= pb && pa <= pc)
+    return a;
+  else if (pb <= pc)
+    return b;
+  else
+    return c;
+}
+
+
+static void paethScalar( unsigned char *row, const unsigned char *prev, size_t n, int bpp )
+
+{
+  for (int i=0; i<bpp; i++)
+    row[i] += prev[i];          // a = c = 0, so b is the prediction
+
+  for (size_t i=bpp; i<n; i++)
+    row[i] += paethPredictor( row[i-bpp], prev[i], prev[i-bpp] );
+}
+
+
+static void greyAlphaToRGBAScalar( unsigned char *out, const unsigned char *in, size_t numPixels )
+
+{
+  for (size_t i=0; i<numPixels; i++) {
+    out[0] = out[1] = out[2] = in[0];
+    out[3] = in[1];
+    in  += 2;
+    out += 4;
+  }
+}
+
+
+static void greyToRGBScalar( unsigned char *out, const unsigned char *in, size_t numPixels )
+
+{
+  for (size_t i=0; i<numPixels; i++) {
+    out[0] = out[1] = out[2] = in[i];
+    out += 3;
+  }
+}
+
+
+static void rgbToRGBAScalar( unsigned char *out, const unsigned char *in, size_t numPixels )
+
+{
+  for (size_t i=0; i<numPixels; i++) {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+    out[3] = 255;
+    in  += 3;
+    out += 4;
+  }
+}
+
+
+// Palette indices are looked up in a table of whole RGBA pixels, so
+// each pixel is one load and one store.  This is the same for every
+// kernel set: x86 has no byte gather that would do better.
+
+static void paletteToRGBA( unsigned char *out, const unsigned char *in, size_t numPixels, const unsigned int *palette )
+
+{
+  for (size_t i=0; i<numPixels; i++)
+    memcpy( out + 4*i, &palette[in[i]], 4 );
+}
+
+
+// For an opaque palette.  Each store is 4 bytes, and the next pixel
+// overwrites the extra byte, except at the end of the row.
+
+static void paletteToRGB( unsigned char *out, const unsigned char *in, size_t numPixels, const unsigned int *palette )
+
+{
+  size_t i = 0;
+
+  for (; i+1 < numPixels; i++)
+    memcpy( out + 3*i, &palette[in[i]], 4 );
+
+  if (i < numPixels)
+    memcpy( out + 3*i, &palette[in[i]], 3 );
+}
+
+
+#ifdef PNG_USE_SSE2
+
+// One pixel of 3 or 4 bytes in the low lanes of a register.  The
+// memcpy keeps a 3-byte pixel from touching the next one.
+
+template <int BPP> static inline __m128i loadPixel( const unsigned char *p )
+
+{
+  unsigned int v = 0;
+  memcpy( &v, p, BPP );
+  return _mm_cvtsi32_si128( (int) v );
+}
+
+
+template <int BPP> static inline void storePixel( unsigned char *p, __m128i x )
+
+{
+  unsigned int v = (unsigned int) _mm_cvtsi128_si32( x );
+  memcpy( p, &v, BPP );
+}
+
+
+// Sub, a pixel at a time
+
+template <int BPP> static void subPixelsSSE2( unsigned char *row, size_t n )
+
+{
+  __m128i a = _mm_setzero_si128();
+
+  for (size_t i=0; i<n; i+=BPP) {
+    a = _mm_add_epi8( a, loadPixel<BPP>( row+i ) );
+    storePixel<BPP>( row+i, a );
+  }
+}
+
+
+// With 4-byte pixels, four pixels are done at once as a prefix sum
+// across the register, plus the last pixel of the previous four.
+
+static void sub4SSE2( unsigned char *row, size_t n )
+
+{
+  __m128i last = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i+16 <= n; i+=16) {
+    __m128i x = _mm_loadu_si128( (const __m128i *) (row+i) );
+    x = _mm_add_epi8( x, _mm_slli_si128( x, 4 ) );
+    x = _mm_add_epi8( x, _mm_slli_si128( x, 8 ) );
+    x = _mm_add_epi8( x, _mm_shuffle_epi32( last, 0xff ) );
+    _mm_storeu_si128( (__m128i *) (row+i), x );
+    last = x;
+  }
+
+  for (size_t j=(i > 0 ? i : 4); j<n; j++)
+    row[j] += row[j-4];
+}
+
+
+static void subSSE2( unsigned char *row, size_t n, int bpp )
+
+{
+  if (bpp == 4)
+    sub4SSE2( row, n );
+  else if (bpp == 3)
+    subPixelsSSE2<3>( row, n );
+  else
+    subScalar( row, n, bpp );
+}
+
+
+static void upSSE2( unsigned char *row, const unsigned char *prev, size_t n, int bpp )
+
+{
+  size_t i = 0;
+
+  for (; i+16 <= n; i+=16) {
+    __m128i x = _mm_loadu_si128( (const __m128i *) (row+i) );
+    __m128i b = _mm_loadu_si128( (const __m128i *) (prev+i) );
+    _mm_storeu_si128( (__m128i *) (row+i), _mm_add_epi8( x, b ) );
+  }
+
+  for (; i<n; i++)
+    row[i] += prev[i];
+}
+
+
+// Average.  pavgb rounds up, so one is taken off where a+b is odd.
+
+template <int BPP> static void averagePixelsSSE2( unsigned char *row, const unsigned char *prev, size_t n )
+
+{
+  const __m128i ones = _mm_set1_epi8( 1 );
+  __m128i a = _mm_setzero_si128();
+
+  for (size_t i=0; i<n; i+=BPP) {
+    __m128i b   = loadPixel<BPP>( prev+i );
+    __m128i avg = _mm_sub_epi8( _mm_avg_epu8( a, b ), _mm_and_si128( _mm_xor_si128( a, b ), ones ) );
+    a = _mm_add_epi8( loadPixel<BPP>( row+i ), avg );
+    storePixel<BPP>( row+i, a );
+  }
+}
+
+
+static void averageSSE2( unsigned char *row, const unsigned char *prev, size_t n, int bpp )
+
+{
+  if (bpp == 4)
+    averagePixelsSSE2<4>( row, prev, n );
+  else if (bpp == 3)
+    averagePixelsSSE2<3>( row, prev, n );
+  else
+    averageScalar( row, prev, n, bpp );
+}
+
+
+// Paeth, in 16-bit lanes.  With p = a+b-c:
+//
+//   |p-a| = |b-c|,  |p-b| = |a-c|,  |p-c| = |(b-c) + (a-c)|
+//
+// The smallest distance is found, and the prediction is a if that is
+// |p-a|, else b if it is |p-b|, else c.  So ties go as in the
+// specification.
+
+static inline __m128i select16( __m128i mask, __m128i x, __m128i y )
+
+{
+  return _mm_or_si128( _mm_and_si128( mask, x ), _mm_andnot_si128( mask, y ) );
+}
+
+
+template <int BPP> static void paethPixelsSSE2( unsigned char *row, const unsigned char *prev, size_t n )
+
+{
+  const __m128i zero     = _mm_setzero_si128();
+  const __m128i lowBytes = _mm_set1_epi16( 0x00ff );
+  __m128i a = zero, c = zero;
+
+  for (size_t i=0; i<n; i+=BPP) {
+    __m128i b = _mm_unpacklo_epi8( loadPixel<BPP>( prev+i ), zero );
+
+    __m128i pa = _mm_sub_epi16( b, c );
+    __m128i pb = _mm_sub_epi16( a, c );
+    __m128i pc = _mm_add_epi16( pa, pb );
+
+    pa = _mm_max_epi16( pa, _mm_sub_epi16( zero, pa ) );
+    pb = _mm_max_epi16( pb, _mm_sub_epi16( zero, pb ) );
+    pc = _mm_max_epi16( pc, _mm_sub_epi16( zero, pc ) );
+
+    __m128i smallest = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+    __m128i nearest  = select16( _mm_cmpeq_epi16( smallest, pa ), a,
+				 select16( _mm_cmpeq_epi16( smallest, pb ), b, c ) );
+
+    a = _mm_and_si128( _mm_add_epi16( _mm_unpacklo_epi8( loadPixel<BPP>( row+i ), zero ), nearest ), lowBytes );
+    storePixel<BPP>( row+i, _mm_packus_epi16( a, a ) );
+
+    c = b;
+  }
+}
+
+
+static void paethSSE2( unsigned char *row, const unsigned char *prev, size_t n, int bpp )
+
+{
+  if (bpp == 4)
+    paethPixelsSSE2<4>( row, prev, n );
+  else if (bpp == 3)
+    paethPixelsSSE2<3>( row, prev, n );
+  else
+    paethScalar( row, prev, n, bpp );
+}
+
+
+// Grey+alpha: 8 pixels at a time.  Each g,a pair is a 16-bit lane, and
+// a copy with g in both bytes is interleaved with it.
+
+static void greyAlphaToRGBASSE2( unsigned char *out, const unsigned char *in, size_t numPixels )
+
+{
+  const __m128i lowBytes = _mm_set1_epi16( 0x00ff );
+  size_t i = 0;
+
+  for (; i+8 <= numPixels; i+=8) {
+    __m128i ga = _mm_loadu_si128( (const __m128i *) (in + 2*i) );
+    __m128i g  = _mm_and_si128( ga, lowBytes );
+    __m128i gg = _mm_or_si128( g, _mm_slli_epi16( g, 8 ) );
+    _mm_storeu_si128( (__m128i *) (out + 4*i),      _mm_unpacklo_epi16( gg, ga ) );
+    _mm_storeu_si128( (__m128i *) (out + 4*i + 16), _mm_unpackhi_epi16( gg, ga ) );
+  }
+
+  greyAlphaToRGBAScalar( out + 4*i, in + 2*i, numPixels-i );
+}
+
+
+// RGB: 4 pixels at a time, from a 16-byte load shifted by 0, 3, 6 and
+// 9 bytes.  The load reads 4 bytes past the 4 pixels, so it stops 6
+// pixels from the end.
+
+static void rgbToRGBASSE2( unsigned char *out, const unsigned char *in, size_t numPixels )
+
+{
+  const __m128i opaque = _mm_set1_epi32( (int) 0xff000000 );
+  size_t i = 0;
+
+  for (; i+6 <= numPixels; i+=4) {
+    __m128i x  = _mm_loadu_si128( (const __m128i *) (in + 3*i) );
+    __m128i p01 = _mm_unpacklo_epi32( x, _mm_srli_si128( x, 3 ) );
+    __m128i p23 = _mm_unpacklo_epi32( _mm_srli_si128( x, 6 ), _mm_srli_si128( x, 9 ) );
+    _mm_storeu_si128( (__m128i *) (out + 4*i), _mm_or_si128( _mm_unpacklo_epi64( p01, p23 ), opaque ) );
+  }
+
+  rgbToRGBAScalar( out + 4*i, in + 3*i, numPixels-i );
+}
+
+
+// SSSE3 has pabsw for Paeth and pshufb for moving bytes around.
+
+TARGET_SSSE3 static void sub3SSSE3( unsigned char *row, size_t n )
+
+{
+  // Five pixels at a time, as a prefix sum across the register plus
+  // the last pixel of the previous five
+
+  const __m128i lastPixel = _mm_setr_epi8( 12, 13, 14, 12, 13, 14, 12, 13, 14, 12, 13, 14, 12, 13, 14, -1 );
+
+  __m128i last = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i+16 <= n; i+=15) {
+    __m128i x = _mm_loadu_si128( (const __m128i *) (row+i) );
+    x = _mm_add_epi8( x, _mm_slli_si128( x, 3 ) );
+    x = _mm_add_epi8( x, _mm_slli_si128( x, 6 ) );
+    x = _mm_add_epi8( x, _mm_slli_si128( x, 12 ) );
+    x = _mm_add_epi8( x, _mm_shuffle_epi8( last, lastPixel ) );
+
+    // Store 15 bytes: the 16th belongs to the next pixel, which is
+    // not done yet
+
+    _mm_storel_epi64( (__m128i *) (row+i), x );
+    unsigned char high[8];
+    _mm_storel_epi64( (__m128i *) high, _mm_srli_si128( x, 8 ) );
+    memcpy( row+i+8, high, 7 );
+
+    last = x;
+  }
+
+  for (size_t j=(i > 0 ? i : 3); j<n; j++)
+    row[j] += row[j-3];
+}
+
+
+TARGET_SSSE3 static void subSSSE3( unsigned char *row, size_t n, int bpp )
+
+{
+  if (bpp == 3)
+    sub3SSSE3( row, n );
+  else
+    subSSE2( row, n, bpp );
+}
+
+
+template <int BPP> TARGET_SSSE3 static void paethPixelsSSSE3( unsigned char *row, const unsigned char *prev, size_t n )
+
+{
+  const __m128i zero     = _mm_setzero_si128();
+  const __m128i lowBytes = _mm_set1_epi16( 0x00ff );
+  __m128i a = zero, c = zero;
+
+  for (size_t i=0; i<n; i+=BPP) {
+    __m128i b = _mm_unpacklo_epi8( loadPixel<BPP>( prev+i ), zero );
+
+    __m128i pa = _mm_sub_epi16( b, c );
+    __m128i pb = _mm_sub_epi16( a, c );
+    __m128i pc = _mm_abs_epi16( _mm_add_epi16( pa, pb ) );
+
+    pa = _mm_abs_epi16( pa );
+    pb = _mm_abs_epi16( pb );
+
+    __m128i smallest = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+    __m128i nearest  = select16( _mm_cmpeq_epi16( smallest, pa ), a,
+				 select16( _mm_cmpeq_epi16( smallest, pb ), b, c ) );
+
+    a = _mm_and_si128( _mm_add_epi16( _mm_unpacklo_epi8( loadPixel<BPP>( row+i ), zero ), nearest ), lowBytes );
+    storePixel<BPP>( row+i, _mm_packus_epi16( a, a ) );
+
+    c = b;
+  }
+}
+
+
+TARGET_SSSE3 static void paethSSSE3( unsigned char *row, const unsigned char *prev, size_t n, int bpp )
+
+{
+  if (bpp == 4)
+    paethPixelsSSSE3<4>( row, prev, n );
+  else if (bpp == 3)
+    paethPixelsSSSE3<3>( row, prev, n );
+  else
+    paethScalar( row, prev, n, bpp );
+}
+
+
+// Grey to RGB: 16 pixels at a time, spread over three registers
+
+TARGET_SSSE3 static void greyToRGBSSSE3( unsigned char *out, const unsigned char *in, size_t numPixels )
+
+{
+  const __m128i spread0 = _mm_setr_epi8(  0,  0,  0,  1,  1,  1,  2,  2,  2,  3,  3,  3,  4,  4,  4,  5 );
+  const __m128i spread1 = _mm_setr_epi8(  5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10 );
+  const __m128i spread2 = _mm_setr_epi8( 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15 );
+  size_t i = 0;
+
+  for (; i+16 <= numPixels; i+=16) {
+    __m128i g = _mm_loadu_si128( (const __m128i *) (in+i) );
+    _mm_storeu_si128( (__m128i *) (out + 3*i),      _mm_shuffle_epi8( g, spread0 ) );
+    _mm_storeu_si128( (__m128i *) (out + 3*i + 16), _mm_shuffle_epi8( g, spread1 ) );
+    _mm_storeu_si128( (__m128i *) (out + 3*i + 32), _mm_shuffle_epi8( g, spread2 ) );
+  }
+
+  greyToRGBScalar( out + 3*i, in+i, numPixels-i );
+}
+
+
+TARGET_SSSE3 static void rgbToRGBASSSE3( unsigned char *out, const unsigned char *in, size_t numPixels )
+
+{
+  const __m128i spread = _mm_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 );
+  const __m128i opaque = _mm_set1_epi32( (int) 0xff000000 );
+  size_t i = 0;
+
+  for (; i+6 <= numPixels; i+=4) {
+    __m128i x = _mm_loadu_si128( (const __m128i *) (in + 3*i) );
+    _mm_storeu_si128( (__m128i *) (out + 4*i), _mm_or_si128( _mm_shuffle_epi8( x, spread ), opaque ) );
+  }
+
+  rgbToRGBAScalar( out + 4*i, in + 3*i, numPixels-i );
+}
+
+
+static bool cpuHasSSSE3()
+
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid( info, 1 );
+  return (info[2] & (1 << 9)) != 0;
+#else
+  return __builtin_cpu_supports( "ssse3" );
+#endif
+}
+
+#endif
+
+
+
+static PNGKernels kernels[NUM_PNG_KERNEL_SETS];
+
+static bool buildKernels()
+
+{
+  PNGKernels scalar = { subScalar, upScalar, averageScalar, paethScalar,
+			greyToRGBScalar, greyAlphaToRGBAScalar, rgbToRGBAScalar };
+
+  for (int i=0; i<NUM_PNG_KERNEL_SETS; i++)
+    kernels[i] = scalar;
+
+#ifdef PNG_USE_SSE2
+  PNGKernels sse2 = { subSSE2, upSSE2, averageSSE2, paethSSE2,
+		      greyToRGBScalar, greyAlphaToRGBASSE2, rgbToRGBASSE2 };
+
+  PNGKernels ssse3 = { subSSSE3, upSSE2, averageSSE2, paethSSSE3,
+		       greyToRGBSSSE3, greyAlphaToRGBASSE2, rgbToRGBASSSE3 };
+
+  kernels[PNG_SSE2]  = sse2;
+  kernels[PNG_SSSE3] = ssse3;
+#endif
+
+  return true;
+}
+
+static bool kernelsBuilt = buildKernels();
+
+
+bool canUsePNGKernelSet( PNGKernelSet set )
+
+{
+  switch (set) {
+  case PNG_SCALAR:
+    return true;
+#ifdef PNG_USE_SSE2
+  case PNG_SSE2:
+    return true;
+  case PNG_SSSE3:
+    return cpuHasSSSE3();
+#endif
+  default:
+    return false;
+  }
+}
+
+
+static PNGKernelSet bestPNGKernelSet()
+
+{
+  int set = NUM_PNG_KERNEL_SETS-1;
+
+  while (set > PNG_SCALAR && !canUsePNGKernelSet( (PNGKernelSet) set ))
+    set--;
+
+  return (PNGKernelSet) set;
+}
+
+PNGKernelSet pngKernelSet = bestPNGKernelSet();
+
+
+
+// ---------------- Decoding ----------------
+
+
+static bool unfilterRow( const PNGKernels &k, unsigned char *row, const unsigned char *prev, int filterType, size_t n, int bpp )
+
+{
+  switch (filterType) {
+
+  case 0:                       // None
+    break;
+
+  case 1:                       // Sub
+    k.sub( row, n, bpp );
+    break;
+
+  case 2:                       // Up
+    if (prev != NULL)
+      k.up( row, prev, n, bpp );
+    break;
+
+  case 3:                       // Average
+    if (prev != NULL)
+      k.average( row, prev, n, bpp );
+    else
+      averageFirstScalar( row, n, bpp );
+    break;
+
+  case 4:                       // Paeth, which is Sub on the first row
+    if (prev != NULL)
+      k.paeth( row, prev, n, bpp );
+    else
+      k.sub( row, n, bpp );
+    break;
+
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+
+void expandRGBToRGBA( unsigned char *out, const unsigned char *in, size_t numPixels )
+
+{
+  kernels[pngKernelSet].rgbToRGBA( out, in, numPixels );
+}
+
+
+bool unfilterScanline( unsigned char *row, const unsigned char *prev, int filterType, size_t n, int bpp )
+
+{
+  return unfilterRow( kernels[pngKernelSet], row, prev, filterType, n, bpp );
+}
+
+
+// Decode the common PNGs directly.  Returns false for anything else,
+// including a damaged file, which is then left to lodepng to decode
+// or to report.
+//
+// Of the ancillary chunks, only tRNS changes the pixels.  The others
+// are skipped without being read.
+
+static bool decodeDirect( unsigned char **out, unsigned width, unsigned height, bool &hasAlpha,
+			  const LodePNGColorMode &color, const unsigned char *in, size_t inSize )
+
+{
+  if (color.bitdepth != 8)
+    return false;
+
+  int bpp;
+
+  switch (color.colortype) {
+  case LCT_GREY:       bpp = 1; break;
+  case LCT_GREY_ALPHA: bpp = 2; break;
+  case LCT_RGB:        bpp = 3; break;
+  case LCT_RGBA:       bpp = 4; break;
+  case LCT_PALETTE:    bpp = 1; break;
+  default:             return false;
+  }
+
+  size_t numPixels = (size_t) width * height;
+  size_t rowBytes  = (size_t) width * bpp;
+
+  if (width == 0 || height == 0 || numPixels / width != height || numPixels > ((size_t) -1) / 8)
+    return false;
+
+  // Read the chunks.  Unused palette entries are opaque black, as in
+  // lodepng.
+
+  unsigned int palette[256];
+  unsigned int paletteSize = 0;
+  bool         havePalette = false;
+
+  for (int i=0; i<256; i++) {
+    unsigned char black[4] = { 0, 0, 0, 255 };
+    memcpy( &palette[i], black, 4 );
+  }
+
+  std::vector<unsigned char> idat;
+
+  const unsigned char *chunk = in + 33; // after the signature and IHDR
+  const unsigned char *end   = in + inSize;
+
+  while (true) {
+
+    if (end - chunk < 12)
+      return false;
+
+    unsigned int length = lodepng_chunk_length( chunk );
+
+    if (length > 2147483647 || (size_t) (end - chunk) - 12 < length)
+      return false;
+
+    const unsigned char *data = lodepng_chunk_data_const( chunk );
+
+    if (lodepng_chunk_type_equals( chunk, "IDAT" )) {
+
+      idat.insert( idat.end(), data, data+length );
+
+    } else if (lodepng_chunk_type_equals( chunk, "IEND" )) {
+
+      if (lodepng_chunk_check_crc( chunk ))
+	return false;
+      break;
+
+    } else if (lodepng_chunk_type_equals( chunk, "PLTE" )) {
+
+      paletteSize = length / 3;
+
+      if (havePalette || paletteSize == 0 || paletteSize > 256)
+	return false;
+
+      for (unsigned int i=0; i<paletteSize; i++) {
+	unsigned char rgba[4] = { data[3*i], data[3*i+1], data[3*i+2], 255 };
+	memcpy( &palette[i], rgba, 4 );
+      }
+
+      havePalette = true;
+
+    } else if (lodepng_chunk_type_equals( chunk, "tRNS" )) {
+
+      // A colour key in grey or RGB is left to lodepng
+
+      if (color.colortype != LCT_PALETTE || length > paletteSize)
+	return false;
+
+      for (unsigned int i=0; i<length; i++)
+	((unsigned char *) &palette[i])[3] = data[i];
+
+    } else if (!lodepng_chunk_ancillary( chunk ))
+
+      return false;             // an unknown critical chunk
+
+    if (!lodepng_chunk_ancillary( chunk ) || lodepng_chunk_type_equals( chunk, "tRNS" ))
+      if (lodepng_chunk_check_crc( chunk ))
+	return false;
+
+    chunk = lodepng_chunk_next_const( chunk, end );
+  }
+
+  if (color.colortype == LCT_PALETTE && !havePalette)
+    return false;
+
+  // Opaque images are kept as RGB
+
+  hasAlpha = (color.colortype == LCT_GREY_ALPHA || color.colortype == LCT_RGBA);
+
+  if (color.colortype == LCT_PALETTE)
+    for (unsigned int i=0; i<paletteSize; i++)
+      if (((unsigned char *) &palette[i])[3] != 255)
+	hasAlpha = true;
+
+  int channels = (hasAlpha ? 4 : 3);
+
+  // Decompress into the back of the output buffer.  Each row starts
+  // with its filter type.
+  //
+  // Each row is unfiltered and then expanded into place at the front,
+  // while it is still in the cache.  The scanlines start far enough
+  // back that an expanded row never reaches the row it came from, so
+  // the previous row is still there to unfilter the next one.  Rows
+  // that are already RGB or RGBA are moved down instead, over their
+  // own start, and the moved row is then the previous one.
+
+  size_t scanlinesSize = (rowBytes + 1) * height;
+  size_t lead          = (bpp == channels ? 0 : (channels - bpp) * numPixels + rowBytes);
+
+  unsigned char *buffer = new (std::nothrow) unsigned char[ lead + scanlinesSize + INFLATE_MARGIN ];
+
+  if (buffer == NULL)
+    return false;
+
+  unsigned char *scanlines = buffer + lead;
+  size_t size;
+
+  if (idat.empty() ||
+      inflateZlibInto( scanlines, scanlinesSize + INFLATE_MARGIN, &size, idat.data(), idat.size() ) != 0 ||
+      size != scanlinesSize) {
+    delete [] buffer;
+    return false;
+  }
+
+  const PNGKernels &k = kernels[pngKernelSet];
+
+  unsigned char *prev = NULL;
+
+  for (unsigned int y=0; y<height; y++) {
+
+    unsigned char *row = scanlines + y * (rowBytes + 1);
+    int filterType = row[0];
+    row++;
+
+    if (!unfilterRow( k, row, prev, filterType, rowBytes, bpp )) {
+      delete [] buffer;
+      return false;
+    }
+
+    unsigned char *dst = buffer + (size_t) y * width * channels;
+
+    if (bpp == channels)
+      memmove( dst, row, rowBytes );
+    else if (color.colortype == LCT_GREY)
+      k.greyToRGB( dst, row, width );
+    else if (color.colortype == LCT_GREY_ALPHA)
+      k.greyAlphaToRGBA( dst, row, width );
+    else if (hasAlpha)
+      paletteToRGBA( dst, row, width, palette );
+    else
+      paletteToRGB( dst, row, width, palette );
+
+    prev = (bpp == channels ? dst : row);
+  }
+
+  *out = buffer;
+
+  return true;
+}
+
+
+unsigned decodePNG( unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha,
+		    const unsigned char *in, size_t inSize )
+
+{
+  *out = NULL;
+
+  lodepng::State state;
+
+  unsigned error = lodepng_inspect( &width, &height, &state, in, inSize );
+
+  if (error)
+    return error;
+
+  if (state.info_png.interlace_method == 0 &&
+      decodeDirect( out, width, height, hasAlpha, state.info_png.color, in, inSize ))
+    return 0;
+
+  // lodepng does the rest, still with inflateZlib().  Its result is
+  // copied to a buffer from new[], dropping alpha if the image cannot
+  // have any.
+
+  InflateContext context;
+
+  context.expectedSize = 0;
+
+  if (state.info_png.interlace_method == 0)
+    context.expectedSize = lodepng_get_raw_size( width, height, &state.info_png.color ) + height; // plus a filter byte per row
+
+  state.decoder.zlibsettings.custom_zlib    = inflateZlib;
+  state.decoder.zlibsettings.custom_context = &context;
+
+  unsigned char *pixels;
+
+  error = lodepng_decode( &pixels, &width, &height, &state, in, inSize );
+
+  if (!error) {
+
+    size_t numPixels = (size_t) width * height;
+
+    hasAlpha = (lodepng_can_have_alpha( &state.info_png.color ) != 0);
+
+    if (hasAlpha) {
+      *out = new unsigned char[ numPixels * 4 ];
+      memcpy( *out, pixels, numPixels * 4 );
+    } else {
+      *out = new unsigned char[ numPixels * 3 + RGB_PADDING ];
+      for (size_t i=0; i<numPixels; i++)
+	memcpy( *out + 3*i, pixels + 4*i, 3 );
+    }
+  }
+
+  free( pixels );
+
+  return error;
+}
@@ -0,0 +1,73 @@
+// pngReader.h
+//
+// PNG decoding to 8-bit RGBA, or to RGB for images that cannot have
+// any transparency.
+//
+// The common PNGs (8 bits per channel, not interlaced, and without a
+// transparent colour key) are decoded here:
+//
+//   - The IDAT chunks are decompressed with inflateZlibInto() into
+//     the back of the output buffer, and each row is then unfiltered
+//     and expanded to RGBA towards the front.  So the pixels are never
+//     copied, and there is only one image-sized buffer.
+//
+//   - The scanline filters are reversed in place.  Sub, Average and
+//     Paeth each depend on the pixel to the left, so with 3- and
+//     4-byte pixels a whole pixel is done at once in SIMD registers.
+//     Paeth is computed in 16-bit lanes without branches.  Up is done
+//     16 bytes at a time.
+//
+//   - Grey and grey+alpha are expanded to RGB or RGBA with SIMD
+//     shuffles, and palette indices are looked up as whole RGBA words.
+//     RGB and RGBA rows are just moved into place.
+//
+// Everything else goes through lodepng (still with inflateZlib()).
+//
+// The kernels are chosen when the program starts, as the best set
+// that the processor can run.  Every set gives exactly the same bytes
+// as the scalar set.
+//
+// Define PNG_NO_SIMD to use only the scalar kernels.
+
+
+#ifndef PNG_READER_H
+#define PNG_READER_H
+
+#include <cstddef>
+
+
+typedef enum { PNG_SCALAR, PNG_SSE2, PNG_SSSE3, NUM_PNG_KERNEL_SETS } PNGKernelSet;
+
+extern const char *pngKernelSetNames[];
+
+extern PNGKernelSet pngKernelSet;   // the set in use, which can be changed for testing
+
+bool canUsePNGKernelSet( PNGKernelSet set );
+
+
+// Decode the PNG file in 'in'.  The pixels are put in '*out', which is
+// allocated with new[] for the caller to own, and which has
+// RGB_PADDING spare bytes after an RGB image, as a texmap does (see
+// image.h).  They are RGBA if 'hasAlpha' is set, and otherwise RGB:
+// that is, if the image is grey or RGB without a colour key, or has a
+// palette without transparency.  Returns 0 on success, or a lodepng
+// error code.
+
+unsigned decodePNG( unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha,
+		    const unsigned char *in, size_t inSize );
+
+
+// Expand 'numPixels' RGB pixels to opaque RGBA.  'out' must not
+// overlap 'in'.
+
+void expandRGBToRGBA( unsigned char *out, const unsigned char *in, size_t numPixels );
+
+
+// Reverse the filter on one scanline of 'n' bytes with 'bpp' bytes
+// per pixel.  'prev' is the previous scanline, already unfiltered, or
+// NULL for the first.  Returns false for an unknown filter type.
+
+bool unfilterScanline( unsigned char *row, const unsigned char *prev, int filterType, size_t n, int bpp );
+
+
+#endif
@@ -0,0 +1,1044 @@
+// pngWriter.cpp
+
+
+#include "pngWriter.h"
+#include "inflate.h"  // for adler32()
+
+#include <atomic>
+#include <thread>
+
+
+#define STRIP_BYTES   262144    // filtered bytes compressed by each task
+#define WINDOW_SIZE   32768     // how far back a match can reach
+#define WINDOW_MASK   (WINDOW_SIZE-1)
+#define HASH_BITS     15
+#define HASH_SIZE     (1 << HASH_BITS)
+#define MIN_MATCH     3
+#define MAX_MATCH     258
+#define TOO_FAR       4096      // a match of length 3 further back than this costs more than three literals
+#define BLOCK_SYMBOLS 16384     // literals and matches in each deflate block
+
+#define NUM_LIT_CODES  286
+#define NUM_DIST_CODES 30
+#define NUM_CL_CODES   19
+
+
+// Run 'task(i)' for each i in [0,n), spread over 'numThreads' threads
+
+template<class Task> static void parallelFor( int n, int numThreads, Task task )
+
+{
+  std::atomic<int> next( 0 );
+
+  auto work = [&]() {
+    for (int i=next++; i<n; i=next++)
+      task( i );
+  };
+
+  if (numThreads > n)
+    numThreads = n;
+
+  std::vector<std::thread> threads;
+
+  for (int i=1; i<numThreads; i++)
+    threads.push_back( std::thread( work ) );
+
+  work();
+
+  for (unsigned int i=0; i<threads.size(); i++)
+    threads[i].join();
+}
+
+
+
+// ---------------- Filtering ----------------
+
+
+static inline unsigned char paeth( int a, int b, int c )
+
+{
+  int p  = a + b - c;
+  int pa = abs( p - a );
+  int pb = abs( p - b );
+  int pc = abs( p - c );
+
+  if (pa <= pb && pa <= pc)
+    return a;
+  else if (pb <= pc)
+    return b;
+  else
+    return c;
+}
+
+
+// The filtered value of byte i of 'row' with filter type 'f'
+
+static inline unsigned char filtered( int f, unsigned char *row, unsigned char *prev, int i, int bpp )
+
+{
+  int a = (i >= bpp ? row[i-bpp] : 0);
+  int b = prev[i];
+  int c = (i >= bpp ? prev[i-bpp] : 0);
+
+  switch (f) {
+  case 0:  return row[i];
+  case 1:  return row[i] - a;
+  case 2:  return row[i] - b;
+  case 3:  return row[i] - ((a + b) >> 1);
+  default: return row[i] - paeth( a, b, c );
+  }
+}
+
+
+// Filter one row into 'out' (filter type, then the filtered bytes).
+// Unless the level is 0, the filter is the one whose output has the
+// smallest sum of absolute values, as lodepng does.
+
+static void filterRow( unsigned char *out, unsigned char *row, unsigned char *prev, int rowBytes, int bpp, int level )
+
+{
+  int best = 0;
+
+  if (level > 0) {
+
+    unsigned long bestSum = 0;
+
+    for (int f=0; f<5; f++) {
+
+      unsigned long sum = 0;
+
+      for (int i=0; i<rowBytes; i++)
+	sum += abs( (signed char) filtered( f, row, prev, i, bpp ) );
+
+      if (f == 0 || sum < bestSum) {
+	best = f;
+	bestSum = sum;
+      }
+    }
+  }
+
+  out[0] = best;
+
+  for (int i=0; i<rowBytes; i++)
+    out[i+1] = filtered( best, row, prev, i, bpp );
+}
+
+
+
+// ---------------- Checksums ----------------
+
+
+static unsigned int crcTable[256];
+
+static bool buildCRCTable()
+
+{
+  for (unsigned int n=0; n<256; n++) {
+    unsigned int c = n;
+    for (int k=0; k<8; k++)
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    crcTable[n] = c;
+  }
+
+  return true;
+}
+
+static bool crcTableBuilt = buildCRCTable();
+
+
+// Continue a CRC-32 (start with 0xffffffff and invert at the end)
+
+static unsigned int updateCRC( unsigned int crc, const unsigned char *buf, size_t len )
+
+{
+  for (size_t i=0; i<len; i++)
+    crc = crcTable[ (crc ^ buf[i]) & 0xff ] ^ (crc >> 8);
+
+  return crc;
+}
+
+
+#define ADLER_BASE 65521
+
+
+// The Adler-32 of the concatenation of two buffers, given the Adler-32
+// of each and the length of the second (as in zlib's adler32_combine)
+
+static unsigned int combineAdler32( unsigned int adler1, unsigned int adler2, size_t len2 )
+
+{
+  unsigned int rem  = len2 % ADLER_BASE;
+  unsigned int sum1 = adler1 & 0xffff;
+  unsigned int sum2 = (unsigned int) (((unsigned long long) rem * sum1) % ADLER_BASE);
+
+  sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+  sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+
+  if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+  if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+  if (sum2 >= 2*ADLER_BASE) sum2 -= 2*ADLER_BASE;
+  if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+
+  return (sum2 << 16) | sum1;
+}
+
+
+
+// ---------------- Deflate ----------------
+
+
+static const int lengthBase[29]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+				     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const int lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+				     3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+static const int distBase[30]  = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+				   257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const int distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+				   7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static const int codeLengthOrder[ NUM_CL_CODES ] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+
+static unsigned char lengthCode[ MAX_MATCH+1 ]; // match length to length code (0 to 28)
+
+// Distance code of distance d is distCodeTable[d-1] for d <= 256, and
+// distCodeTable[256 + ((d-1) >> 7)] otherwise, as in zlib
+
+static unsigned char distCodeTable[512];
+
+static bool buildLengthCodes()
+
+{
+  for (int c=0; c<29; c++)
+    for (int len=lengthBase[c]; len < lengthBase[c] + (1 << lengthExtra[c]) && len <= MAX_MATCH; len++)
+      lengthCode[len] = c; // 258 is last set by code 28
+
+  for (int c=0; c<30; c++)
+    for (int d=distBase[c]; d < distBase[c] + (1 << distExtra[c]); d++)
+      if (d <= 256)
+	distCodeTable[d-1] = c;
+      else
+	distCodeTable[ 256 + ((d-1) >> 7) ] = c;
+
+  return true;
+}
+
+static bool lengthCodesBuilt = buildLengthCodes();
+
+
+static inline int distCode( int dist )
+
+{
+  return (dist <= 256 ? distCodeTable[dist-1] : distCodeTable[ 256 + ((dist-1) >> 7) ]);
+}
+
+
+// Settings for each level, as in zlib: a match search follows at most
+// 'chain' earlier positions and stops at a match of 'nice' bytes.  If
+// 'lazy' is non-zero, a match shorter than 'lazy' is dropped when the
+// next position has a longer one.
+
+struct LevelSettings {
+  int chain, nice, lazy;
+};
+
+static const LevelSettings levelSettings[10] = {
+  {    0,   0,   0 },  // 0: stored
+  {    4,   8,   0 },
+  {    8,  16,   0 },
+  {   32,  32,   0 },
+  {   16,  32,   4 },
+  {   32,  64,  16 },
+  {  128, 128,  16 },
+  {  256, 128,  32 },
+  { 1024, 258, 128 },
+  { 4096, 258, 258 }
+};
+
+
+// Find the lengths of Huffman codes for the symbols with frequencies
+// 'freq', with no code longer than 'maxBits'.  At least two symbols
+// get codes, as some decoders require.
+
+static void buildCodeLengths( unsigned int *freq, int n, int maxBits, unsigned char *lengths )
+
+{
+  seq<int> used;
+
+  for (int i=0; i<n; i++) {
+    lengths[i] = 0;
+    if (freq[i] > 0)
+      used.add( i );
+  }
+
+  if (used.size() < 2) {
+    int other = (used.size() == 1 && used[0] == 0 ? 1 : 0);
+    lengths[other] = 1;
+    if (used.size() == 1)
+      lengths[ used[0] ] = 1;
+    else
+      lengths[1] = 1;
+    return;
+  }
+
+  // Sort the used symbols by increasing frequency
+
+  int numUsed = used.size();
+
+  for (int i=1; i<numUsed; i++) {
+    int s = used[i];
+    int j = i;
+    while (j > 0 && freq[ used[j-1] ] > freq[s]) {
+      used[j] = used[j-1];
+      j--;
+    }
+    used[j] = s;
+  }
+
+  // Build the tree with two queues: leaves in 'used' order, and
+  // internal nodes in the order made (which is also by weight)
+
+  int numNodes = 2*numUsed - 1;
+
+  seq<unsigned long> weight( numNodes );
+  seq<int>           parent( numNodes );
+
+  for (int i=0; i<numNodes; i++) {
+    weight.add( (i < numUsed ? freq[ used[i] ] : 0) );
+    parent.add( -1 );
+  }
+
+  int nextLeaf = 0, nextInternal = numUsed;
+
+  for (int node=numUsed; node<numNodes; node++) {
+
+    int child[2];
+
+    for (int k=0; k<2; k++)
+      if (nextLeaf < numUsed && (nextInternal >= node || weight[nextLeaf] <= weight[nextInternal]))
+	child[k] = nextLeaf++;
+      else
+	child[k] = nextInternal++;
+
+    weight[node] = weight[ child[0] ] + weight[ child[1] ];
+    parent[ child[0] ] = node;
+    parent[ child[1] ] = node;
+  }
+
+  // Depths, from the root down
+
+  seq<int> depth( numNodes );
+
+  for (int i=0; i<numNodes; i++)
+    depth.add( 0 );
+
+  for (int node=numNodes-2; node>=0; node--)
+    depth[node] = depth[ parent[node] ] + 1;
+
+  // Count the codes of each length, then limit the length as miniz
+  // does: move the too-long codes to 'maxBits', and then lengthen
+  // shorter codes until the lengths are those of a complete code.
+
+  int count[ 64 ];
+
+  for (int i=0; i<64; i++)
+    count[i] = 0;
+
+  for (int i=0; i<numUsed; i++)
+    count[ min( depth[i], 63 ) ]++;
+
+  for (int i=maxBits+1; i<64; i++) {
+    count[maxBits] += count[i];
+    count[i] = 0;
+  }
+
+  unsigned long total = 0;
+
+  for (int i=1; i<=maxBits; i++)
+    total += (unsigned long) count[i] << (maxBits - i);
+
+  while (total != (1UL << maxBits)) {
+    count[maxBits]--;
+    for (int i=maxBits-1; i>0; i--)
+      if (count[i] > 0) {
+	count[i]--;
+	count[i+1] += 2;
+	break;
+      }
+    total--;
+  }
+
+  // The most frequent symbols get the shortest codes
+
+  int s = numUsed-1;
+
+  for (int len=1; len<=maxBits; len++)
+    for (int i=0; i<count[len]; i++)
+      lengths[ used[s--] ] = len;
+}
+
+
+// Canonical codes for the code lengths, bit-reversed because deflate
+// writes codes starting from their most significant bit
+
+static void buildCodes( unsigned char *lengths, int n, unsigned short *codes )
+
+{
+  int count[16], nextCode[16];
+
+  for (int i=0; i<16; i++)
+    count[i] = 0;
+
+  for (int i=0; i<n; i++)
+    count[ lengths[i] ]++;
+
+  count[0] = 0;
+
+  int code = 0;
+  for (int len=1; len<16; len++) {
+    code = (code + count[len-1]) << 1;
+    nextCode[len] = code;
+  }
+
+  for (int i=0; i<n; i++) {
+
+    int len = lengths[i];
+
+    if (len == 0) {
+      codes[i] = 0;
+      continue;
+    }
+
+    int c = nextCode[len]++;
+    int r = 0;
+
+    for (int k=0; k<len; k++) {
+      r = (r << 1) | (c & 1);
+      c >>= 1;
+    }
+
+    codes[i] = r;
+  }
+}
+
+
+
+// Compresses one strip of the filtered data
+
+class DeflateStrip {
+
+  const unsigned char *data;    // all of the filtered data
+  size_t dataSize;
+  size_t start, end;            // the strip
+  bool   last;                  // true for the last strip, which ends the stream
+  LevelSettings settings;
+
+  std::vector<unsigned char> &out;
+
+  unsigned long long bitBuffer;
+  int bitCount;
+
+  // Literals (< 256) and matches (MATCH_FLAG | length << 16 | distance)
+  // of the current block, which covers input from 'blockStart'
+
+  #define MATCH_FLAG 0x80000000
+
+  seq<unsigned int> symbols;
+  size_t blockStart;
+
+  // Hash chains.  Positions are stored relative to 'base', plus one
+  // so that 0 means none.
+
+  size_t base;
+  seq<unsigned int> head, prev;
+
+  void putBits( unsigned int value, int n ) {
+    bitBuffer |= (unsigned long long) value << bitCount;
+    bitCount += n;
+    while (bitCount >= 8) {
+      out.push_back( bitBuffer & 0xff );
+      bitBuffer >>= 8;
+      bitCount -= 8;
+    }
+  }
+
+  void alignToByte() {
+    if (bitCount > 0)
+      putBits( 0, 8 - bitCount );
+  }
+
+  unsigned int hash( size_t pos ) {
+    unsigned int x = (data[pos] << 16) | (data[pos+1] << 8) | data[pos+2];
+    return (x * 2654435761u) >> (32 - HASH_BITS);
+  }
+
+  void insert( size_t pos ) {
+    if (pos + MIN_MATCH > dataSize)
+      return;
+    unsigned int h = hash( pos );
+    prev[ pos & WINDOW_MASK ] = head[h];
+    head[h] = (unsigned int) (pos - base + 1);
+  }
+
+  int findMatch( size_t pos, int &bestDist );
+
+  void writeStored( size_t from, size_t to, bool final );
+  void flushBlock( size_t inputEnd, bool final );
+
+ public:
+
+  DeflateStrip( const unsigned char *d, size_t size, size_t s, size_t e, bool l, int level, std::vector<unsigned char> &o )
+    : out( o ) {
+    data = d;
+    dataSize = size;
+    start = s;
+    end = e;
+    last = l;
+    settings = levelSettings[ level ];
+    bitBuffer = 0;
+    bitCount = 0;
+  }
+
+  void compress();
+};
+
+
+
+// The longest match for 'pos' among earlier positions, or 0 if none
+
+int DeflateStrip::findMatch( size_t pos, int &bestDist )
+
+{
+  int maxLen = (int) min( (size_t) MAX_MATCH, end - pos );
+
+  if (maxLen < MIN_MATCH)
+    return 0;
+
+  int best = MIN_MATCH-1;
+  int chain = settings.chain;
+
+  const unsigned char *p = data + pos;
+
+  unsigned int cand = head[ hash( pos ) ];
+
+  while (cand != 0 && chain-- > 0) {
+
+    size_t c = cand - 1 + base;
+
+    if (c >= pos || pos - c > WINDOW_SIZE)
+      break;
+
+    const unsigned char *q = data + c;
+
+    if (q[best] == p[best] && q[0] == p[0] && q[1] == p[1]) {
+
+      int len = 2;
+      while (len < maxLen && q[len] == p[len])
+	len++;
+
+      if (len > best) {
+	best = len;
+	bestDist = (int) (pos - c);
+	if (len >= settings.nice || len == maxLen) // p[best] would be past the end
+	  break;
+      }
+    }
+
+    unsigned int next = prev[ c & WINDOW_MASK ];
+
+    if (next == 0 || next - 1 + base >= c) // overwritten by a newer position
+      break;
+
+    cand = next;
+  }
+
+  if (best < MIN_MATCH || (best == MIN_MATCH && bestDist > TOO_FAR))
+    return 0;
+
+  return best;
+}
+
+
+
+// Write data[from,to) as stored blocks
+
+void DeflateStrip::writeStored( size_t from, size_t to, bool final )
+
+{
+  do {
+    size_t n = min( to - from, (size_t) 65535 );
+    bool lastBlock = final && from + n == to;
+
+    putBits( lastBlock ? 1 : 0, 3 ); // BFINAL, then BTYPE 00
+    alignToByte();
+    putBits( n & 0xffff, 16 );
+    putBits( ~n & 0xffff, 16 );
+    out.insert( out.end(), data + from, data + from + n );
+
+    from += n;
+  } while (from < to);
+}
+
+
+
+// Write the current symbols as a block with dynamic Huffman codes, or
+// as stored blocks if that is smaller
+
+void DeflateStrip::flushBlock( size_t inputEnd, bool final )
+
+{
+  if (symbols.size() == 0) {
+    if (final)
+      writeStored( inputEnd, inputEnd, true );
+    return;
+  }
+
+  // Frequencies
+
+  unsigned int litFreq[ NUM_LIT_CODES ], distFreq[ NUM_DIST_CODES ];
+
+  memset( litFreq,  0, sizeof(litFreq) );
+  memset( distFreq, 0, sizeof(distFreq) );
+
+  for (int i=0; i<symbols.size(); i++) {
+    unsigned int s = symbols[i];
+    if (s & MATCH_FLAG) {
+      litFreq[ 257 + lengthCode[ (s >> 16) & 0x1ff ] ]++;
+      distFreq[ distCode( s & 0xffff ) ]++;
+    } else
+      litFreq[s]++;
+  }
+
+  litFreq[256] = 1; // end of block
+
+  unsigned char  litLen[ NUM_LIT_CODES ], distLen[ NUM_DIST_CODES ];
+  unsigned short litCode[ NUM_LIT_CODES ], distCodes[ NUM_DIST_CODES ];
+
+  buildCodeLengths( litFreq,  NUM_LIT_CODES,  15, litLen );
+  buildCodeLengths( distFreq, NUM_DIST_CODES, 15, distLen );
+
+  // Run-length code the code lengths: 16 repeats the previous length
+  // 3-6 times, 17 gives 3-10 zeros, and 18 gives 11-138 zeros
+
+  int numLit = NUM_LIT_CODES;
+  while (numLit > 257 && litLen[numLit-1] == 0)
+    numLit--;
+
+  int numDist = NUM_DIST_CODES;
+  while (numDist > 1 && distLen[numDist-1] == 0)
+    numDist--;
+
+  unsigned char allLen[ NUM_LIT_CODES + NUM_DIST_CODES ];
+
+  memcpy( allLen, litLen, numLit );
+  memcpy( allLen + numLit, distLen, numDist );
+
+  int numAll = numLit + numDist;
+
+  seq<unsigned short> rle; // code length symbol | repeat count << 8
+
+  for (int i=0; i<numAll; ) {
+
+    int len = allLen[i];
+    int run = 1;
+    while (i+run < numAll && allLen[i+run] == len)
+      run++;
+
+    if (len == 0 && run >= 3) {
+      int n = min( run, 138 );
+      rle.add( (n >= 11 ? 18 : 17) | (n << 8) );
+      i += n;
+    } else if (len != 0 && run >= 4) {
+      rle.add( len );
+      int n = min( run-1, 6 );
+      rle.add( 16 | (n << 8) );
+      i += 1 + n;
+    } else {
+      rle.add( len );
+      i++;
+    }
+  }
+
+  unsigned int   clFreq[ NUM_CL_CODES ];
+  unsigned char  clLen[ NUM_CL_CODES ];
+  unsigned short clCode[ NUM_CL_CODES ];
+
+  memset( clFreq, 0, sizeof(clFreq) );
+
+  for (int i=0; i<rle.size(); i++)
+    clFreq[ rle[i] & 0xff ]++;
+
+  buildCodeLengths( clFreq, NUM_CL_CODES, 7, clLen );
+
+  int numCL = NUM_CL_CODES;
+  while (numCL > 4 && clLen[ codeLengthOrder[numCL-1] ] == 0)
+    numCL--;
+
+  // Compare the sizes
+
+  static const int clExtra[3] = { 2, 3, 7 }; // extra bits of codes 16, 17, 18
+
+  unsigned long dynamicBits = 3 + 5 + 5 + 4 + 3 * numCL;
+
+  for (int i=0; i<rle.size(); i++) {
+    int s = rle[i] & 0xff;
+    dynamicBits += clLen[s] + (s >= 16 ? clExtra[s-16] : 0);
+  }
+
+  for (int i=0; i<NUM_LIT_CODES; i++)
+    dynamicBits += (unsigned long) litFreq[i] * (litLen[i] + (i >= 257 ? lengthExtra[i-257] : 0));
+
+  for (int i=0; i<NUM_DIST_CODES; i++)
+    dynamicBits += (unsigned long) distFreq[i] * (distLen[i] + distExtra[i]);
+
+  size_t numBytes = inputEnd - blockStart;
+  unsigned long storedBits = (numBytes + 5 * (numBytes / 65535 + 1)) * 8 + 8;
+
+  if (storedBits <= dynamicBits) {
+    writeStored( blockStart, inputEnd, final );
+    symbols.clear();
+    blockStart = inputEnd;
+    return;
+  }
+
+  // Header
+
+  buildCodes( litLen,  NUM_LIT_CODES,  litCode );
+  buildCodes( distLen, NUM_DIST_CODES, distCodes );
+  buildCodes( clLen,   NUM_CL_CODES,   clCode );
+
+  putBits( final ? 1 : 0, 1 );
+  putBits( 2, 2 ); // dynamic Huffman codes
+  putBits( numLit - 257, 5 );
+  putBits( numDist - 1, 5 );
+  putBits( numCL - 4, 4 );
+
+  for (int i=0; i<numCL; i++)
+    putBits( clLen[ codeLengthOrder[i] ], 3 );
+
+  for (int i=0; i<rle.size(); i++) {
+    int s = rle[i] & 0xff;
+    int n = rle[i] >> 8;
+    putBits( clCode[s], clLen[s] );
+    if (s == 16)
+      putBits( n - 3, 2 );
+    else if (s == 17)
+      putBits( n - 3, 3 );
+    else if (s == 18)
+      putBits( n - 11, 7 );
+  }
+
+  // Data
+
+  for (int i=0; i<symbols.size(); i++) {
+
+    unsigned int s = symbols[i];
+
+    if (s & MATCH_FLAG) {
+
+      int len  = (s >> 16) & 0x1ff;
+      int dist = s & 0xffff;
+
+      int lc = lengthCode[len];
+      putBits( litCode[ 257 + lc ], litLen[ 257 + lc ] );
+      putBits( len - lengthBase[lc], lengthExtra[lc] );
+
+      int dc = distCode( dist );
+      putBits( distCodes[dc], distLen[dc] );
+      putBits( dist - distBase[dc], distExtra[dc] );
+
+    } else
+      putBits( litCode[s], litLen[s] );
+  }
+
+  putBits( litCode[256], litLen[256] );
+
+  symbols.clear();
+  blockStart = inputEnd;
+}
+
+
+
+void DeflateStrip::compress()
+
+{
+  blockStart = start;
+
+  if (settings.chain == 0) { // level 0
+    writeStored( start, end, last );
+  } else {
+
+    head.reserve( HASH_SIZE );
+    for (int i=0; i<HASH_SIZE; i++)
+      head.add( 0 );
+
+    prev.reserve( WINDOW_SIZE );
+    for (int i=0; i<WINDOW_SIZE; i++)
+      prev.add( 0 );
+
+    symbols.reserve( BLOCK_SYMBOLS );
+
+    // Prime the hash chains with the window before the strip
+
+    base = (start > WINDOW_SIZE ? start - WINDOW_SIZE : 0);
+
+    for (size_t pos=base; pos<start; pos++)
+      insert( pos );
+
+    // Find matches.  A pending match at i+1 is kept from the lazy
+    // check so that it is not searched for twice.
+
+    size_t i = start;
+
+    int  nextLen = 0, nextDist = 0;
+    bool haveNext = false;
+
+    while (i < end) {
+
+      int dist = 0;
+      int len;
+
+      if (haveNext) {
+	len = nextLen;
+	dist = nextDist;
+	haveNext = false;
+      } else
+	len = findMatch( i, dist );
+
+      insert( i );
+
+      if (len > 0 && len < settings.lazy && i+1 < end) {
+	nextLen = findMatch( i+1, nextDist );
+	haveNext = true;
+	if (nextLen > len)
+	  len = 0; // take the next match instead
+      }
+
+      if (len > 0) {
+	symbols.add( MATCH_FLAG | (len << 16) | dist );
+	for (int k=1; k<len; k++)
+	  insert( i+k );
+	i += len;
+	haveNext = false;
+      } else {
+	symbols.add( data[i] );
+	i++;
+      }
+
+      if (symbols.size() >= BLOCK_SYMBOLS && !haveNext)
+	flushBlock( i, false );
+    }
+
+    flushBlock( end, last );
+  }
+
+  // End a strip that is not the last with an empty stored block,
+  // which leaves it at a byte boundary without ending the stream
+
+  if (!last) {
+    putBits( 0, 3 );
+    alignToByte();
+    putBits( 0x0000, 16 );
+    putBits( 0xffff, 16 );
+  }
+
+  alignToByte();
+}
+
+
+
+// ---------------- PNG ----------------
+
+
+static void putInt( std::vector<unsigned char> &out, unsigned int x )
+
+{
+  out.push_back( x >> 24 );
+  out.push_back( x >> 16 );
+  out.push_back( x >> 8 );
+  out.push_back( x );
+}
+
+
+static void putChunk( std::vector<unsigned char> &out, const char *type, const unsigned char *data, size_t len, unsigned int crc )
+
+{
+  putInt( out, len );
+  out.insert( out.end(), type, type+4 );
+  out.insert( out.end(), data, data + len );
+  putInt( out, crc );
+}
+
+
+static unsigned int chunkCRC( const char *type, const unsigned char *data, size_t len )
+
+{
+  unsigned int crc = updateCRC( 0xffffffff, (const unsigned char *) type, 4 );
+  return updateCRC( crc, data, len ) ^ 0xffffffff;
+}
+
+
+
+struct CompressedStrip {
+  std::vector<unsigned char> bytes;
+  unsigned int adler;
+  unsigned int crc;             // of the IDAT chunk holding 'bytes'
+};
+
+
+
+void encodePNG( Image *image, std::vector<unsigned char> &out, int level, int numThreads )
+
+{
+  if (level < 0) level = 0;
+  if (level > 9) level = 9;
+
+  if (numThreads <= 0)
+    numThreads = std::thread::hardware_concurrency();
+  if (numThreads <= 0)
+    numThreads = 1;
+
+  // An image with alpha that is opaque everywhere is written as RGB,
+  // as lodepng does
+
+  int srcBpp = (image->hasAlpha ? 4 : 3);
+  bool alpha = false;
+
+  if (image->hasAlpha) {
+    size_t n = (size_t) image->width * image->height;
+    for (size_t i=0; i<n && !alpha; i++)
+      alpha = (image->texmap[4*i+3] != 255);
+  }
+
+  int bpp = (alpha ? 4 : 3);
+  int rowBytes = image->width * bpp;
+  size_t filteredRowBytes = rowBytes + 1;
+  size_t dataSize = filteredRowBytes * image->height;
+
+  // Filter, in bands of rows
+
+  unsigned char *data = new unsigned char[ dataSize ];
+
+  int rowsPerBand = max( 1, (int) (STRIP_BYTES / filteredRowBytes) );
+  int numBands = (image->height + rowsPerBand-1) / rowsPerBand;
+
+  parallelFor( numBands, numThreads, [&]( int band ) {
+
+    // Rows in the written format: 'row' and the row above it
+
+    std::vector<unsigned char> row( rowBytes ), above( rowBytes, 0 );
+
+    auto getRow = [&]( unsigned int y, unsigned char *out ) {
+      unsigned char *p = image->texmap + y * (size_t) image->width * srcBpp;
+      if (srcBpp == bpp)
+	memcpy( out, p, rowBytes );
+      else
+	for (unsigned int x=0; x<image->width; x++, p+=4, out+=3) {
+	  out[0] = p[0];
+	  out[1] = p[1];
+	  out[2] = p[2];
+	}
+    };
+
+    unsigned int y0 = band * rowsPerBand;
+    unsigned int y1 = min( (unsigned int) (band+1) * rowsPerBand, image->height );
+
+    if (y0 > 0)
+      getRow( y0-1, above.data() );
+
+    for (unsigned int y=y0; y<y1; y++) {
+      getRow( y, row.data() );
+      filterRow( data + y * filteredRowBytes, row.data(), above.data(), rowBytes, bpp, level );
+      row.swap( above );
+    }
+  } );
+
+  // Compress, in strips
+
+  int numStrips = max( (size_t) 1, (dataSize + STRIP_BYTES-1) / STRIP_BYTES );
+
+  CompressedStrip *strips = new CompressedStrip[ numStrips ];
+
+  // zlib header: 32 KB window, deflate, and the level, with a check
+
+  unsigned int cmf = 0x78;
+  unsigned int flg = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+  flg += 31 - (cmf * 256 + flg) % 31;
+
+  strips[0].bytes.push_back( cmf );
+  strips[0].bytes.push_back( flg );
+
+  parallelFor( numStrips, numThreads, [&]( int i ) {
+
+    size_t start = i * (size_t) STRIP_BYTES;
+    size_t end   = min( start + STRIP_BYTES, dataSize );
+
+    DeflateStrip strip( data, dataSize, start, end, i == numStrips-1, level, strips[i].bytes );
+
+    strip.compress();
+
+    strips[i].adler = adler32( data + start, end - start );
+    strips[i].crc   = chunkCRC( "IDAT", strips[i].bytes.data(), strips[i].bytes.size() );
+  } );
+
+  delete [] data;
+
+  // Assemble the file
+
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+  out.clear();
+  out.insert( out.end(), signature, signature+8 );
+
+  std::vector<unsigned char> header;
+
+  putInt( header, image->width );
+  putInt( header, image->height );
+  header.push_back( 8 );                         // bits per channel
+  header.push_back( alpha ? 6 : 2 );             // RGBA or RGB
+  header.push_back( 0 );                         // deflate
+  header.push_back( 0 );                         // adaptive filtering
+  header.push_back( 0 );                         // not interlaced
+
+  putChunk( out, "IHDR", header.data(), header.size(), chunkCRC( "IHDR", header.data(), header.size() ) );
+
+  unsigned int adler = 1;
+
+  for (int i=0; i<numStrips; i++) {
+    size_t len = min( (size_t) STRIP_BYTES, dataSize - i * (size_t) STRIP_BYTES );
+    adler = combineAdler32( adler, strips[i].adler, len );
+    putChunk( out, "IDAT", strips[i].bytes.data(), strips[i].bytes.size(), strips[i].crc );
+  }
+
+  delete [] strips;
+
+  std::vector<unsigned char> trailer;
+
+  putInt( trailer, adler );
+
+  putChunk( out, "IDAT", trailer.data(), trailer.size(), chunkCRC( "IDAT", trailer.data(), trailer.size() ) );
+  putChunk( out, "IEND", NULL, 0, chunkCRC( "IEND", NULL, 0 ) );
+}
+
+
+
+bool writePNG( Image *image, string filename, int level, int numThreads )
+
+{
+  std::vector<unsigned char> png;
+
+  encodePNG( image, png, level, numThreads );
+
+  FILE *f = fopen( filename.c_str(), "wb" );
+
+  if (f == NULL)
+    return false;
+
+  bool ok = (fwrite( png.data(), 1, png.size(), f ) == png.size());
+
+  if (fclose( f ) != 0)
+    ok = false;
+
+  return ok;
+}
@@ -0,0 +1,42 @@
+// pngWriter.h
+//
+// PNG encoding that uses all of the cores.
+//
+// The rows are filtered in parallel.  The filtered data is then cut
+// into strips that are compressed in parallel.  Each strip is primed
+// with the 32 KB of data before it, so matches can reach back across
+// strip boundaries as in a single stream.  Every strip but the last
+// ends with an empty stored block, which leaves it at a byte boundary
+// without ending the stream.  So the compressed strips join into one
+// valid zlib stream, as in pigz, and each one is written as its own
+// IDAT chunk.  The Adler-32 checksums of the strips are combined at
+// the end.
+//
+// Levels are as in zlib: 0 stores without compressing, 1 is fastest,
+// and 9 compresses most.
+
+
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include "coreHeaders.h"
+#include "image.h"
+
+#include <string>
+#include <vector>
+
+
+#define PNG_DEFAULT_LEVEL 6
+
+
+// Encode 'image' as a PNG in 'out'.  If 'numThreads' is 0, one thread
+// per core is used.
+
+void encodePNG( Image *image, std::vector<unsigned char> &out, int level = PNG_DEFAULT_LEVEL, int numThreads = 0 );
+
+// Write 'image' as a PNG file.  Returns false if it could not be written.
+
+bool writePNG( Image *image, string filename, int level = PNG_DEFAULT_LEVEL, int numThreads = 0 );
+
+
+#endif
@@ -0,0 +1,298 @@
+// pnm.cpp
+//
+// See the Netpbm documentation (netpbm.sourceforge.net/doc/pam.html).
+
+
+#include "pnm.h"
+
+#include <cctype>
+#include <new>
+#include <vector>
+
+
+#define PNM_MAX_PIXELS 400000000
+
+
+// ---------------- Reading ----------------
+
+
+// Skip whitespace and '#' comments in a PPM or PGM header
+
+static void skipSpace( FILE *f )
+
+{
+  int c;
+
+  while ((c = getc( f )) != EOF)
+    if (c == '#') {
+      while ((c = getc( f )) != EOF && c != '\n')
+	;
+    } else if (!isspace( c )) {
+      ungetc( c, f );
+      return;
+    }
+}
+
+
+
+// Read a decimal number in a PPM or PGM header.  Returns false if
+// there is none.
+
+static bool readNumber( FILE *f, unsigned &n )
+
+{
+  skipSpace( f );
+
+  int c = getc( f );
+
+  if (!isdigit( c ))
+    return false;
+
+  n = 0;
+
+  do {
+    if (n > 100000000)
+      return false;
+    n = n * 10 + (c - '0');
+  } while (isdigit( c = getc( f ) ));
+
+  if (c != EOF)
+    ungetc( c, f );
+
+  return true;
+}
+
+
+
+// Read the header of a PPM or PGM file after its magic number
+
+static const char *readPPMHeader( FILE *f, unsigned &width, unsigned &height, unsigned &maxval )
+
+{
+  if (!readNumber( f, width ) || !readNumber( f, height ) || !readNumber( f, maxval ))
+    return "invalid PPM header";
+
+  if (!isspace( getc( f ) )) // exactly one whitespace character before the pixels
+    return "invalid PPM header";
+
+  return NULL;
+}
+
+
+
+// Read the header of a PAM file after its magic number: lines of
+// "KEYWORD value" up to "ENDHDR".
+
+static const char *readPAMHeader( FILE *f, unsigned &width, unsigned &height, unsigned &depth, unsigned &maxval )
+
+{
+  width = height = depth = maxval = 0;
+
+  char line[256];
+
+  while (fgets( line, sizeof(line), f ) != NULL) {
+
+    char key[64];
+    unsigned value;
+
+    if (line[0] == '#' || sscanf( line, "%63s", key ) != 1)
+      continue;
+
+    if (strcmp( key, "ENDHDR" ) == 0) {
+      if (width == 0 || height == 0 || depth == 0 || maxval == 0)
+	return "incomplete PAM header";
+      return NULL;
+    }
+
+    if (strcmp( key, "TUPLTYPE" ) == 0) // the depth says all that is needed
+      continue;
+
+    if (sscanf( line, "%*s %u", &value ) != 1)
+      return "invalid PAM header";
+
+    if (strcmp( key, "WIDTH" ) == 0)
+      width = value;
+    else if (strcmp( key, "HEIGHT" ) == 0)
+      height = value;
+    else if (strcmp( key, "DEPTH" ) == 0)
+      depth = value;
+    else if (strcmp( key, "MAXVAL" ) == 0)
+      maxval = value;
+  }
+
+  return "PAM header has no ENDHDR";
+}
+
+
+
+const char *readPNM( string filename, unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha )
+
+{
+  FILE *f = fopen( filename.c_str(), "rb" );
+
+  if (f == NULL)
+    return "cannot open the file";
+
+  // Header
+
+  const char *error = NULL;
+  unsigned depth = 0, maxval = 0;
+
+  char magic[2];
+
+  if (fread( magic, 1, 2, f ) != 2 || magic[0] != 'P')
+    error = "not a PPM, PGM or PAM file";
+  else if (magic[1] == '6') {
+    error = readPPMHeader( f, width, height, maxval );
+    depth = 3;
+  } else if (magic[1] == '5') {
+    error = readPPMHeader( f, width, height, maxval );
+    depth = 1;
+  } else if (magic[1] == '7' && getc( f ) == '\n')
+    error = readPAMHeader( f, width, height, depth, maxval );
+  else
+    error = "not a binary PPM, PGM or PAM file";
+
+  if (error == NULL) {
+    if (maxval != 255)
+      error = "only 8-bit samples are supported";
+    else if (depth < 1 || depth > 4)
+      error = "only 1 to 4 channels are supported";
+    else if (width == 0 || height == 0 || height >= PNM_MAX_PIXELS / width)
+      error = "invalid image size";
+  }
+
+  if (error != NULL) {
+    fclose( f );
+    return error;
+  }
+
+  // Pixels.  RGB and RGBA are read straight into place.  Grey (depth
+  // 1) becomes RGB and grey+alpha (depth 2) becomes RGBA: they are
+  // read into the back of the buffer and expanded forwards, which
+  // never overwrites a byte not yet read.
+
+  hasAlpha = (depth == 2 || depth == 4);
+
+  size_t numPixels = (size_t) width * height;
+  int    channels  = (hasAlpha ? 4 : 3);
+  size_t fileBytes = numPixels * depth;
+  size_t size      = numPixels * channels + (hasAlpha ? 0 : RGB_PADDING);
+
+  unsigned char *pixels = new (std::nothrow) unsigned char[ size ];
+
+  if (pixels == NULL) {
+    fclose( f );
+    return "not enough memory for the image";
+  }
+
+  unsigned char *in = (depth >= 3 ? pixels : pixels + size - fileBytes);
+
+  bool ok = (fread( in, 1, fileBytes, f ) == fileBytes);
+
+  fclose( f );
+
+  if (!ok) {
+    delete [] pixels;
+    return "pixel data is truncated";
+  }
+
+  if (depth == 1) {
+    unsigned char *q = pixels;
+    for (size_t i=0; i<numPixels; i++) {
+      unsigned char v = in[i];
+      *q++ = v;
+      *q++ = v;
+      *q++ = v;
+    }
+  } else if (depth == 2) {
+    unsigned char *q = pixels;
+    for (size_t i=0; i<numPixels; i++) {
+      unsigned char v = in[2*i];
+      unsigned char a = in[2*i+1];
+      *q++ = v;
+      *q++ = v;
+      *q++ = v;
+      *q++ = a;
+    }
+  }
+
+  *out = pixels;
+
+  return NULL;
+}
+
+
+
+// ---------------- Writing ----------------
+
+
+bool writePAM( Image *image, string filename )
+
+{
+  FILE *f = fopen( filename.c_str(), "wb" );
+
+  if (f == NULL)
+    return false;
+
+  int channels = (image->hasAlpha ? 4 : 3);
+  size_t bytes = (size_t) image->width * image->height * channels;
+
+  fprintf( f, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+	   image->width, image->height, channels, image->hasAlpha ? "RGB_ALPHA" : "RGB" );
+
+  bool ok = (fwrite( image->texmap, 1, bytes, f ) == bytes);
+
+  if (fclose( f ) != 0)
+    ok = false;
+
+  return ok;
+}
+
+
+
+bool writePPM( Image *image, string filename )
+
+{
+  FILE *f = fopen( filename.c_str(), "wb" );
+
+  if (f == NULL)
+    return false;
+
+  fprintf( f, "P6\n%u %u\n255\n", image->width, image->height );
+
+  bool ok;
+
+  if (!image->hasAlpha) {
+
+    size_t bytes = (size_t) image->width * image->height * 3;
+    ok = (fwrite( image->texmap, 1, bytes, f ) == bytes);
+
+  } else {
+
+    // Drop alpha a row at a time
+
+    std::vector<unsigned char> row( image->width * 3 );
+
+    ok = true;
+
+    for (unsigned int y=0; y<image->height && ok; y++) {
+
+      unsigned char *p = image->row<4>( y );
+      unsigned char *q = row.data();
+
+      for (unsigned int x=0; x<image->width; x++, p+=4) {
+	*q++ = p[0];
+	*q++ = p[1];
+	*q++ = p[2];
+      }
+
+      ok = (fwrite( row.data(), 1, row.size(), f ) == row.size());
+    }
+  }
+
+  if (fclose( f ) != 0)
+    ok = false;
+
+  return ok;
+}
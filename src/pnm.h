@@ -0,0 +1,44 @@
+// pnm.h
+//
+// The binary Netpbm formats: PPM (P6), PGM (P5) and PAM (P7).
+//
+// These have a short text header followed by the raw pixels, row by
+// row, in the same layout as Image::texmap.  So RGB and RGBA files are
+// read with one fread() straight into the texmap, and written with one
+// fwrite() straight from it.  Grey and grey+alpha files are read into
+// the back of the texmap and expanded towards the front.
+//
+// Only 8-bit samples (MAXVAL 255) are supported.
+
+
+#ifndef PNM_H
+#define PNM_H
+
+#include "coreHeaders.h"
+#include "image.h"
+
+#include <string>
+
+
+// Read a PPM, PGM or PAM file.  As in decodePNG(), the pixels are put
+// in '*out', which is allocated with new[] for the caller to own and
+// has RGB_PADDING spare bytes after an RGB image.  They are RGBA if
+// the file has alpha, and otherwise RGB.  Returns NULL on success, or
+// a description of the error.
+
+const char *readPNM( string filename, unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha );
+
+
+// Write 'image' as a PAM file, with TUPLTYPE RGB_ALPHA if it has alpha
+// and RGB otherwise.  Returns false if it could not be written.
+
+bool writePAM( Image *image, string filename );
+
+
+// Write 'image' as a PPM file.  Alpha is dropped.  Returns false if it
+// could not be written.
+
+bool writePPM( Image *image, string filename );
+
+
+#endif
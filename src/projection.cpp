@@ -0,0 +1,522 @@
+// projection.cpp
+
+
+#include "projection.h"
+#include "intensity.h"
+
+
+
+#define PROJECTION_TILE_ROWS  32      // rows projected between checks for cancellation
+#define PROJECTION_BAND_BYTES 262144  // at most this much of the destination in a band, so a band stays in L2 cache
+
+
+// Rows in each band of 'image' that is projected
+
+static int bandRows( Image *image )
+
+{
+  int rowBytes = image->width * (image->hasAlpha ? 4 : 3);
+  int rows = PROJECTION_BAND_BYTES / (rowBytes > 0 ? rowBytes : 1);
+
+  if (rows < 1)
+    rows = 1;
+  if (rows > PROJECTION_TILE_ROWS)
+    rows = PROJECTION_TILE_ROWS;
+
+  return rows;
+}
+
+
+template <int CHANNELS> static bool projectSampled( Image *srcImage, Image *destImage, ProjectionParams &params, affine2d &T_inverse, ProjectionCanceller *canceller, ProjectionBandListener *listener );
+
+
+
+// The bounding rectangle, in an image of 'width' x 'height', of the
+// transform by T of a 'srcWidth' x 'srcHeight' image.  It has a
+// margin of one pixel to allow for rounding and for sampling at pixel
+// centres.
+
+static PixelRect transformedBounds( affine2d &T, unsigned int srcWidth, unsigned int srcHeight, unsigned int width, unsigned int height )
+
+{
+  vec2 corners[4] = { T * vec2( 0,        0         ),
+		      T * vec2( srcWidth, 0         ),
+		      T * vec2( 0,        srcHeight ),
+		      T * vec2( srcWidth, srcHeight ) };
+
+  float xmin = corners[0].x, xmax = corners[0].x;
+  float ymin = corners[0].y, ymax = corners[0].y;
+
+  for (int i=1; i<4; i++) {
+    xmin = fmin( xmin, corners[i].x );
+    xmax = fmax( xmax, corners[i].x );
+    ymin = fmin( ymin, corners[i].y );
+    ymax = fmax( ymax, corners[i].y );
+  }
+
+  if (!std::isfinite( xmin+xmax+ymin+ymax )) // degenerate transform: assume everything is covered
+    return PixelRect( 0, 0, width, height );
+
+  // Clamp before converting to int, since the corners can be far away
+
+  xmin = fmax( floor(xmin) - 1, 0 );
+  ymin = fmax( floor(ymin) - 1, 0 );
+  xmax = fmin( ceil(xmax) + 1, width );
+  ymax = fmin( ceil(ymax) + 1, height );
+
+  PixelRect r( xmin, ymin, xmax, ymax );
+
+  if (r.empty())
+    r.x1 = r.x0 = r.y1 = r.y0 = 0;
+
+  return r;
+}
+
+
+
+// Make transparent the pixels of 'image' that are within its
+// footprint but outside 'covered', then make 'covered' its footprint.
+// Only pixels that were non-transparent after the previous projection
+// are touched.
+
+static void clearUncovered( Image *image, PixelRect &covered )
+
+{
+  PixelRect &old = image->footprint;
+
+  Pixel transparentPixel = { 0,0,0,0 };
+
+  for (int y=old.y0; y<old.y1; y++) {
+
+    Pixel *row = &image->pixel( 0, y );
+
+    if (y < covered.y0 || y >= covered.y1 || covered.empty())
+      for (int x=old.x0; x<old.x1; x++)
+	row[x] = transparentPixel;
+    else {
+      for (int x=old.x0; x<old.x1 && x<covered.x0; x++)
+	row[x] = transparentPixel;
+      for (int x=max(old.x0,covered.x1); x<old.x1; x++)
+	row[x] = transparentPixel;
+    }
+  }
+
+  image->footprint = covered;
+}
+
+
+
+// Take the source image, apply the transform in 'params', and store
+// the transformed image in the destination image.
+//
+// Where a pixel in the destination image has no corresponding (valid)
+// pixel in the source image, use the 'transparentPixel'
+//
+// Also apply the intensity transform.
+//
+// Only the destination pixels within the bounding rectangle of the
+// transformed source are computed.  Those outside it that the
+// previous projection into 'destImage' covered are cleared, and the
+// rectangle becomes the destination's footprint.  The footprint is
+// correct even if the projection is abandoned part way, since the
+// clearing is done first.
+//
+// The work is done in bands of at most PROJECTION_TILE_ROWS rows.  If
+// a 'canceller' is given and reports that the work is no longer
+// wanted (e.g. a worker has since received a newer request), this
+// stops after the current band and returns false.  Otherwise it
+// returns true.
+//
+// If a 'listener' is given, it is told of each band of the footprint
+// as the band is finished.  Forward projection can write to any
+// destination row, so there the whole footprint is one band.
+//
+// The source may be RGB or RGBA.  The destination must be RGBA, as
+// it gets transparent pixels.
+
+template <int CHANNELS> static bool projectImage( Image *srcImage, Image *destImage, ProjectionParams &params, ProjectionCanceller *canceller, ProjectionBandListener *listener );
+
+
+bool project( Image *srcImage, Image *destImage, ProjectionParams &params, ProjectionCanceller *canceller, ProjectionBandListener *listener )
+
+{
+  // Check that dimensions match
+  
+  if (srcImage->width != destImage->width || srcImage->height != destImage->height) {
+    cerr << "in project() the source and destination images have different dimensions" << endl;
+    exit(1);
+  }
+
+  if (!destImage->hasAlpha) {
+    cerr << "in project() the destination image has no alpha channel" << endl;
+    exit(1);
+  }
+
+  if (srcImage->hasAlpha)
+    return projectImage<4>( srcImage, destImage, params, canceller, listener );
+  else
+    return projectImage<3>( srcImage, destImage, params, canceller, listener );
+}
+
+
+template <int CHANNELS> static bool projectImage( Image *srcImage, Image *destImage, ProjectionParams &params, ProjectionCanceller *canceller, ProjectionBandListener *listener )
+
+{
+  // Project
+
+  affine2d T = params.transform;
+
+  float M = params.intensityScale;
+  float B = params.intensityBias;
+  
+  Pixel transparentPixel = { 0,0,0,0 }; // fully transparent pixel (alpha = 0, so r,g,b doesn't matter)
+
+  // Destination pixels that the source can reach
+
+  PixelRect covered = transformedBounds( T, srcImage->width, srcImage->height, destImage->width, destImage->height );
+
+  clearUncovered( destImage, covered );
+    
+  if (params.projectionMode == FORWARD) { // Forward projection
+    
+    // Set the covered part of the image to transparent pixels in case
+    // there are destination locations that do not get written to with
+    // forward projection.
+
+    for (int y=covered.y0; y<covered.y1; y++)
+      for (int x=covered.x0; x<covered.x1; x++)
+        destImage->pixel( x, y ) = transparentPixel;
+
+    // Do the forward projection, visiting only the source pixels that
+    // can land in the destination image
+
+    affine2d T_inverse = T.inverse();
+
+    PixelRect visible = transformedBounds( T_inverse, destImage->width, destImage->height, srcImage->width, srcImage->height );
+
+    int rows = bandRows( srcImage );
+
+    for (int y0=visible.y0; y0<visible.y1; y0+=rows) {
+
+      if (canceller != NULL && canceller->cancelled())
+	return false;
+
+      for (int y=y0; y<y0+rows && y<visible.y1; y++) {
+
+	unsigned char *srcRow = srcImage->row<CHANNELS>( y );
+
+	// Destination position of (x,y), which moves by (T.a,T.c) with each step in x
+
+	double destX = T.a * visible.x0 + T.b * y + T.tx;
+	double destY = T.c * visible.x0 + T.d * y + T.ty;
+
+	for (int x=visible.x0; x<visible.x1; x++, destX += T.a, destY += T.c)
+	  if (destX >= 0 && destX < destImage->width && destY >= 0 && destY < destImage->height) {
+
+	    Pixel p = readPixel<CHANNELS>( srcRow + CHANNELS * x );
+
+	    p = applyIntensityTransform( p, M, B );
+	  
+	    destImage->pixel( (int) destX, (int) destY ) = p;
+	  }
+      }
+    }
+
+    if (listener != NULL && !covered.empty())
+      listener->bandProjected( destImage, covered.y0, covered.y1 );
+
+  } else { // Backward projection
+
+    // Where a destination pixel has no corresponding source pixel,
+    // set the destination pixel to 'transparentPixel'.
+    // 
+    // Note that the inverse must not be recalculated with every
+    // iteration of the loops.  That's incredibly slow.  Use 'inverse'
+    // from linalg.h.
+    //
+    // Use 'applyIntensityTransform()' as above.
+    
+    // YOUR CODE HERE
+
+    // Calculate inverse transformation once for efficiency
+    affine2d T_inverse = T.inverse();
+
+    // Interpolated or mip-mapped sampling is done separately
+
+    if (params.interpolation != NEAREST || params.mipMapping != NO_MIPMAPS)
+      return projectSampled<CHANNELS>( srcImage, destImage, params, T_inverse, canceller, listener );
+    
+    // For each covered destination pixel, a band of rows at a time
+    int rows = bandRows( destImage );
+
+    for (int y0=covered.y0; y0<covered.y1; y0+=rows) {
+
+      if (canceller != NULL && canceller->cancelled())
+	return false;
+
+      for (int y=y0; y<y0+rows && y<covered.y1; y++) {
+
+	// Apply inverse transform to find the source position of the
+	// pixel centre, as projectSampled() does, so that the
+	// interpolations all agree under an identity transform.  It
+	// moves by (T_inverse.a,T_inverse.c) with each step in x.
+	double srcX = T_inverse.a * (covered.x0+0.5) + T_inverse.b * (y+0.5) + T_inverse.tx;
+	double srcY = T_inverse.c * (covered.x0+0.5) + T_inverse.d * (y+0.5) + T_inverse.ty;
+
+	for (int x=covered.x0; x<covered.x1; x++, srcX += T_inverse.a, srcY += T_inverse.c) {
+        
+	  // Check if source position is within valid bounds
+	  if (srcX >= 0 && srcX < srcImage->width && 
+	      srcY >= 0 && srcY < srcImage->height) {
+          
+	    // Valid source pixel - copy it and apply intensity transform
+	    Pixel p = readPixel<CHANNELS>( srcImage->row<CHANNELS>( (int) srcY ) + CHANNELS * (int) srcX ); // The casting performs nearest-neighbor sampling
+	    p = applyIntensityTransform(p, M, B);
+	    destImage->pixel(x, y) = p;
+          
+	  } else {
+	    // No valid source pixel - use transparent pixel
+	    destImage->pixel(x, y) = transparentPixel;
+	  }
+	}
+      }
+
+      if (listener != NULL)
+	listener->bandProjected( destImage, y0, min( y0+rows, covered.y1 ) );
+    }
+  }
+
+  return true;
+}
+
+
+
+// Backward projection with interpolation and/or mip mapping.
+//
+// The source is sampled at the position of the destination pixel's
+// centre, (x+0.5,y+0.5), so that an identity transform reproduces
+// the source exactly.
+//
+// When the transform shrinks the image and mip mapping is on, the
+// samples come from the level of the source's mip map that best
+// matches the amount of shrinking, or (with trilinear mip mapping)
+// from the two nearest levels, blended.
+//
+// With an axis-aligned transform, the source x depends only on the
+// destination column and the source y only on the destination row,
+// so the filter taps are found once per column and per row.
+//
+// Only the destination's footprint, as set by project(), is computed.
+
+
+template <int CHANNELS> static bool projectSampled( Image *srcImage, Image *destImage, ProjectionParams &params, affine2d &T_inverse, ProjectionCanceller *canceller, ProjectionBandListener *listener )
+
+{
+  float M = params.intensityScale;
+  float B = params.intensityBias;
+
+  Pixel transparentPixel = { 0,0,0,0 };
+
+  // Choose the source level(s).  'lod' is log2 of the number of
+  // source pixels per destination pixel.
+
+  float lod = 0.5 * log2( fabs( T_inverse.determinant() ) );
+
+  int   levelNum[2] = { 0, 0 };
+  int   nLevels     = 1;
+  float blend       = 0; // weight of the second level
+
+  if (params.mipMapping != NO_MIPMAPS && lod > 0) {
+
+    int maxLevel = srcImage->numMipMapLevels() - 1;
+
+    if (params.mipMapping == NEAREST_MIPMAP) {
+      levelNum[0] = (int) floor( lod + 0.5 );
+      if (levelNum[0] > maxLevel)
+	levelNum[0] = maxLevel;
+    } else {
+      levelNum[0] = (int) floor( lod );
+      blend = lod - levelNum[0];
+      if (levelNum[0] >= maxLevel) {
+	levelNum[0] = maxLevel;
+	blend = 0;
+      } else if (blend > 0) {
+	levelNum[1] = levelNum[0] + 1;
+	nLevels = 2;
+      }
+    }
+  }
+
+  Image *level[2];
+  float    levelScale[2]; // level pixels per source pixel
+
+  for (int l=0; l<nLevels; l++) {
+    level[l]      = srcImage->mipMap( levelNum[l] );
+    levelScale[l] = 1.0 / (1 << levelNum[l]);
+  }
+
+  PixelRect covered = destImage->footprint;
+
+  bool axisAligned = (T_inverse.b == 0 && T_inverse.c == 0);
+
+  SampleTaps *columnTaps[2] = { NULL, NULL };
+
+  if (axisAligned)
+    for (int l=0; l<nLevels; l++) {
+      columnTaps[l] = new SampleTaps[ destImage->width ];
+      for (int x=covered.x0; x<covered.x1; x++) {
+	double srcX = T_inverse.a * (x+0.5) + T_inverse.tx;
+	findTaps( params.interpolation, srcX * levelScale[l], level[l]->width, columnTaps[l][x] );
+	columnTaps[l][x].inside = (srcX >= 0 && srcX < srcImage->width);
+      }
+    }
+
+  bool finished = true;
+
+  int rows = bandRows( destImage );
+
+  for (int y0=covered.y0; y0<covered.y1 && finished; y0+=rows) {
+
+    if (canceller != NULL && canceller->cancelled()) {
+      finished = false;
+      break;
+    }
+
+    for (int y=y0; y<y0+rows && y<covered.y1; y++) {
+
+      SampleTaps rowTaps[2], xTaps[2];
+
+      if (axisAligned)
+	for (int l=0; l<nLevels; l++) {
+	  double srcY = T_inverse.d * (y+0.5) + T_inverse.ty;
+	  findTaps( params.interpolation, srcY * levelScale[l], level[l]->height, rowTaps[l] );
+	  rowTaps[l].inside = (srcY >= 0 && srcY < srcImage->height);
+	}
+
+      // Source position of the pixel centre, for a general transform
+
+      double srcX = T_inverse.a * (covered.x0+0.5) + T_inverse.b * (y+0.5) + T_inverse.tx;
+      double srcY = T_inverse.c * (covered.x0+0.5) + T_inverse.d * (y+0.5) + T_inverse.ty;
+
+      for (int x=covered.x0; x<covered.x1; x++, srcX += T_inverse.a, srcY += T_inverse.c) {
+
+	Pixel p[2];
+	bool  inside = true;
+
+	for (int l=0; l<nLevels && inside; l++) {
+
+	  SampleTaps *tx, *ty;
+
+	  if (axisAligned) {
+	    tx = &columnTaps[l][x];
+	    ty = &rowTaps[l];
+	  } else {
+	    findTaps( params.interpolation, srcX * levelScale[l], level[l]->width,  xTaps[l] );
+	    findTaps( params.interpolation, srcY * levelScale[l], level[l]->height, rowTaps[l] );
+	    xTaps[l].inside   = (srcX >= 0 && srcX < srcImage->width);
+	    rowTaps[l].inside = (srcY >= 0 && srcY < srcImage->height);
+	    tx = &xTaps[l];
+	    ty = &rowTaps[l];
+	  }
+
+	  inside = (tx->inside && ty->inside);
+
+	  if (params.interpolation == BILINEAR)
+	    p[l] = sampleBilinear<CHANNELS>( level[l], *tx, *ty );
+	  else
+	    p[l] = sampleSeparable<CHANNELS>( level[l], params.interpolation, *tx, *ty );
+	}
+
+	if (!inside)
+	  destImage->pixel(x, y) = transparentPixel;
+	else {
+	  if (nLevels == 2)
+	    p[0] = blendPixels( p[0], p[1], blend );
+	  destImage->pixel(x, y) = applyIntensityTransform( p[0], M, B );
+	}
+      }
+    }
+
+    if (listener != NULL)
+      listener->bandProjected( destImage, y0, min( y0+rows, covered.y1 ) );
+  }
+
+  for (int l=0; l<nLevels; l++)
+    delete [] columnTaps[l];
+
+  return finished;
+}
+
+
+
+// Reduce 'srcImage' by 'factor' into 'destImage' by averaging each
+// factor x factor block.  Blocks at the right and bottom edges may be
+// partial.  Both images have CHANNELS bytes per pixel.
+
+template <int CHANNELS> static void shrinkChannels( Image *srcImage, Image *destImage, int factor )
+
+{
+  for (unsigned int y=0; y<destImage->height; y++) {
+
+    unsigned char *destRow = destImage->row<CHANNELS>( y );
+
+    for (unsigned int x=0; x<destImage->width; x++) {
+
+      unsigned int sum[4] = { 0, 0, 0, 0 };
+      unsigned int n = 0;
+
+      for (unsigned int sy=y*factor; sy<(y+1)*factor && sy<srcImage->height; sy++) {
+	unsigned char *srcRow = srcImage->row<CHANNELS>( sy );
+	for (unsigned int sx=x*factor; sx<(x+1)*factor && sx<srcImage->width; sx++) {
+	  for (int c=0; c<CHANNELS; c++)
+	    sum[c] += srcRow[ CHANNELS*sx + c ];
+	  n++;
+	}
+      }
+
+      for (int c=0; c<CHANNELS; c++)
+	destRow[ CHANNELS*x + c ] = (sum[c] + n/2) / n;
+    }
+  }
+}
+
+
+void shrinkImage( Image *srcImage, Image *destImage, int factor )
+
+{
+  if (srcImage->hasAlpha != destImage->hasAlpha) {
+    cerr << "in shrinkImage() the source and destination images have different channels" << endl;
+    exit(1);
+  }
+
+  if (srcImage->hasAlpha)
+    shrinkChannels<4>( srcImage, destImage, factor );
+  else
+    shrinkChannels<3>( srcImage, destImage, factor );
+}
+
+
+
+// Enlarge 'srcImage' by 'factor' into 'destImage' by replicating
+// each pixel into a factor x factor block.  Only the enlarged
+// footprint of 'srcImage' is copied; the rest of 'destImage' is
+// cleared as in project().
+
+void enlargeImage( Image *srcImage, Image *destImage, int factor )
+
+{
+  PixelRect covered( srcImage->footprint.x0 * factor,
+		     srcImage->footprint.y0 * factor,
+		     min( srcImage->footprint.x1 * factor, (int) destImage->width ),
+		     min( srcImage->footprint.y1 * factor, (int) destImage->height ) );
+
+  clearUncovered( destImage, covered );
+
+  for (int y=covered.y0; y<covered.y1; y++) {
+
+    Pixel *srcRow = &srcImage->pixel( 0, y / factor );
+
+    for (int x=covered.x0; x<covered.x1; x++)
+      destImage->pixel( x, y ) = srcRow[ x / factor ];
+  }
+}
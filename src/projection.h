@@ -0,0 +1,62 @@
+// projection.h
+//
+// Geometric projection of an image by a 2D affine transform, with
+// the intensity transform applied on the way.  This is part of the
+// image core and does not need OpenGL.
+
+
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include "coreHeaders.h"
+#include "image.h"
+#include "resample.h"
+
+
+typedef enum { FORWARD, BACKWARD } ProjectionMode;
+typedef enum { NO_MIPMAPS, NEAREST_MIPMAP, TRILINEAR_MIPMAP } MipMapping;
+
+
+// A snapshot of everything that project() needs, so that a
+// projection can be computed while the editing parameters change.
+
+struct ProjectionParams {
+  affine2d       transform;       // geometric transform, source to destination
+  float          intensityScale;  // M in Y' = Y * M + B
+  float          intensityBias;   // B in Y' = Y * M + B
+  ProjectionMode projectionMode;
+  Interpolation  interpolation;   // sampling of the source image in backward projection
+  MipMapping     mipMapping;      // use of the source's mip map when backward projection shrinks
+  int            shrink;          // 1 for full resolution, or 2, 4, or 8 for a reduced-resolution preview
+};
+
+
+// Something that can tell a long projection to stop early, such as a
+// worker thread that has received a newer request
+
+class ProjectionCanceller {
+ public:
+  virtual ~ProjectionCanceller() {}
+  virtual bool cancelled() = 0;
+};
+
+
+// Something that is told as each band of destination rows is
+// projected, so that it can do more work on the band while the band
+// is still in cache.  Bands are finished in order from the top.
+
+class ProjectionBandListener {
+ public:
+  virtual ~ProjectionBandListener() {}
+  virtual void bandProjected( Image *destImage, int y0, int y1 ) = 0;
+};
+
+
+bool project( Image *srcImage, Image *destImage, ProjectionParams &params,
+	      ProjectionCanceller *canceller = NULL, ProjectionBandListener *listener = NULL );
+
+void shrinkImage( Image *srcImage, Image *destImage, int factor );
+void enlargeImage( Image *srcImage, Image *destImage, int factor );
+
+
+#endif
@@ -0,0 +1,173 @@
+// projectionWorker.cpp
+
+
+#include "projectionWorker.h"
+
+
+// The displayed image's texmap becomes the initial front buffer.  The
+// other two buffers are copies of it, so a frame received before the
+// first projection finishes still shows something sensible.
+
+ProjectionWorker::ProjectionWorker( Editor *ed, Texture *displayedImage, void (*frameReady)() )
+
+{
+  editor = ed;
+  frameReadyCallback = frameReady;
+
+  backImage = new Image( *displayedImage );
+
+  unsigned int nBytes = displayedImage->width * displayedImage->height * (displayedImage->hasAlpha ? 4 : 3);
+
+  buffers[0] = displayedImage->texmap;
+  buffers[1] = new GLubyte[ nBytes ];
+  buffers[2] = backImage->texmap;
+
+  memcpy( buffers[1], buffers[0], nBytes );
+
+  for (int i=0; i<3; i++)
+    footprints[i] = PixelRect( 0, 0, displayedImage->width, displayedImage->height );
+
+  frontIndex = 0;
+  backIndex  = 2;
+  readyState.store( 1 );
+
+  pendingSrc = NULL;
+  hasPending = false;
+  busy       = false;
+  quitting   = false;
+
+  latestGeneration.store( 0 );
+  workingGeneration = 0;
+
+  thread = std::thread( &ProjectionWorker::run, this );
+}
+
+
+
+ProjectionWorker::~ProjectionWorker()
+
+{
+  {
+    std::unique_lock<std::mutex> lock( mutex );
+    quitting = true;
+    latestGeneration++; // abandon any current work
+  }
+  wakeWorker.notify_one();
+
+  thread.join();
+
+  // The front buffer belongs to the displayed image.  Free the others.
+
+  for (int i=0; i<3; i++)
+    if (i != frontIndex)
+      delete [] buffers[i];
+
+  backImage->texmap = NULL;
+  delete backImage;
+}
+
+
+
+// Replace any pending request with this one.  If the worker is busy
+// with an older request, it abandons that request at its next tile.
+
+void ProjectionWorker::request( Image *srcImage, ProjectionParams &params )
+
+{
+  {
+    std::unique_lock<std::mutex> lock( mutex );
+    pendingSrc    = srcImage;
+    pendingParams = params;
+    hasPending    = true;
+    latestGeneration++;
+  }
+  wakeWorker.notify_one();
+}
+
+
+
+// Drop any pending request, abandon the current one, and wait until
+// the worker is idle.  After this returns, the caller may modify or
+// delete the source image of earlier requests.
+
+void ProjectionWorker::cancelAndWait()
+
+{
+  std::unique_lock<std::mutex> lock( mutex );
+
+  hasPending = false;
+  latestGeneration++;
+
+  while (busy)
+    workerIdle.wait( lock );
+}
+
+
+
+// If a new frame has been published, swap it into 'displayedImage'
+// and return true.  The previous front buffer goes back to the worker.
+
+bool ProjectionWorker::receive( Texture *displayedImage )
+
+{
+  if (!(readyState.load( std::memory_order_acquire ) & FRESH_FRAME))
+    return false;
+
+  frontIndex = readyState.exchange( frontIndex, std::memory_order_acq_rel ) & ~FRESH_FRAME;
+
+  displayedImage->texmap = buffers[ frontIndex ];
+
+  return true;
+}
+
+
+
+// Worker thread: wait for a request, render it into the back buffer,
+// and publish the result unless it was abandoned.
+
+void ProjectionWorker::run()
+
+{
+  while (true) {
+
+    Image *src;
+    ProjectionParams params;
+
+    {
+      std::unique_lock<std::mutex> lock( mutex );
+
+      while (!hasPending && !quitting)
+        wakeWorker.wait( lock );
+
+      if (quitting)
+        return;
+
+      src    = pendingSrc;
+      params = pendingParams;
+
+      hasPending = false;
+      busy       = true;
+
+      workingGeneration = latestGeneration.load();
+    }
+
+    backImage->texmap    = buffers[ backIndex ];
+    backImage->footprint = footprints[ backIndex ];
+
+    bool finished = editor->render( src, backImage, params, this );
+
+    footprints[ backIndex ] = backImage->footprint; // valid even if abandoned
+
+    if (finished)
+      backIndex = readyState.exchange( backIndex | FRESH_FRAME, std::memory_order_acq_rel ) & ~FRESH_FRAME;
+
+    {
+      std::unique_lock<std::mutex> lock( mutex );
+      busy = false;
+    }
+    workerIdle.notify_all();
+
+    if (finished && frameReadyCallback != NULL)
+      frameReadyCallback();
+  }
+}
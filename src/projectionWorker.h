@@ -0,0 +1,91 @@
+// projectionWorker.h
+//
+// Run Editor::project() on a background thread so that a slow
+// projection never holds up input handling or drawing.
+//
+// Requests are parameter snapshots.  Only the newest request is
+// computed: a request that arrives while an older one is being
+// computed causes the older one to be abandoned at the next tile.
+//
+// Finished frames are handed to the rendering thread through a
+// lock-free triple buffer.  The renderer owns the 'front' buffer
+// (which is the displayed image's texmap), the worker owns the 'back'
+// buffer, and the most recently finished frame waits in the 'ready'
+// slot.  Buffers are exchanged with a single atomic operation, so
+// neither side ever waits for the other.
+
+
+#ifndef PROJECTION_WORKER_H
+#define PROJECTION_WORKER_H
+
+#include "headers.h"
+#include "texture.h"
+#include "editor.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+
+class ProjectionWorker : public ProjectionCanceller {
+
+  Editor *editor;
+
+  std::thread             thread;
+  std::mutex              mutex;
+  std::condition_variable wakeWorker;   // a request arrived, or quitting
+  std::condition_variable workerIdle;   // worker finished or abandoned a request
+
+  // Pending request (protected by 'mutex')
+
+  Image            *pendingSrc;
+  ProjectionParams  pendingParams;
+  bool              hasPending;
+  bool              busy;
+  bool              quitting;
+
+  // Each request gets a new generation number.  The worker abandons
+  // its current request when 'latestGeneration' moves past it.
+
+  std::atomic<unsigned int> latestGeneration;
+  unsigned int              workingGeneration; // used only by the worker thread
+
+  // Triple buffer of pixel storage.  'readyState' holds the index of
+  // the ready buffer, plus FRESH_FRAME if it has not been received.
+
+  static const int FRESH_FRAME = 4;
+
+  GLubyte          *buffers[3];
+  int               frontIndex;  // used only by the rendering thread
+  int               backIndex;   // used only by the worker thread
+  std::atomic<int>  readyState;
+
+  PixelRect footprints[3];       // footprint of each buffer's last projection
+
+  Image *backImage;              // wraps buffers[backIndex] for project()
+
+  void (*frameReadyCallback)();  // called from the worker thread after a frame is published
+
+  void run();
+
+ public:
+
+  ProjectionWorker( Editor *ed, Texture *displayedImage, void (*frameReady)() );
+  ~ProjectionWorker();
+
+  // Called from the rendering thread
+
+  void request( Image *srcImage, ProjectionParams &params );
+  void cancelAndWait();
+  bool receive( Texture *displayedImage );
+
+  // Called from project() on the worker thread
+
+  bool cancelled() {
+    return latestGeneration.load( std::memory_order_relaxed ) != workingGeneration;
+  }
+};
+
+
+#endif
@@ -0,0 +1,347 @@
+// qoi.cpp
+//
+// See the QOI specification, version 1.0 (qoiformat.org).
+
+
+#include "qoi.h"
+
+#include <cstdint>
+#include <new>
+
+
+#define QOI_OP_INDEX  0x00      // 00iiiiii: the colour in index[i]
+#define QOI_OP_DIFF   0x40      // 01rrggbb: r,g,b differ from the previous pixel by -2..1
+#define QOI_OP_LUMA   0x80      // 10gggggg rrrrbbbb: g differs by -32..31, and r,b by g-8..g+7
+#define QOI_OP_RUN    0xc0      // 11rrrrrr: the previous pixel repeated 1..62 times
+#define QOI_OP_RGB    0xfe      // r,g,b follow
+#define QOI_OP_RGBA   0xff      // r,g,b,a follow
+#define QOI_MASK_2    0xc0
+
+#define QOI_HEADER_BYTES 14
+#define QOI_END_BYTES    8      // the end marker
+#define QOI_MAX_PIXELS   400000000 // as in the reference implementation
+
+#if RGB_PADDING < 1
+  #error "decodePixels<3>() writes a byte past the image"
+#endif
+
+static const unsigned char qoiEndMarker[ QOI_END_BYTES ] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+
+// A pixel as r,g,b,a bytes, which can be compared as one word
+
+union QOIPixel {
+  unsigned char c[4];
+  uint32_t      word;
+};
+
+
+static inline int qoiHash( QOIPixel p )
+
+{
+  return (p.c[0] * 3 + p.c[1] * 5 + p.c[2] * 7 + p.c[3] * 11) & 63;
+}
+
+
+
+// ---------------- Decoding ----------------
+
+
+// Decode the chunks in 'in' (after the header) into 'numPixels' pixels
+// of CHANNELS bytes.  Each pixel is stored as four bytes, so with RGB
+// the last one needs a spare byte after the image, which RGB_PADDING
+// gives.  Returns false if
+// the chunks end before the image is complete.
+
+template <int CHANNELS> static bool decodePixels( unsigned char *out, size_t numPixels, const unsigned char *in, size_t inSize )
+
+{
+  QOIPixel index[64];
+  memset( index, 0, sizeof(index) );
+
+  QOIPixel px;
+  px.c[0] = px.c[1] = px.c[2] = 0;
+  px.c[3] = 255;
+
+  size_t p   = 0;
+  size_t end = (inSize > QOI_END_BYTES ? inSize - QOI_END_BYTES : 0); // chunks never extend into the end marker
+  int    run = 0;
+
+  unsigned char *q    = out;
+  unsigned char *qEnd = out + numPixels * CHANNELS;
+
+  while (q < qEnd) {
+
+    if (run > 0)
+      run--;
+
+    else {
+
+      if (p >= end)
+	return false;
+
+      int b1 = in[p++];
+
+      if (b1 == QOI_OP_RGB) {
+	if (p + 3 > end)
+	  return false;
+	px.c[0] = in[p];
+	px.c[1] = in[p+1];
+	px.c[2] = in[p+2];
+	p += 3;
+      } else if (b1 == QOI_OP_RGBA) {
+	if (p + 4 > end)
+	  return false;
+	memcpy( px.c, in + p, 4 );
+	p += 4;
+      } else
+	switch (b1 & QOI_MASK_2) {
+	case QOI_OP_INDEX:
+	  px = index[ b1 ];
+	  break;
+	case QOI_OP_DIFF:
+	  px.c[0] += ((b1 >> 4) & 3) - 2;
+	  px.c[1] += ((b1 >> 2) & 3) - 2;
+	  px.c[2] += ( b1       & 3) - 2;
+	  break;
+	case QOI_OP_LUMA: {
+	  if (p + 1 > end)
+	    return false;
+	  int b2 = in[p++];
+	  int vg = (b1 & 0x3f) - 32;
+	  px.c[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+	  px.c[1] += vg;
+	  px.c[2] += vg - 8 +  (b2       & 0x0f);
+	  break;
+	}
+	case QOI_OP_RUN:
+	  run = (b1 & 0x3f);
+	  break;
+	}
+
+      index[ qoiHash( px ) ] = px;
+    }
+
+    memcpy( q, px.c, 4 ); // an RGB pixel's fourth byte is overwritten by the next pixel
+    q += CHANNELS;
+  }
+
+  return true;
+}
+
+
+
+static inline uint32_t getBigEndian32( const unsigned char *p )
+
+{
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+
+
+const char *decodeQOI( unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha,
+		       const unsigned char *in, size_t inSize )
+
+{
+  if (inSize < QOI_HEADER_BYTES + QOI_END_BYTES || memcmp( in, "qoif", 4 ) != 0)
+    return "not a QOI file";
+
+  width  = getBigEndian32( in + 4 );
+  height = getBigEndian32( in + 8 );
+
+  int channels   = in[12];
+  int colourSpace = in[13];
+
+  if (width == 0 || height == 0 || height >= QOI_MAX_PIXELS / width ||
+      (channels != 3 && channels != 4) || colourSpace > 1)
+    return "invalid QOI header";
+
+  size_t numPixels = (size_t) width * height;
+
+  unsigned char *pixels = new (std::nothrow) unsigned char[ numPixels * channels + (channels == 3 ? RGB_PADDING : 0) ];
+
+  if (pixels == NULL)
+    return "not enough memory for the image";
+
+  bool ok;
+
+  if (channels == 4)
+    ok = decodePixels<4>( pixels, numPixels, in + QOI_HEADER_BYTES, inSize - QOI_HEADER_BYTES );
+  else
+    ok = decodePixels<3>( pixels, numPixels, in + QOI_HEADER_BYTES, inSize - QOI_HEADER_BYTES );
+
+  if (!ok) {
+    delete [] pixels;
+    return "QOI data is truncated";
+  }
+
+  *out     = pixels;
+  hasAlpha = (channels == 4);
+
+  return NULL;
+}
+
+
+
+// ---------------- Encoding ----------------
+
+
+// Encode the pixels of 'image', which has CHANNELS bytes per pixel,
+// at 'o'.  There must be room for CHANNELS+1 bytes per pixel.  Returns
+// the end of the chunks, and whether any pixel is not opaque in
+// 'transparent'.
+
+template <int CHANNELS> static unsigned char *encodePixels( Image *image, unsigned char *o, bool &transparent )
+
+{
+  QOIPixel index[64];
+  memset( index, 0, sizeof(index) );
+
+  QOIPixel prev;
+  prev.c[0] = prev.c[1] = prev.c[2] = 0;
+  prev.c[3] = 255;
+
+  int run = 0;
+  unsigned char minAlpha = 255;
+
+  size_t numPixels = (size_t) image->width * image->height;
+  const unsigned char *src = image->texmap;
+
+  for (size_t i=0; i<numPixels; i++, src += CHANNELS) {
+
+    QOIPixel px;
+    Pixel p = readPixel<CHANNELS>( src );
+    memcpy( px.c, &p, 4 );
+
+    if (px.word == prev.word) {
+      run++;
+      if (run == 62 || i == numPixels-1) {
+	*o++ = QOI_OP_RUN | (run - 1);
+	run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0) {
+      *o++ = QOI_OP_RUN | (run - 1);
+      run = 0;
+    }
+
+    if (CHANNELS == 4 && px.c[3] < minAlpha)
+      minAlpha = px.c[3];
+
+    int h = qoiHash( px );
+
+    if (index[h].word == px.word)
+      *o++ = QOI_OP_INDEX | h;
+
+    else {
+
+      index[h] = px;
+
+      if (px.c[3] == prev.c[3]) {
+
+	int vr = (signed char) (px.c[0] - prev.c[0]);
+	int vg = (signed char) (px.c[1] - prev.c[1]);
+	int vb = (signed char) (px.c[2] - prev.c[2]);
+
+	int vgr = vr - vg;
+	int vgb = vb - vg;
+
+	if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1)
+	  *o++ = QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2);
+
+	else if (vg >= -32 && vg <= 31 && vgr >= -8 && vgr <= 7 && vgb >= -8 && vgb <= 7) {
+	  *o++ = QOI_OP_LUMA | (vg + 32);
+	  *o++ = ((vgr + 8) << 4) | (vgb + 8);
+	}
+
+	else {
+	  *o++ = QOI_OP_RGB;
+	  *o++ = px.c[0];
+	  *o++ = px.c[1];
+	  *o++ = px.c[2];
+	}
+
+      } else {
+	*o++ = QOI_OP_RGBA;
+	memcpy( o, px.c, 4 );
+	o += 4;
+      }
+    }
+
+    prev = px;
+  }
+
+  transparent = (minAlpha != 255);
+
+  return o;
+}
+
+
+
+static inline void putBigEndian32( unsigned char *p, uint32_t v )
+
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+
+
+void encodeQOI( Image *image, std::vector<unsigned char> &out )
+
+{
+  out.resize( QOI_HEADER_BYTES + (size_t) image->width * image->height * (image->hasAlpha ? 5 : 4) + QOI_END_BYTES );
+
+  unsigned char *o = out.data();
+
+  memcpy( o, "qoif", 4 );
+  putBigEndian32( o + 4, image->width );
+  putBigEndian32( o + 8, image->height );
+  o[13] = 0; // sRGB with linear alpha
+  o += QOI_HEADER_BYTES;
+
+  // The chunks are the same with 3 channels and 4, so the number of
+  // channels in the header is only a hint to the reader.  An image
+  // with alpha that is opaque everywhere is marked as RGB, as in
+  // writePNG().
+
+  bool transparent;
+
+  if (image->hasAlpha)
+    o = encodePixels<4>( image, o, transparent );
+  else
+    o = encodePixels<3>( image, o, transparent );
+
+  out[12] = (transparent ? 4 : 3);
+
+  memcpy( o, qoiEndMarker, QOI_END_BYTES );
+  o += QOI_END_BYTES;
+
+  out.resize( o - out.data() );
+}
+
+
+
+bool writeQOI( Image *image, string filename )
+
+{
+  std::vector<unsigned char> qoi;
+
+  encodeQOI( image, qoi );
+
+  FILE *f = fopen( filename.c_str(), "wb" );
+
+  if (f == NULL)
+    return false;
+
+  bool ok = (fwrite( qoi.data(), 1, qoi.size(), f ) == qoi.size());
+
+  if (fclose( f ) != 0)
+    ok = false;
+
+  return ok;
+}
@@ -0,0 +1,43 @@
+// qoi.h
+//
+// The QOI image format ("Quite OK Image", see qoiformat.org).
+//
+// Each pixel is coded in one to five bytes: as a run of the previous
+// pixel, as an index into a 64-entry table of recently seen colours,
+// as a small difference from the previous pixel, or in full.  There
+// is no filtering or entropy coding, so it is coded many times faster
+// than PNG, in files that are somewhat larger.
+
+
+#ifndef QOI_H
+#define QOI_H
+
+#include "coreHeaders.h"
+#include "image.h"
+
+#include <string>
+#include <vector>
+
+
+// Decode the QOI file in 'in'.  As in decodePNG(), the pixels are put
+// in '*out', which is allocated with new[] for the caller to own and
+// has RGB_PADDING spare bytes after an RGB image.  They are RGBA if
+// the file has 4 channels, and otherwise RGB.  Returns NULL on
+// success, or a description of the error.
+
+const char *decodeQOI( unsigned char **out, unsigned &width, unsigned &height, bool &hasAlpha,
+		       const unsigned char *in, size_t inSize );
+
+
+// Encode 'image' as a QOI file in 'out', with 4 channels if it has
+// alpha that is not opaque everywhere, and 3 otherwise.
+
+void encodeQOI( Image *image, std::vector<unsigned char> &out );
+
+
+// Write 'image' as a QOI file.  Returns false if it could not be written.
+
+bool writeQOI( Image *image, string filename );
+
+
+#endif
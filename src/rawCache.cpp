@@ -0,0 +1,318 @@
+// rawCache.cpp
+
+
+#include "rawCache.h"
+#include "image.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <atomic>
+#include <cerrno>
+
+#ifdef _WIN32
+  #include <io.h>
+#else
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+
+#define RAW_CACHE_MAGIC     "IMGRAWC"   // 7 characters and a NUL
+#define RAW_CACHE_VERSION   1
+#define RAW_CACHE_BYTE_ORDER 0x01020304 // reads differently with the other byte order
+
+
+struct RawCacheHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t headerBytes;   // offset of the pixels
+  uint32_t width, height;
+  uint32_t channels;      // 3 or 4
+  uint64_t pixelBytes;    // not including the padding
+  uint64_t sourceSize;
+  int64_t  sourceModifiedSeconds;
+  int64_t  sourceModifiedNanoseconds;
+};
+
+
+
+bool getSourceStamp( string filename, SourceStamp &stamp )
+
+{
+#ifdef _WIN32
+
+  struct _stat64 st;
+
+  if (_stat64( filename.c_str(), &st ) != 0)
+    return false;
+
+  stamp.modifiedNanoseconds = 0;
+
+#else
+
+  struct stat st;
+
+  if (stat( filename.c_str(), &st ) != 0)
+    return false;
+
+  #ifdef __APPLE__
+    stamp.modifiedNanoseconds = st.st_mtimespec.tv_nsec;
+  #else
+    stamp.modifiedNanoseconds = st.st_mtim.tv_nsec;
+  #endif
+
+#endif
+
+  stamp.size            = st.st_size;
+  stamp.modifiedSeconds = st.st_mtime;
+
+  return true;
+}
+
+
+
+string rawCacheName( string filename )
+
+{
+  return filename + ".rawcache";
+}
+
+
+
+// Map all of 'filename' copy-on-write.  Returns NULL if it cannot be
+// mapped.
+
+static void *mapFile( string filename, size_t &size )
+
+{
+  size = 0;
+
+#ifdef _WIN32
+
+  HANDLE file = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+  if (file == INVALID_HANDLE_VALUE)
+    return NULL;
+
+  LARGE_INTEGER fileSize;
+  void *address = NULL;
+
+  if (GetFileSizeEx( file, &fileSize ) && fileSize.QuadPart > 0) {
+
+    HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+
+    if (mapping != NULL) {
+      address = MapViewOfFile( mapping, FILE_MAP_COPY, 0, 0, 0 );
+      CloseHandle( mapping ); // the view keeps the mapping open
+    }
+
+    size = fileSize.QuadPart;
+  }
+
+  CloseHandle( file );
+
+  return address;
+
+#else
+
+  int fd = open( filename.c_str(), O_RDONLY );
+
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  void *address = NULL;
+
+  if (fstat( fd, &st ) == 0 && st.st_size > 0) {
+
+    address = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+
+    if (address == MAP_FAILED)
+      address = NULL;
+
+    size = st.st_size;
+  }
+
+  close( fd ); // the mapping keeps the file open
+
+  return address;
+
+#endif
+}
+
+
+
+void unmapRawCache( void *mapping, size_t mappingSize )
+
+{
+#ifdef _WIN32
+  UnmapViewOfFile( mapping );
+#else
+  munmap( mapping, mappingSize );
+#endif
+}
+
+
+
+unsigned char *mapRawCache( string filename, SourceStamp &stamp,
+			    unsigned int &width, unsigned int &height, bool &hasAlpha,
+			    void *&mapping, size_t &mappingSize )
+
+{
+  size_t size;
+  void *address = mapFile( rawCacheName( filename ), size );
+
+  if (address == NULL)
+    return NULL;
+
+  // Check the header against the source and the file's size
+
+  RawCacheHeader h;
+  bool valid = false;
+
+  if (size >= RAW_CACHE_HEADER_BYTES) {
+
+    memcpy( &h, address, sizeof(h) );
+
+    valid = (memcmp( h.magic, RAW_CACHE_MAGIC, 8 ) == 0 &&
+	     h.version == RAW_CACHE_VERSION &&
+	     h.byteOrder == RAW_CACHE_BYTE_ORDER &&
+	     h.headerBytes == RAW_CACHE_HEADER_BYTES &&
+	     (h.channels == 3 || h.channels == 4) &&
+	     h.width > 0 && h.height > 0 &&
+	     h.pixelBytes == (uint64_t) h.width * h.height * h.channels &&
+	     size == h.headerBytes + h.pixelBytes + (h.channels == 3 ? RGB_PADDING : 0) &&
+	     h.sourceSize == stamp.size &&
+	     h.sourceModifiedSeconds == stamp.modifiedSeconds &&
+	     h.sourceModifiedNanoseconds == stamp.modifiedNanoseconds);
+  }
+
+  if (!valid) {
+    unmapRawCache( address, size );
+    return NULL;
+  }
+
+  width    = h.width;
+  height   = h.height;
+  hasAlpha = (h.channels == 4);
+
+  mapping     = address;
+  mappingSize = size;
+
+  return (unsigned char *) address + h.headerBytes;
+}
+
+
+
+// Create a temporary file beside 'name', with a name of its own, so
+// that processes or threads writing the same cache at once do not
+// write into or rename each other's file.  Returns its name in
+// 'tmpName', or NULL if it could not be created.
+
+static std::atomic<unsigned int> numTempFiles( 0 );
+
+static FILE *createTempFile( string name, string &tmpName )
+
+{
+#ifdef _WIN32
+  string process = std::to_string( GetCurrentProcessId() );
+#else
+  string process = std::to_string( getpid() );
+#endif
+
+  for (int attempt=0; attempt<100; attempt++) {
+
+    tmpName = name + "." + process + "." + std::to_string( numTempFiles++ ) + ".tmp";
+
+#ifdef _WIN32
+
+    int fd = _open( tmpName.c_str(), _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE );
+
+    if (fd >= 0)
+      return _fdopen( fd, "wb" );
+
+#else
+
+    int fd = open( tmpName.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666 ); // exclusive, in case a crashed process left it
+
+    if (fd >= 0) {
+      FILE *f = fdopen( fd, "wb" );
+      if (f == NULL) {
+	close( fd );
+	remove( tmpName.c_str() );
+      }
+      return f;
+    }
+
+#endif
+
+    if (errno != EEXIST)
+      return NULL;
+  }
+
+  return NULL;
+}
+
+
+
+bool writeRawCache( string filename, SourceStamp &stamp,
+		    unsigned char *pixels, unsigned int width, unsigned int height, bool hasAlpha )
+
+{
+  if (width == 0 || height == 0)
+    return false;
+
+  RawCacheHeader h;
+
+  memset( &h, 0, sizeof(h) );
+  memcpy( h.magic, RAW_CACHE_MAGIC, 8 );
+
+  h.version     = RAW_CACHE_VERSION;
+  h.byteOrder   = RAW_CACHE_BYTE_ORDER;
+  h.headerBytes = RAW_CACHE_HEADER_BYTES;
+  h.width       = width;
+  h.height      = height;
+  h.channels    = (hasAlpha ? 4 : 3);
+  h.pixelBytes  = (uint64_t) width * height * h.channels;
+
+  h.sourceSize                = stamp.size;
+  h.sourceModifiedSeconds     = stamp.modifiedSeconds;
+  h.sourceModifiedNanoseconds = stamp.modifiedNanoseconds;
+
+  string name = rawCacheName( filename );
+  string tmpName;
+
+  FILE *f = createTempFile( name, tmpName );
+
+  if (f == NULL)
+    return false;
+
+  unsigned char header[ RAW_CACHE_HEADER_BYTES ];
+
+  memset( header, 0, sizeof(header) );
+  memcpy( header, &h, sizeof(h) );
+
+  unsigned char padding[ RGB_PADDING ] = { 0 };
+
+  bool ok = (fwrite( header, 1, sizeof(header), f ) == sizeof(header) &&
+	     fwrite( pixels, 1, h.pixelBytes, f ) == h.pixelBytes &&
+	     (hasAlpha || fwrite( padding, 1, RGB_PADDING, f ) == RGB_PADDING));
+
+  if (fclose( f ) != 0)
+    ok = false;
+
+#ifdef _WIN32
+  if (ok)
+    remove( name.c_str() ); // rename() does not replace an existing file here
+#endif
+
+  if (!ok || rename( tmpName.c_str(), name.c_str() ) != 0) {
+    remove( tmpName.c_str() );
+    return false;
+  }
+
+  return true;
+}
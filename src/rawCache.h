@@ -0,0 +1,70 @@
+// rawCache.h
+//
+// A cache of an image's decoded pixels in a file beside the image, so
+// that an image that is opened again is mapped into memory instead of
+// being decoded.
+//
+// The cache of "name.png" is "name.png.rawcache".  It is a header of
+// RAW_CACHE_HEADER_BYTES, then the pixels, uncompressed and row by row
+// as in Image::texmap, then RGB_PADDING zero bytes if the pixels are
+// RGB.  The header is a multiple of the page size, so the rows start
+// on a page boundary.  The file is mapped copy-on-write: pages are
+// read only when they are first touched, and writes to the pixels do
+// not reach the file.
+//
+// The header records the size and modification time of the source
+// file.  A cache that does not match its source is ignored, and is
+// replaced when the source has been decoded.
+//
+// The cache is in the machine's byte order, so it is not meant to be
+// moved between machines.  One from a machine with another byte order
+// is ignored.
+
+
+#ifndef RAW_CACHE_H
+#define RAW_CACHE_H
+
+#include "coreHeaders.h"
+
+#include <cstdint>
+#include <string>
+
+
+#define RAW_CACHE_HEADER_BYTES 16384  // a multiple of the page size: 4 KB on x86, 16 KB on Apple silicon
+
+
+// The size and modification time of a source file
+
+struct SourceStamp {
+  uint64_t size;
+  int64_t  modifiedSeconds;
+  int64_t  modifiedNanoseconds;  // 0 where the system does not give them
+};
+
+bool getSourceStamp( string filename, SourceStamp &stamp );
+
+string rawCacheName( string filename );
+
+
+// Map the cache of 'filename' if there is one that matches 'stamp'.
+// Returns the pixels, which stay valid until unmapRawCache() is called
+// with 'mapping' and 'mappingSize', or NULL if there is no usable
+// cache.
+
+unsigned char *mapRawCache( string filename, SourceStamp &stamp,
+			    unsigned int &width, unsigned int &height, bool &hasAlpha,
+			    void *&mapping, size_t &mappingSize );
+
+void unmapRawCache( void *mapping, size_t mappingSize );
+
+
+// Write the cache of 'filename', whose stamp was 'stamp' when it was
+// read.  The cache is written to a temporary file that is then renamed,
+// so a reader never sees a partly written cache.  Returns false if the
+// cache could not be written (e.g. if the directory is read-only).
+
+bool writeRawCache( string filename, SourceStamp &stamp,
+		    unsigned char *pixels, unsigned int width, unsigned int height, bool hasAlpha );
+
+
+#endif
@@ -0,0 +1,325 @@
+// resample.cpp
+
+
+#include "resample.h"
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+
+const char *interpolationNames[ NUM_INTERPOLATIONS ] = { "nearest", "bilinear", "bicubic", "lanczos" };
+
+
+
+int numTaps( Interpolation interp )
+
+{
+  switch (interp) {
+  case BILINEAR:
+    return 2;
+  case BICUBIC:
+    return 4;
+  case LANCZOS:
+    return 6;
+  default:
+    return 1;
+  }
+}
+
+
+
+// Catmull-Rom cubic (Keys, a = -0.5) at distance x from the sample
+
+static float cubicWeight( float x )
+
+{
+  const float a = -0.5;
+
+  x = fabs(x);
+
+  if (x < 1)
+    return ((a+2)*x - (a+3))*x*x + 1;
+  else if (x < 2)
+    return ((a*x - 5*a)*x + 8*a)*x - 4*a;
+  else
+    return 0;
+}
+
+
+
+// Lanczos (a = 3) at distance x from the sample
+
+static float lanczosWeight( float x )
+
+{
+  x = fabs(x);
+
+  if (x < 1e-6)
+    return 1;
+  else if (x >= 3)
+    return 0;
+
+  float px = M_PI * x;
+
+  return 3 * sin(px) * sin(px/3) / (px*px);
+}
+
+
+
+// Find the taps in one dimension for sampling at 'srcPos', where
+// source pixel i covers [i,i+1) and has its centre at i+0.5.
+
+void findTaps( Interpolation interp, float srcPos, int srcSize, SampleTaps &taps )
+
+{
+  taps.inside = (srcPos >= 0 && srcPos < srcSize);
+
+  if (interp == NEAREST) {
+    taps.index[0]  = (srcPos < 0 ? 0 : srcPos >= srcSize ? srcSize-1 : (int) srcPos);
+    taps.weight[0] = 1;
+    return;
+  }
+
+  float u  = srcPos - 0.5;
+  int   i0 = (int) floor(u);
+  float f  = u - i0;
+
+  int n     = numTaps( interp );
+  int first = i0 - (n/2 - 1);  // leftmost tap
+
+  float sum = 0;
+
+  for (int k=0; k<n; k++) {
+
+    int i = first + k;
+    float dist = (u - i);
+
+    if (interp == BILINEAR)
+      taps.weight[k] = 1 - fabs(dist);
+    else if (interp == BICUBIC)
+      taps.weight[k] = cubicWeight( dist );
+    else
+      taps.weight[k] = lanczosWeight( dist );
+
+    sum += taps.weight[k];
+
+    if (i < 0)
+      i = 0;
+    else if (i > srcSize-1)
+      i = srcSize-1;
+
+    taps.index[k] = i;
+  }
+
+  for (int k=0; k<n; k++)
+    taps.weight[k] /= sum;
+
+  if (interp == BILINEAR) {
+    taps.fixedWeight[1] = (short) (f * 256 + 0.5);
+    taps.fixedWeight[0] = 256 - taps.fixedWeight[1];
+  }
+}
+
+
+
+// Convert a premultiplied pixel back to straight alpha
+
+static inline Pixel unpremultiply( unsigned int r, unsigned int g, unsigned int b, unsigned int a )
+
+{
+  if (a == 0)
+    return Pixel( 0, 0, 0, 0 );
+
+  r = (r * 255 + a/2) / a;
+  g = (g * 255 + a/2) / a;
+  b = (b * 255 + a/2) / a;
+
+  return Pixel( r > 255 ? 255 : r,
+		g > 255 ? 255 : g,
+		b > 255 ? 255 : b,
+		a );
+}
+
+
+
+// Bilinear interpolation in 8-bit fixed point.  Pixels are
+// premultiplied as round(c*a/255), blended horizontally with the
+// x weights, rounded to 8 bits, then blended vertically with the y
+// weights.  The SSE2 version does all four channels of two rows at
+// once and gives exactly the same result as the scalar version.
+//
+// RGB pixels are opaque, and premultiplying by 255 changes nothing,
+// so they are blended directly.  The result is the same as for the
+// RGBA pixel with alpha 255.
+
+template <int CHANNELS> Pixel sampleBilinear( Image *src, SampleTaps &tx, SampleTaps &ty )
+
+{
+  unsigned char *row0 = src->row<CHANNELS>( ty.index[0] );
+  unsigned char *row1 = src->row<CHANNELS>( ty.index[1] );
+
+#ifdef __SSE2__
+
+  unsigned int q00, q01, q10, q11; // an RGB pixel's fourth byte is ignored
+
+  memcpy( &q00, row0 + CHANNELS * tx.index[0], 4 );
+  memcpy( &q01, row0 + CHANNELS * tx.index[1], 4 );
+  memcpy( &q10, row1 + CHANNELS * tx.index[0], 4 );
+  memcpy( &q11, row1 + CHANNELS * tx.index[1], 4 );
+
+  const __m128i zero = _mm_setzero_si128();
+
+  // left taps of both rows in A, right taps of both rows in B, as 16-bit lanes
+
+  __m128i A = _mm_unpacklo_epi8( _mm_unpacklo_epi32( _mm_cvtsi32_si128( q00 ), _mm_cvtsi32_si128( q10 ) ), zero );
+  __m128i B = _mm_unpacklo_epi8( _mm_unpacklo_epi32( _mm_cvtsi32_si128( q01 ), _mm_cvtsi32_si128( q11 ) ), zero );
+
+  const __m128i c128 = _mm_set1_epi16( 128 );
+
+  if (CHANNELS == 4) {
+
+    // premultiply: multiply r,g,b by a and a by 255, then divide by 255 with rounding
+
+    const __m128i alphaMask = _mm_set_epi16( -1,0,0,0, -1,0,0,0 );
+    const __m128i alpha255  = _mm_set_epi16( 255,0,0,0, 255,0,0,0 );
+    const __m128i c257      = _mm_set1_epi16( 257 );
+
+    __m128i alphaA = _mm_shufflehi_epi16( _mm_shufflelo_epi16( A, _MM_SHUFFLE(3,3,3,3) ), _MM_SHUFFLE(3,3,3,3) );
+    __m128i alphaB = _mm_shufflehi_epi16( _mm_shufflelo_epi16( B, _MM_SHUFFLE(3,3,3,3) ), _MM_SHUFFLE(3,3,3,3) );
+
+    alphaA = _mm_or_si128( _mm_andnot_si128( alphaMask, alphaA ), alpha255 );
+    alphaB = _mm_or_si128( _mm_andnot_si128( alphaMask, alphaB ), alpha255 );
+
+    A = _mm_mulhi_epu16( _mm_add_epi16( _mm_mullo_epi16( A, alphaA ), c128 ), c257 );
+    B = _mm_mulhi_epu16( _mm_add_epi16( _mm_mullo_epi16( B, alphaB ), c128 ), c257 );
+  }
+
+  // horizontal blend
+
+  __m128i H = _mm_add_epi16( _mm_mullo_epi16( A, _mm_set1_epi16( tx.fixedWeight[0] ) ),
+			     _mm_mullo_epi16( B, _mm_set1_epi16( tx.fixedWeight[1] ) ) );
+  H = _mm_srli_epi16( _mm_add_epi16( H, c128 ), 8 );
+
+  // vertical blend: row 0 is in the low half, row 1 in the high half
+
+  __m128i wy = _mm_unpacklo_epi64( _mm_set1_epi16( ty.fixedWeight[0] ), _mm_set1_epi16( ty.fixedWeight[1] ) );
+
+  __m128i V = _mm_mullo_epi16( H, wy );
+  V = _mm_add_epi16( V, _mm_srli_si128( V, 8 ) );
+  V = _mm_srli_epi16( _mm_add_epi16( V, c128 ), 8 );
+
+  unsigned int result = _mm_cvtsi128_si32( _mm_packus_epi16( V, zero ) );
+  unsigned char *c = (unsigned char *) &result;
+
+  if (CHANNELS == 3)
+    return Pixel( c[0], c[1], c[2] );
+
+  return unpremultiply( c[0], c[1], c[2], c[3] );
+
+#else
+
+  Pixel p[4] = { readPixel<CHANNELS>( row0 + CHANNELS * tx.index[0] ),
+		 readPixel<CHANNELS>( row1 + CHANNELS * tx.index[0] ),
+		 readPixel<CHANNELS>( row0 + CHANNELS * tx.index[1] ),
+		 readPixel<CHANNELS>( row1 + CHANNELS * tx.index[1] ) };
+
+  unsigned int pm[4][4]; // premultiplied
+
+  for (int i=0; i<4; i++) {
+    if (CHANNELS == 3) {
+      pm[i][0] = p[i].r;
+      pm[i][1] = p[i].g;
+      pm[i][2] = p[i].b;
+    } else {
+      unsigned int a = p[i].a;
+      pm[i][0] = ((p[i].r * a + 128) * 257) >> 16;
+      pm[i][1] = ((p[i].g * a + 128) * 257) >> 16;
+      pm[i][2] = ((p[i].b * a + 128) * 257) >> 16;
+      pm[i][3] = ((a * 255 + 128) * 257) >> 16;
+    }
+  }
+
+  unsigned int out[4];
+
+  for (int c=0; c<CHANNELS; c++) {
+    unsigned int h0 = (pm[0][c] * tx.fixedWeight[0] + pm[2][c] * tx.fixedWeight[1] + 128) >> 8;
+    unsigned int h1 = (pm[1][c] * tx.fixedWeight[0] + pm[3][c] * tx.fixedWeight[1] + 128) >> 8;
+    out[c] = (h0 * ty.fixedWeight[0] + h1 * ty.fixedWeight[1] + 128) >> 8;
+  }
+
+  if (CHANNELS == 3)
+    return Pixel( out[0], out[1], out[2] );
+
+  return unpremultiply( out[0], out[1], out[2], out[3] );
+
+#endif
+}
+
+template Pixel sampleBilinear<3>( Image *src, SampleTaps &tx, SampleTaps &ty );
+template Pixel sampleBilinear<4>( Image *src, SampleTaps &tx, SampleTaps &ty );
+
+
+
+// General separable interpolation in floating point
+
+template <int CHANNELS> Pixel sampleSeparable( Image *src, Interpolation interp, SampleTaps &tx, SampleTaps &ty )
+
+{
+  int n = numTaps( interp );
+
+  float r = 0, g = 0, b = 0, a = 0;
+
+  for (int j=0; j<n; j++) {
+
+    unsigned char *row = src->row<CHANNELS>( ty.index[j] );
+
+    for (int i=0; i<n; i++) {
+
+      Pixel p = readPixel<CHANNELS>( row + CHANNELS * tx.index[i] );
+
+      float wa = tx.weight[i] * ty.weight[j] * p.a;
+
+      r += wa * p.r;
+      g += wa * p.g;
+      b += wa * p.b;
+      a += wa;
+    }
+  }
+
+  if (a <= 0.5)
+    return Pixel( 0, 0, 0, 0 );
+
+  r = rint( r / a );
+  g = rint( g / a );
+  b = rint( b / a );
+  a = rint( a );
+
+  return Pixel( r < 0 ? 0 : (r > 255 ? 255 : r),
+		g < 0 ? 0 : (g > 255 ? 255 : g),
+		b < 0 ? 0 : (b > 255 ? 255 : b),
+		a > 255 ? 255 : a );
+}
+
+template Pixel sampleSeparable<3>( Image *src, Interpolation interp, SampleTaps &tx, SampleTaps &ty );
+template Pixel sampleSeparable<4>( Image *src, Interpolation interp, SampleTaps &tx, SampleTaps &ty );
+
+
+
+// Blend (1-t) * p0 + t * p1 with premultiplied alpha
+
+Pixel blendPixels( Pixel p0, Pixel p1, float t )
+
+{
+  float w0 = (1-t) * p0.a;
+  float w1 = t     * p1.a;
+  float a  = w0 + w1;
+
+  if (a <= 0.5)
+    return Pixel( 0, 0, 0, 0 );
+
+  return Pixel( rint( (w0 * p0.r + w1 * p1.r) / a ),
+		rint( (w0 * p0.g + w1 * p1.g) / a ),
+		rint( (w0 * p0.b + w1 * p1.b) / a ),
+		rint( a ) );
+}
@@ -0,0 +1,53 @@
+// resample.h
+//
+// Interpolation of source pixels for backward projection.
+//
+// A source position is sampled with a separable filter: the filter
+// taps in x and in y are found separately (a SampleTaps for each) and
+// the pixel is the weighted sum of the taps' outer product.  When the
+// transform is axis-aligned, the taps depend only on the destination
+// column (for x) or row (for y), so they can be found once per column
+// and once per row rather than once per pixel.
+//
+// Colours are interpolated with premultiplied alpha so that fully
+// transparent pixels do not darken the edges of an image.
+
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "coreHeaders.h"
+#include "image.h"
+
+
+typedef enum { NEAREST, BILINEAR, BICUBIC, LANCZOS, NUM_INTERPOLATIONS } Interpolation;
+
+extern const char *interpolationNames[ NUM_INTERPOLATIONS ];
+
+
+#define MAX_TAPS 6  // Lanczos (a=3) has the widest support
+
+
+// Filter taps in one dimension
+
+struct SampleTaps {
+  bool  inside;                 // true if the position is within the source image
+  int   index[ MAX_TAPS ];      // source pixel of each tap, clamped to the image
+  float weight[ MAX_TAPS ];     // weight of each tap (sums to 1)
+  short fixedWeight[2];         // bilinear weights in 1/256ths (sum to 256)
+};
+
+
+int numTaps( Interpolation interp );
+
+void findTaps( Interpolation interp, float srcPos, int srcSize, SampleTaps &taps );
+
+// Sample 'src', which has CHANNELS bytes per pixel (3 or 4)
+
+template <int CHANNELS> Pixel sampleBilinear( Image *src, SampleTaps &tx, SampleTaps &ty );
+template <int CHANNELS> Pixel sampleSeparable( Image *src, Interpolation interp, SampleTaps &tx, SampleTaps &ty );
+
+Pixel blendPixels( Pixel p0, Pixel p1, float t );
+
+
+#endif
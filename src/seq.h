@@ -9,17 +9,28 @@
  *   CONSTRUCTORS
  *
  *     seq()               Create an empty sequence
+ *     seq( n )            Create an empty sequence with storage for n elements
  *
  *   PUBLIC FUNCTIONS
  *
  *     add( x )            Add x to the end of the sequence
+ *     emplace( args )     Construct an element from args at the end of the sequence
  *     remove()            Remove the last element of the sequence
  *     remove( i )         Remove the i^{th} element of the sequence (expensive)
  *     shift( i )          Shift right everything starting at position i
  *     operator [i]        Returns the i^{th} element (starting from 0)
  *     exists( x )         Return true if x exists in sequence, false otherwise
- *     clear()             Deletes the whole sequence
+ *     clear()             Removes all elements, but keeps the storage
+ *     reserve( n )        Make room for at least n elements
+ *     compress()          Release unused storage
  *     findIndex( x )      Find the index of element x, or -1 if it doesn't exist
+ *
+ * The first N elements (default 4) are stored inside the seq itself,
+ * so short sequences never allocate.  Elements are moved, not copied,
+ * when the storage grows.
+ *
+ * Index and range checks are done only in debug builds (i.e. when
+ * NDEBUG is not defined).
  */
 
 
@@ -28,50 +39,80 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <new>
+#include <utility>
 using namespace std;
 
 
-template<class T> class seq {
+#ifndef NDEBUG
+  #define SEQ_CHECK( condition, message )					\
+    if (!(condition)) {							\
+      cerr << message << "\n";						\
+      abort();								\
+    }
+#else
+  #define SEQ_CHECK( condition, message )
+#endif
+
+
+template<class T, int N = 4> class seq {
 
   int storageSize;
   int numElements;
 
+  // Inline storage for the first N elements
+
+  alignas(T) unsigned char smallBuffer[ N * sizeof(T) ];
+
+  T *smallData() {
+    return reinterpret_cast<T *>( smallBuffer );
+  }
+
+  void moveStorage( int newSize );
+  void copyFrom( const seq<T,N> &source );
+  void moveFrom( seq<T,N> &source );
+  void destroyAll();
+
 public:
 
   T  *data;
 
   seq() {			// constructor
-    storageSize = 2;
+    storageSize = N;
     numElements = 0;
-    data = new T[ storageSize ];
+    data = smallData();
   }
 
   seq( int n ) {		// constructor
-    storageSize = n;
+    storageSize = N;
     numElements = 0;
-    data = new T[ storageSize ];
+    data = smallData();
+    reserve( n );
   }
 
   ~seq() {			// destructor
-    delete [] data;
+    destroyAll();
   }
 
-  seq( const seq<T> & source ) { // copy constructor
+  seq( const seq<T,N> & source ) { // copy constructor
+    storageSize = N;
+    numElements = 0;
+    data = smallData();
+    copyFrom( source );
+  }
 
-    storageSize = source.storageSize;
-    numElements = source.numElements;
-    data = new T[ storageSize ];
-    for (int i=0; i<numElements; i++)
-      data[i] = source.data[i];
+  seq( seq<T,N> && source ) {	// move constructor
+    storageSize = N;
+    numElements = 0;
+    data = smallData();
+    moveFrom( source );
   }
 
   void remove() {
-    if (numElements == 0) {
-      cerr << "remove: Tried to remove element from empty sequence\n";
-      exit(-1);
-    }
+    SEQ_CHECK( numElements > 0, "remove: Tried to remove element from empty sequence" );
 
     numElements = numElements - 1;
+    data[ numElements ].~T();
   }
 
   void remove( int i );
@@ -83,94 +124,192 @@ public:
   }
 
   T & operator [] ( int i ) const {
-    if (i >= numElements || i < 0) {
-      cerr << "element: Tried to access an element beyond the range of the sequence: "
-	   << i << "(numElements = " << numElements << ")\n";
-      { int i = 0;
-      int j = 1 / i;
-      j = j;
-      }
-      exit(-1);
-    }
+    SEQ_CHECK( i < numElements && i >= 0,
+	       "element: Tried to access an element beyond the range of the sequence: "
+	       << i << "(numElements = " << numElements << ")" );
     return data[ i ];
   }
 
   void clear() {
-    delete [] data;
-    storageSize = 1;
+    for (int i=0; i<numElements; i++)
+      data[i].~T();
     numElements = 0;
-    data = new T[ storageSize ];
   }
 
-  seq<T> & operator = (const seq<T> &source) { // assignment operator
-    storageSize = source.storageSize;
-    numElements = source.numElements;
-    delete [] data;
-    data = new T[ storageSize ];
-    for (int i=0; i<numElements; i++)
-      data[i] = source.data[i];
+  void reserve( int n ) {
+    if (n > storageSize)
+      moveStorage( n );
+  }
+
+  seq<T,N> & operator = (const seq<T,N> &source) { // assignment operator
+    if (this != &source) {
+      clear();
+      copyFrom( source );
+    }
     return *this;
   }
 
-  void add( const T &x );
+  seq<T,N> & operator = (seq<T,N> &&source) { // move assignment operator
+    if (this != &source) {
+      destroyAll();
+      storageSize = N;
+      data = smallData();
+      moveFrom( source );
+    }
+    return *this;
+  }
+
+  void add( const T &x ) {
+    emplace( x );
+  }
+
+  void add( T &&x ) {
+    emplace( std::move( x ) );
+  }
+
+  template<class... Args>
+  T & emplace( Args&&... args );
+
   int findIndex( const T &x );
   bool exists( const T &x );
 };
 
 
-// Add an element to the end of the sequence
+// Construct an element at the end of the sequence
 
-template<class T>
-void 
-seq<T>::add( const T &x )
+template<class T, int N>
+template<class... Args>
+T &
+seq<T,N>::emplace( Args&&... args )
 
 {
   // No storage left?  If so, double the storage
 
   if (numElements == storageSize) {
-    T *newData;
 
-    newData = new T[ storageSize * 2 ];
-    for (int i=0; i<storageSize; i++)
-      newData[i] = data[i];
-    storageSize = storageSize * 2;
-    delete [] data;
-    data = newData;
-  }
+    // 'args' might refer to an element of this sequence, so construct
+    // the new element before the old storage is released
+
+    T x( std::forward<Args>( args )... );
+    moveStorage( storageSize * 2 );
+    new (&data[ numElements ]) T( std::move( x ) );
+
+  } else
 
-  // Store the element in the next available position
+    new (&data[ numElements ]) T( std::forward<Args>( args )... );
 
-  data[ numElements ] = x;
   numElements++;
+
+  return data[ numElements-1 ];
 }
 
 
-// Compress the array
+// Move the elements to storage for 'newSize' elements, which is the
+// inline storage if they fit there
 
-template<class T>
-void 
-seq<T>::compress()
+template<class T, int N>
+void
+seq<T,N>::moveStorage( int newSize )
 
 {
+  if (newSize < numElements)
+    newSize = numElements;
+
   T *newData;
 
+  if (newSize <= N) {
+    if (data == smallData())
+      return;
+    newData = smallData();
+    newSize = N;
+  } else
+    newData = static_cast<T *>( ::operator new( newSize * sizeof(T) ) );
+
+  for (int i=0; i<numElements; i++) {
+    new (&newData[i]) T( std::move( data[i] ) );
+    data[i].~T();
+  }
+
+  if (data != smallData())
+    ::operator delete( data );
+
+  data = newData;
+  storageSize = newSize;
+}
+
+
+// Destroy the elements and release the storage
+
+template<class T, int N>
+void
+seq<T,N>::destroyAll()
+
+{
+  clear();
+
+  if (data != smallData())
+    ::operator delete( data );
+}
+
+
+// Append copies of the elements of 'source'
+
+template<class T, int N>
+void
+seq<T,N>::copyFrom( const seq<T,N> &source )
+
+{
+  reserve( numElements + source.numElements );
+
+  for (int i=0; i<source.numElements; i++)
+    new (&data[ numElements++ ]) T( source.data[i] );
+}
+
+
+// Take the elements of 'source' into this sequence, which must be
+// empty, leaving 'source' empty.  Allocated storage is taken over;
+// inline elements are moved one by one.
+
+template<class T, int N>
+void
+seq<T,N>::moveFrom( seq<T,N> &source )
+
+{
+  if (source.data == source.smallData()) {
+    for (int i=0; i<source.numElements; i++)
+      new (&data[i]) T( std::move( source.data[i] ) );
+    numElements = source.numElements;
+    source.clear();
+  } else {
+    data        = source.data;
+    storageSize = source.storageSize;
+    numElements = source.numElements;
+    source.data        = source.smallData();
+    source.storageSize = N;
+    source.numElements = 0;
+  }
+}
+
+
+// Compress the array
+
+template<class T, int N>
+void
+seq<T,N>::compress()
+
+{
   if (numElements == storageSize)
     return;
 
-  newData = new T[ numElements ];
-  for (int i=0; i<numElements; i++)
-    newData[i] = data[i];
-  storageSize = numElements;
-  delete [] data;
-  data = newData;
+  moveStorage( numElements );
 }
 
 
 // Find and return an element
 
-template<class T>
-bool 
-seq<T>::exists( const T &x )
+template<class T, int N>
+bool
+seq<T,N>::exists( const T &x )
 
 {
   for (int i=0; i<numElements; i++)
@@ -183,9 +322,9 @@ seq<T>::exists( const T &x )
 
 // Find and return the *index* of an element
 
-template<class T>
-int 
-seq<T>::findIndex( const T &x )
+template<class T, int N>
+int
+seq<T,N>::findIndex( const T &x )
 
 {
   for (int i=0; i<numElements; i++)
@@ -196,32 +335,31 @@ seq<T>::findIndex( const T &x )
 }
 
 
-// Shift a suffix of the sequence to the right by one
+// Shift a suffix of the sequence to the right by one.  Element i is
+// left as it was, so it appears at both i and i+1.
 
-template<class T>
-void 
-seq<T>::shift( int i )
+template<class T, int N>
+void
+seq<T,N>::shift( int i )
 
 {
-  if (i < 0 || i >= numElements) {
-    cerr << "remove: Tried to shift element " << i
-	 << " from a sequence of " << numElements << " elements \n";
-    exit(-1);
-  }
+  SEQ_CHECK( i >= 0 && i < numElements,
+	     "remove: Tried to shift element " << i
+	     << " from a sequence of " << numElements << " elements " );
 
-  if (numElements == storageSize) {
-    T *newData;
+  if (numElements == storageSize)
+    moveStorage( storageSize * 2 );
 
-    newData = new T[ storageSize * 2 ];
-    for (int i=0; i<storageSize; i++)
-      newData[i] = data[i];
-    storageSize = storageSize * 2;
-    delete [] data;
-    data = newData;
-  }
+  if (i == numElements-1)
+    new (&data[ numElements ]) T( data[i] );
+  else {
+    new (&data[ numElements ]) T( std::move( data[ numElements-1 ] ) );
+
+    for (int j=numElements-1; j>i+1; j--)
+      data[j] = std::move( data[j-1] );
 
-  for (int j=numElements; j>i; j--)
-    data[j] = data[j-1];
+    data[i+1] = data[i];
+  }
 
   numElements++;
 }
@@ -229,24 +367,20 @@ seq<T>::shift( int i )
 
 // Shift a suffix of the sequence to the left by one
 
-template<class T>
-void 
-seq<T>::remove( int i )
+template<class T, int N>
+void
+seq<T,N>::remove( int i )
 
 {
-  if (i < 0 || i >= numElements) {
-    cerr << "remove: Tried to remove element " << i
-	 << " from a sequence of " << numElements << " elements \n";
-    { int i = 0;
-    int j = 1 / i;
-    }
-    exit(-1);
-  }
+  SEQ_CHECK( i >= 0 && i < numElements,
+	     "remove: Tried to remove element " << i
+	     << " from a sequence of " << numElements << " elements " );
 
   for (int j=i; j<numElements-1; j++)
-    data[j] = data[j+1];
+    data[j] = std::move( data[j+1] );
 
   numElements--;
+  data[ numElements ].~T();
 }
 
 
@@ -0,0 +1,132 @@
+// seqBench.cpp
+//
+// Times seq<T> against std::vector<T> on the ways that the editor
+// uses it.  Build with 'make seq-bench', which compiles with -O2 and
+// NDEBUG, so that seq does no index checks.
+//
+//   stack   Push two elements, read the top one, and pop both, on a
+//           global sequence that never grows past its inline storage.
+//           GPUProgram::active_programs is used this way.
+//
+//   grow    Append strings to an empty sequence, which grows its
+//           storage many times.  The strings are moved, not copied,
+//           when the storage grows.
+//
+// Each test is run BENCH_RUNS times, and the fastest run is reported.
+
+
+#include "seq.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+
+#define BENCH_RUNS     5
+#define STACK_CYCLES   50000000 // push/push/pop/pop cycles per run of the stack test
+#define GROW_ELEMENTS  20000    // strings appended in each round of the grow test
+#define GROW_ROUNDS    100      // rounds per run of the grow test
+#define STRING_LENGTH  40       // longer than std::string's inline buffer, so that copies allocate
+
+
+typedef std::chrono::steady_clock Clock;
+
+// Globals, so that the compiler cannot keep the sequences in registers
+// or drop the work
+
+seq<unsigned int>         seqStack;
+std::vector<unsigned int> vectorStack;
+
+volatile unsigned int sink;
+
+
+
+// The stack test on 'stack', which has add(), remove() and operator[]
+
+template <class Stack> static void stackTest( Stack &stack, void (*push)( Stack &, unsigned int ), void (*pop)( Stack & ) )
+
+{
+  for (unsigned int i=0; i<STACK_CYCLES; i++) {
+    push( stack, i );
+    push( stack, i+1 );
+    sink += stack[ stack.size()-1 ];
+    pop( stack );
+    pop( stack );
+  }
+}
+
+
+static void seqPush( seq<unsigned int> &s, unsigned int x )         { s.add( x ); }
+static void seqPop( seq<unsigned int> &s )                          { s.remove(); }
+static void vectorPush( std::vector<unsigned int> &v, unsigned int x ) { v.push_back( x ); }
+static void vectorPop( std::vector<unsigned int> &v )               { v.pop_back(); }
+
+
+
+// The grow test, appending copies of the strings in 'src'
+
+static void seqGrowTest( std::vector<std::string> &src )
+
+{
+  for (int r=0; r<GROW_ROUNDS; r++) {
+    seq<std::string> s;
+    for (int i=0; i<GROW_ELEMENTS; i++)
+      s.add( src[i] );
+    sink += s.size();
+  }
+}
+
+
+static void vectorGrowTest( std::vector<std::string> &src )
+
+{
+  for (int r=0; r<GROW_ROUNDS; r++) {
+    std::vector<std::string> v;
+    for (int i=0; i<GROW_ELEMENTS; i++)
+      v.push_back( src[i] );
+    sink += v.size();
+  }
+}
+
+
+
+// Fastest of BENCH_RUNS runs of 'test', in seconds
+
+template <class Test> static double fastest( Test test )
+
+{
+  double best = 0;
+
+  for (int run=0; run<BENCH_RUNS; run++) {
+
+    Clock::time_point start = Clock::now();
+    test();
+    double seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+
+    if (run == 0 || seconds < best)
+      best = seconds;
+  }
+
+  return best;
+}
+
+
+
+int main()
+
+{
+  std::vector<std::string> strings( GROW_ELEMENTS, std::string( STRING_LENGTH, 'a' ) );
+
+  double seqStackTime    = fastest( [] () { stackTest( seqStack, seqPush, seqPop ); } );
+  double vectorStackTime = fastest( [] () { stackTest( vectorStack, vectorPush, vectorPop ); } );
+  double seqGrowTime     = fastest( [&] () { seqGrowTest( strings ); } );
+  double vectorGrowTime  = fastest( [&] () { vectorGrowTest( strings ); } );
+
+  printf( "             seq     std::vector\n" );
+  printf( "  stack  %7.3f s   %7.3f s\n", seqStackTime, vectorStackTime );
+  printf( "  grow   %7.3f s   %7.3f s\n", seqGrowTime, vectorGrowTime );
+
+  return 0;
+}
@@ -53,14 +53,48 @@ char *StrokeFont::fontFragmentShader = R"XX(
 
 
 
-void StrokeFont::drawStrokeString( string str, float x, float y, float height, float theta, Alignment alignment )
+// Convert every glyph's line strips into line segments and pack them
+// into one table.  This is done once, so laying out a string is just
+// a matter of copying the segments of each of its characters.
+
+void StrokeFont::packGlyphs()
 
 {
-  gpuProg->activate();
+  SFG_StrokeFont *font = &fgStrokeMonoRoman;
+
+  for (int c=0; c<NUM_GLYPHS; c++) {
+
+    glyphStart[c] = glyphVerts.size();
+    glyphCount[c] = 0;
+    glyphWidth[c] = 0;
 
+    if (c >= font->Quantity || font->Characters[c] == NULL)
+      continue;  // no glyph: draw nothing and take no space
+
+    const SFG_StrokeChar  *schar = font->Characters[c];
+    const SFG_StrokeStrip *strip = schar->Strips;
+
+    for (int i=0; i<schar->Number; i++, strip++)
+      for (int j=0; j<strip->Number-1; j++) {
+	glyphVerts.add( vec2( strip->Vertices[j].X,   strip->Vertices[j].Y   ) );
+	glyphVerts.add( vec2( strip->Vertices[j+1].X, strip->Vertices[j+1].Y ) );
+      }
+
+    glyphCount[c] = glyphVerts.size() - glyphStart[c];
+    glyphWidth[c] = schar->Right;
+  }
+}
+
+
+
+// Lay out 'str' in font units with its alignment offset applied and
+// store the segments in a VBO.  The least recently used cached
+// string is discarded if the cache is full.
+
+StrokeFont::CachedString *StrokeFont::layoutString( string &str, Alignment alignment )
+
+{
   SFG_StrokeFont *font = &fgStrokeMonoRoman;
-  
-  float s = height / (float) font->Height; // scale of letters
 
   // Find total width of string
 
@@ -68,12 +102,10 @@ void StrokeFont::drawStrokeString( string str, float x, float y, float height, f
   for (unsigned int k=0; k<str.size(); k++)
     if (str[k] == '\n')
       width = 0;
-    else {
-      const SFG_StrokeChar *schar = font->Characters[ (unsigned char) str[k] ];
-      width += schar->Right;
-    }
+    else if ((unsigned char) str[k] < NUM_GLYPHS)
+      width += glyphWidth[ (unsigned char) str[k] ];
 
-  float xOffset;
+  float xOffset = 0;
   switch (alignment) {
   case LEFT:
     xOffset = 0; break;
@@ -83,79 +115,122 @@ void StrokeFont::drawStrokeString( string str, float x, float y, float height, f
     xOffset = -width; break;
   }
 
-  // Draw each letter
+  // Copy the segments of each letter into place
+
+  int nVerts = 0;
+  for (unsigned int k=0; k<str.size(); k++)
+    if ((unsigned char) str[k] < NUM_GLYPHS)
+      nVerts += glyphCount[ (unsigned char) str[k] ];
+
+  vec2 *verts = new vec2[ nVerts > 0 ? nVerts : 1 ];
+  vec2 *v = verts;
 
-  float xPos = x;
-  float initX = x;
+  float xPos = 0;
+  float yPos = 0;
 
-  for (unsigned int k=0; k<str.size(); k++) 
+  for (unsigned int k=0; k<str.size(); k++) {
 
-    if (str[k] == '\n') {	// handle newline
+    unsigned char c = (unsigned char) str[k];
 
-      xPos = initX;
-      y -= height * 1.2;
+    if (c == '\n') {	// handle newline
+      xPos = 0;
+      yPos -= font->Height * 1.2;
+      continue;
+    }
 
-    } else {
+    if (c >= NUM_GLYPHS)
+      continue;
 
-      mat4 transform
-	= translate( xPos, y, 0 )
-	* rotate( theta, vec3(0,0,1) )
-	* translate( s*xOffset, 0, 0 )
-	* scale( s, s, 1 );
+    for (int i=0; i<glyphCount[c]; i++) {
+      vec2 &p = glyphVerts[ glyphStart[c] + i ];
+      *v++ = vec2( p.x + xPos + xOffset, p.y + yPos );
+    }
 
-      gpuProg->setMat4( "MVP", transform );
+    xPos += glyphWidth[c];
+  }
 
-      // glutStrokeCharacter( font, str[k] );
-      //
-      // The following is extracted from FreeGlut source.
+  // Find a cache slot
 
-      const SFG_StrokeChar  *schar = font->Characters[ (unsigned char) str[k] ];
-      const SFG_StrokeStrip *strip = schar->Strips;
+  CachedString *cs;
 
-      for (int i=0; i<schar->Number; i++, strip++) {
+  if (cache.size() < MAX_CACHED_STRINGS) {
 
-	// Create a VAO for this stroke
+    cs = new CachedString();
+    glGenVertexArrays( 1, &cs->VAO );
+    glGenBuffers( 1, &cs->VBO );
+    cache.add( cs );
 
-	GLuint VAO;
-	glGenVertexArrays( 1, &VAO );
-	glBindVertexArray( VAO );
+  } else {
 
-	// Fill a buffer with the stroke's vertices
+    cs = cache[0];
+    for (int i=1; i<cache.size(); i++)
+      if (cache[i]->lastUsed < cs->lastUsed)
+	cs = cache[i];
+  }
 
-	float *verts = new float[strip->Number*2];
+  cs->text      = str;
+  cs->alignment = alignment;
+  cs->nVerts    = nVerts;
 
-	for (int j=0; j<strip->Number; j++) {
-	  verts[j*2+0] = strip->Vertices[ j ].X;
-	  verts[j*2+1] = strip->Vertices[ j ].Y;
-	}
+  // Fill the VBO
 
-	// Fill a VBO with the stroke's vertices
+  glBindVertexArray( cs->VAO );
 
-	GLuint VBO;
-	glGenBuffers( 1, &VBO );
-	glBindBuffer( GL_ARRAY_BUFFER, VBO );
-	glBufferData( GL_ARRAY_BUFFER, strip->Number*2*sizeof(float), verts, GL_STATIC_DRAW );
+  glBindBuffer( GL_ARRAY_BUFFER, cs->VBO );
+  glBufferData( GL_ARRAY_BUFFER, nVerts * sizeof(vec2), verts, GL_STATIC_DRAW );
 
-	delete[] verts;
+  glEnableVertexAttribArray( 0 );
+  glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
 
-	// Draw the stroke
+  glBindVertexArray( 0 );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
 
-	glEnableVertexAttribArray( 0 );
-	glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+  delete [] verts;
 
-	glDrawArrays( GL_LINE_STRIP, 0, strip->Number );
+  return cs;
+}
 
-	// Free everything
 
-	glDisableVertexAttribArray( 0 );
-	glDeleteBuffers( 1, &VBO );
-	glDeleteVertexArrays( 1, &VAO );
-      }
 
-      // Move to next position
+// Draw a string.  Strings are laid out once and kept on the GPU, so
+// redrawing an unchanged string costs one uniform and one draw call.
+
+void StrokeFont::drawStrokeString( string str, float x, float y, float height, float theta, Alignment alignment )
+
+{
+  // Find the laid-out string, or lay it out
 
-      xPos += s * schar->Right;
+  CachedString *cs = NULL;
+
+  for (int i=0; i<cache.size(); i++)
+    if (cache[i]->alignment == alignment && cache[i]->text == str) {
+      cs = cache[i];
+      break;
     }
 
+  if (cs == NULL)
+    cs = layoutString( str, alignment );
+
+  cs->lastUsed = ++useCount;
+
+  if (cs->nVerts == 0)
+    return;
+
+  // Draw it
+
+  float s = height / (float) fgStrokeMonoRoman.Height; // scale of letters
+
+  mat4 transform
+    = translate( x, y, 0 )
+    * rotate( theta, vec3(0,0,1) )
+    * scale( s, s, 1 );
+
+  gpuProg->activate();
+  gpuProg->setMat4( MVPLoc, transform );
+
+  glBindVertexArray( cs->VAO );
+  glDrawArrays( GL_LINES, 0, cs->nVerts );
+  glBindVertexArray( 0 );
+
   gpuProg->deactivate();
 }
@@ -7,24 +7,69 @@
 
 #include "headers.h"
 #include "gpuProgram.h"
+#include "seq.h"
 #include <string>
 
 
 typedef enum { LEFT, CENTRE, RIGHT } Alignment;
 
 
+#define NUM_GLYPHS          128  // characters in the stroke font
+#define MAX_CACHED_STRINGS   32  // laid-out strings kept on the GPU
+
+
 class StrokeFont {
 
   static char *fontVertexShader;
   static char *fontFragmentShader;
 
   GPUProgram *gpuProg;
+  GLint       MVPLoc;  // location of "MVP" uniform in 'gpuProg'
+
+  // All glyph strokes, packed once at startup as GL_LINES segments
+  // in font units.  Glyph c occupies glyphVerts[ glyphStart[c] ..
+  // glyphStart[c]+glyphCount[c]-1 ].
+
+  seq<vec2> glyphVerts;
+  int       glyphStart[ NUM_GLYPHS ];
+  int       glyphCount[ NUM_GLYPHS ];
+  float     glyphWidth[ NUM_GLYPHS ];
+
+  // A string that has been laid out in font units and stored in its
+  // own static VBO, so that drawing it again is a single draw call.
+
+  struct CachedString {
+    string       text;
+    Alignment    alignment;
+    GLuint       VAO, VBO;
+    int          nVerts;
+    unsigned int lastUsed;
+  };
+
+  seq<CachedString *> cache;
+  unsigned int        useCount; // for least-recently-used eviction
+
+  void packGlyphs();
+  CachedString *layoutString( string &str, Alignment alignment );
 
  public:
 
   StrokeFont() {
     gpuProg = new GPUProgram();
     gpuProg->init( fontVertexShader, fontFragmentShader, "strokefont" );
+    MVPLoc = gpuProg->uniformLocation( "MVP" );
+
+    useCount = 0;
+    packGlyphs();
+  }
+
+  ~StrokeFont() {
+    for (int i=0; i<cache.size(); i++) {
+      glDeleteBuffers( 1, &cache[i]->VBO );
+      glDeleteVertexArrays( 1, &cache[i]->VAO );
+      delete cache[i];
+    }
+    delete gpuProg;
   }
 
   void drawStrokeString( string str, float x, float y, float height, float theta, Alignment alignment );
@@ -2,10 +2,6 @@
 
 
 #include "texture.h"
-#include "lodepng.h"
-
-
-bool Texture::useMipMaps = false;
 
 
 // Register the current texture with OpenGL, assigning it a textureID.
@@ -35,95 +31,6 @@ void Texture::registerWithOpenGL( )
 
 
 
-void Texture::loadTexture( string filename )
-
-{
-  // Read image
-  
-  std::vector<unsigned char> image;
-
-  unsigned error = lodepng::decode( image, width, height, filename.c_str() );
-
-  if (error)
-    std::cerr << "Error loading '" << filename << "': " << lodepng_error_text(error) << std::endl;
-
-  // Copy image to our own texmap
-  
-  texmap = new GLubyte[ width * height * 4 ];
-
-  GLubyte *p = texmap;
-  for (unsigned int i=0; i<width*height*4; i++)
-    *p++ = image[i];
-
-  hasAlpha = true;
-}
-
-
-
-
-void Texture::createEmptyTexture()
-
-{
-  texmap = new GLubyte[ width * height * 4 ];
-
-  GLubyte *p = texmap;
-  for (unsigned int i=0; i<width*height; i++) {
-    *p++ = 0;
-    *p++ = 0;
-    *p++ = 0;
-    *p++ = 1; // alpha
-  }
-
-  hasAlpha = true;
-}
-
-
-
-void Texture::copyImageFrom( Texture *src )
-
-{
-  // Check that dimensions match
-  
-  if (src->width != width || src->height != height) {
-    cerr << "in Texture::copyImageFrom() the dimensions do not match" << endl;
-    exit(1);
-  }
-
-  if (src->hasAlpha != hasAlpha) {
-    cerr << "in Texture::copyImageFrom() the 'hasAlpha' are not the same" << endl;
-    exit(1);
-  }
-
-  // Copy
-
-  memcpy( texmap, src->texmap, width * height * (hasAlpha ? 4 : 3) );
-}
-
-
-
-
-// Find the texel at x,y for x,y in [0,width-1]x[0,height-1]
-//
-// Return a reference to the texel so that it can be read to and
-// written from.
-//
-// Note that the texel contains 3 bytes if 'hasAlpha' is false and 4
-// bytes if 'hasAlpha' is true.
-
-
-Pixel & Texture::pixel( int x, int y )
-
-{
-  if (x<0) x = 0;
-  if (x>(int)width-1) x = width-1;
-  if (y<0) y = 0;
-  if (y>(int)height-1) y = height-1;
-
-  return * (Pixel*) (texmap + (hasAlpha ? 4 : 3) * (y*width + x));
-}
-
-
-
 // Draw the texture in a region of the window
 
 
@@ -167,7 +74,7 @@ void Texture::draw( vec2 lowerLeft, vec2 upperRight )
   activate( TEX_UNIT_ID );
 
   GPUProg->activate();
-  GPUProg->setInt( "texUnitID", TEX_UNIT_ID );
+  GPUProg->setInt( texUnitIDLoc, TEX_UNIT_ID );
 
   glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 ); // draw the texture
 
@@ -6,108 +6,67 @@
 
 #include "headers.h"
 #include "gpuProgram.h"
+#include "image.h"
 
 
 #define TEX_UNIT_ID 0 // texture unit to use for full-window texture
 
 
-class Pixel { 
- public:
-
-  unsigned char r, g, b, a;
-
-  Pixel() {}
-
-  Pixel( unsigned char rr, unsigned char gg, unsigned char bb, unsigned char aa ) {
-    r = rr; g = gg; b = bb; a = aa;
-  }
-  
-  Pixel( unsigned char rr, unsigned char gg, unsigned char bb ) {
-    r = rr; g = gg; b = bb; a = 255;
-  }
-};
+// An Image that can be drawn with OpenGL.  The pixels are sent to
+// the GPU when the texture is first activated, and again whenever
+// 'updated' is set.
 
-
-class Texture {
+class Texture : public Image {
 
   static char *vertexShader;
   static char *fragmentShader;
   GPUProgram  *GPUProg;
+  GLint        texUnitIDLoc; // location of "texUnitID" uniform in 'GPUProg'
 
   void registerWithOpenGL();
-  void loadTexture( string filename );
 
   bool registeredWithOpenGL; // true once texture is registerd with OpenGL
 
  public:
 
-  GLubyte *texmap; 
-
-  string name;
   GLuint textureID;
-  unsigned int width, height;
-  bool hasAlpha;
-  bool updated; // true if texture was changed.  forces a re-transmission to the GPU.
-
-  static bool useMipMaps;
 
   Texture() {
     GPUProg = NULL;
-    texmap = NULL;
-    updated = false;
   }
 
   // texture from file
 
-  Texture( string filename ) {
+  Texture( string filename ) : Image( filename ) {
 
-    name = filename;
-    loadTexture( filename ); // sets 'texmap'
     GPUProg = NULL;
     registeredWithOpenGL = false;
-    updated = false;
   }
 
   // empty texture
   
-  Texture( unsigned int texWidth, unsigned int texHeight ) {
+  Texture( unsigned int texWidth, unsigned int texHeight ) : Image( texWidth, texHeight ) {
 
     name = "texture";
-    width = texWidth;
-    height = texHeight;
-    createEmptyTexture(); // sets 'texmap'
     GPUProg = NULL;
     registeredWithOpenGL = false;
-    updated = false;
   }
 
   // copy constructor
 
-  Texture( Texture &t ) {
-
-    width    = t.width;
-    height   = t.height;
-    hasAlpha = t.hasAlpha;
-    name     = t.name;
-    
-    texmap = new GLubyte[ width * height * (hasAlpha ? 4 : 3) ];
-    memcpy( texmap, t.texmap, width * height * (hasAlpha ? 4 : 3) );
+  Texture( Texture &t ) : Image( t ) {
 
     // must register this as a new texture, at which time 'GPUProg'
     // and 'textureID' will be set
 
     GPUProg = NULL;
     registeredWithOpenGL = false;
-    updated = false;
   }
 
   // destructor
 
   ~Texture() {
 
-    if (texmap != NULL)
-      delete [] texmap;
-
     if (GPUProg != NULL)
       delete GPUProg;
   }
@@ -117,6 +76,7 @@ class Texture {
     if (!registeredWithOpenGL) {
       GPUProg = new GPUProgram();
       GPUProg->init( vertexShader, fragmentShader, "texture" );
+      texUnitIDLoc = GPUProg->uniformLocation( "texUnitID" );
       registerWithOpenGL();
       registeredWithOpenGL = true;
     }
@@ -134,12 +94,7 @@ class Texture {
     glBindTexture( GL_TEXTURE_2D, 0 );
   }
 
-
-  void createEmptyTexture();
   void draw( vec2 lowerLeft, vec2 upperRight );
-  void copyImageFrom( Texture *src );
-
-  Pixel & pixel( int i, int j );
 };
 
 